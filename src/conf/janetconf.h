@@ -33,10 +33,14 @@
 /* #define JANET_NO_SYMLINKS */
 /* #define JANET_NO_UMASK */
 /* #define JANET_NO_THREADS */
+/* #define JANET_NO_PROFILE */
 
 /* Other settings */
 /* #define JANET_DEBUG */
 /* #define JANET_PRF */
+/* #define JANET_PARALLEL_GC */
+/* #define JANET_JIT */
+/* #define JANET_VM_COUNTERS */
 /* #define JANET_NO_UTC_MKTIME */
 /* #define JANET_OUT_OF_MEMORY do { printf("janet out of memory\n"); exit(1); } while (0) */
 /* #define JANET_EXIT(msg) do { printf("C assert failed executing janet: %s\n", msg); exit(1); } while (0) */
@@ -36,10 +36,7 @@ JanetArray *janet_array(int32_t capacity) {
     Janet *data = NULL;
     if (capacity > 0) {
         janet_vm.next_collection += capacity * sizeof(Janet);
-        data = (Janet *) janet_malloc(sizeof(Janet) * (size_t) capacity);
-        if (NULL == data) {
-            JANET_OUT_OF_MEMORY;
-        }
+        data = (Janet *) janet_gc_data_alloc(sizeof(Janet) * (size_t) capacity);
     }
     array->count = 0;
     array->capacity = capacity;
@@ -52,10 +49,7 @@ JanetArray *janet_array_n(const Janet *elements, int32_t n) {
     JanetArray *array = janet_gcalloc(JANET_MEMORY_ARRAY, sizeof(JanetArray));
     array->capacity = n;
     array->count = n;
-    array->data = janet_malloc(sizeof(Janet) * (size_t) n);
-    if (!array->data) {
-        JANET_OUT_OF_MEMORY;
-    }
+    array->data = janet_gc_data_alloc(sizeof(Janet) * (size_t) n);
     safe_memcpy(array->data, elements, sizeof(Janet) * n);
     return array;
 }
@@ -68,10 +62,8 @@ void janet_array_ensure(JanetArray *array, int32_t capacity, int32_t growth) {
     int64_t new_capacity = ((int64_t) capacity) * growth;
     if (new_capacity > INT32_MAX) new_capacity = INT32_MAX;
     capacity = (int32_t) new_capacity;
-    newData = janet_realloc(old, capacity * sizeof(Janet));
-    if (NULL == newData) {
-        JANET_OUT_OF_MEMORY;
-    }
+    newData = janet_gc_data_realloc(old, (size_t) array->capacity * sizeof(Janet),
+                                    (size_t) capacity * sizeof(Janet));
     janet_vm.next_collection += (capacity - array->capacity) * sizeof(Janet);
     array->data = newData;
     array->capacity = capacity;
@@ -275,16 +267,14 @@ static Janet cfun_array_trim(int32_t argc, Janet *argv) {
     JanetArray *array = janet_getarray(argv, 0);
     if (array->count) {
         if (array->count < array->capacity) {
-            Janet *newData = janet_realloc(array->data, array->count * sizeof(Janet));
-            if (NULL == newData) {
-                JANET_OUT_OF_MEMORY;
-            }
+            Janet *newData = janet_gc_data_realloc(array->data, (size_t) array->capacity * sizeof(Janet),
+                                                   (size_t) array->count * sizeof(Janet));
             array->data = newData;
             array->capacity = array->count;
         }
     } else {
+        janet_gc_data_free(array->data, (size_t) array->capacity * sizeof(Janet));
         array->capacity = 0;
-        janet_free(array->data);
         array->data = NULL;
     }
     return argv[0];
@@ -66,6 +66,8 @@ struct JanetAssembler {
 static const JanetInstructionDef janet_ops[] = {
     {"add", JOP_ADD},
     {"addim", JOP_ADD_IMMEDIATE},
+    {"addimlt", JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF},
+    {"addimltim", JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF},
     {"band", JOP_BAND},
     {"bnot", JOP_BNOT},
     {"bor", JOP_BOR},
@@ -101,6 +103,10 @@ static const JanetInstructionDef janet_ops[] = {
     {"lt", JOP_LESS_THAN},
     {"lte", JOP_LESS_THAN_EQUAL},
     {"ltim", JOP_LESS_THAN_IMMEDIATE},
+    {"ltimjmpif", JOP_LESS_THAN_IMMEDIATE_JUMP_IF},
+    {"ltimjmpno", JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT},
+    {"ltjmpif", JOP_LESS_THAN_JUMP_IF},
+    {"ltjmpno", JOP_LESS_THAN_JUMP_IF_NOT},
     {"mkarr", JOP_MAKE_ARRAY},
     {"mkbtp", JOP_MAKE_BRACKET_TUPLE},
     {"mkbuf", JOP_MAKE_BUFFER},
@@ -138,7 +144,8 @@ static const JanetInstructionDef janet_ops[] = {
     {"sruim", JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE},
     {"sub", JOP_SUBTRACT},
     {"tcall", JOP_TAILCALL},
-    {"tchck", JOP_TYPECHECK}
+    {"tchck", JOP_TYPECHECK},
+    {"wide", JOP_WIDE}
 };
 
 /* Typename aliases for tchck instruction */
@@ -489,7 +496,6 @@ static JanetAssembleResult janet_asm1(JanetAssembler *parent, Janet source, int
     int32_t count, i;
     const Janet *arr;
     Janet x;
-    (void) flags;
 
     /* Initialize funcdef */
     def = janet_funcdef_alloc();
@@ -676,6 +682,15 @@ static JanetAssembleResult janet_asm1(JanetAssembler *parent, Janet source, int
                 def->bytecode[a.bytecode_count++] = op;
             }
         }
+        /* Registers widened by a prefix also need slots */
+        for (i = 0; i + 1 < def->bytecode_length; i++) {
+            int32_t regs[3];
+            if ((def->bytecode[i] & 0x7F) != JOP_WIDE) continue;
+            int32_t nregs = janet_wide_registers(def->bytecode[i], def->bytecode[i + 1], regs);
+            for (int32_t j = 0; j < nregs; j++) {
+                if (regs[j] >= def->slotcount) def->slotcount = regs[j] + 1;
+            }
+        }
     } else {
         janet_asm_error(&a, "bytecode expected");
     }
@@ -721,6 +736,10 @@ static JanetAssembleResult janet_asm1(JanetAssembler *parent, Janet source, int
         janet_asm_error(&a, "invalid assembly");
     }
 
+    if (flags & JANET_ASM_OPTIMIZE) {
+        janet_bytecode_optimize(def);
+    }
+
     /* Add final flags */
     janet_def_addflags(def);
 
@@ -752,6 +771,12 @@ static const JanetInstructionDef *janet_asm_reverse_lookup(uint32_t instr) {
     return NULL;
 }
 
+/* Get the assembly name of an opcode, or NULL if there is none */
+const char *janet_opcode_name(uint32_t opcode) {
+    const JanetInstructionDef *def = janet_asm_reverse_lookup(opcode);
+    return NULL == def ? NULL : def->name;
+}
+
 /* Create some constant sized tuples */
 static const Janet *tup1(Janet x) {
     Janet *tup = janet_tuple_begin(1);
@@ -782,6 +807,7 @@ static const Janet *tup4(Janet w, Janet x, Janet y, Janet z) {
 
 /* Given an argument, convert it to the appropriate integer or symbol */
 Janet janet_asm_decode_instruction(uint32_t instr) {
+    instr = janet_unquicken(instr);
     const JanetInstructionDef *def = janet_asm_reverse_lookup(instr);
     Janet name;
     if (NULL == def) {
@@ -944,9 +970,10 @@ Janet janet_disasm(JanetFuncDef *def) {
 
 /* C Function for assembly */
 static Janet cfun_asm(int32_t argc, Janet *argv) {
-    janet_fixarity(argc, 1);
+    janet_arity(argc, 1, 2);
     JanetAssembleResult res;
-    res = janet_asm(argv[0], 0);
+    int flags = (argc > 1 && janet_truthy(argv[1])) ? JANET_ASM_OPTIMIZE : 0;
+    res = janet_asm(argv[0], flags);
     if (res.status != JANET_ASSEMBLE_OK) {
         janet_panics(res.error);
     }
@@ -979,10 +1006,11 @@ static Janet cfun_disasm(int32_t argc, Janet *argv) {
 static const JanetReg asm_cfuns[] = {
     {
         "asm", cfun_asm,
-        JDOC("(asm assembly)\n\n"
+        JDOC("(asm assembly &opt optimize)\n\n"
              "Returns a new function that is the compiled result of the assembly.\n"
              "The syntax for the assembly can be found on the Janet website, and should correspond\n"
-             "to the return value of disasm. Will throw an\n"
+             "to the return value of disasm. If optimize is truthy, run the same peephole\n"
+             "optimizer as the compiler on the bytecode. Will throw an\n"
              "error on invalid assembly.")
     },
     {
@@ -33,10 +33,7 @@ JanetBuffer *janet_buffer_init(JanetBuffer *buffer, int32_t capacity) {
     uint8_t *data = NULL;
     if (capacity < 4) capacity = 4;
     janet_gcpressure(capacity);
-    data = janet_malloc(sizeof(uint8_t) * (size_t) capacity);
-    if (NULL == data) {
-        JANET_OUT_OF_MEMORY;
-    }
+    data = janet_gc_data_alloc(sizeof(uint8_t) * (size_t) capacity);
     buffer->count = 0;
     buffer->capacity = capacity;
     buffer->data = data;
@@ -45,7 +42,7 @@ JanetBuffer *janet_buffer_init(JanetBuffer *buffer, int32_t capacity) {
 
 /* Deinitialize a buffer (free data memory) */
 void janet_buffer_deinit(JanetBuffer *buffer) {
-    janet_free(buffer->data);
+    janet_gc_data_free(buffer->data, (size_t) buffer->capacity);
 }
 
 /* Initialize a buffer */
@@ -62,10 +59,7 @@ void janet_buffer_ensure(JanetBuffer *buffer, int32_t capacity, int32_t growth)
     int64_t big_capacity = ((int64_t) capacity) * growth;
     capacity = big_capacity > INT32_MAX ? INT32_MAX : (int32_t) big_capacity;
     janet_gcpressure(capacity - buffer->capacity);
-    new_data = janet_realloc(old, (size_t) capacity * sizeof(uint8_t));
-    if (NULL == new_data) {
-        JANET_OUT_OF_MEMORY;
-    }
+    new_data = janet_gc_data_realloc(old, (size_t) buffer->capacity, (size_t) capacity * sizeof(uint8_t));
     buffer->data = new_data;
     buffer->capacity = capacity;
 }
@@ -92,11 +86,9 @@ void janet_buffer_extra(JanetBuffer *buffer, int32_t n) {
     int32_t new_size = buffer->count + n;
     if (new_size > buffer->capacity) {
         int32_t new_capacity = (new_size > (INT32_MAX / 2)) ? INT32_MAX : (new_size * 2);
-        uint8_t *new_data = janet_realloc(buffer->data, new_capacity * sizeof(uint8_t));
+        uint8_t *new_data = janet_gc_data_realloc(buffer->data, (size_t) buffer->capacity,
+                            (size_t) new_capacity * sizeof(uint8_t));
         janet_gcpressure(new_capacity - buffer->capacity);
-        if (NULL == new_data) {
-            JANET_OUT_OF_MEMORY;
-        }
         buffer->data = new_data;
         buffer->capacity = new_capacity;
     }
@@ -201,10 +193,7 @@ static Janet cfun_buffer_trim(int32_t argc, Janet *argv) {
     JanetBuffer *buffer = janet_getbuffer(argv, 0);
     if (buffer->count < buffer->capacity) {
         int32_t newcap = buffer->count > 4 ? buffer->count : 4;
-        uint8_t *newData = janet_realloc(buffer->data, newcap);
-        if (NULL == newData) {
-            JANET_OUT_OF_MEMORY;
-        }
+        uint8_t *newData = janet_gc_data_realloc(buffer->data, (size_t) buffer->capacity, (size_t) newcap);
         buffer->data = newData;
         buffer->capacity = newcap;
     }
@@ -103,9 +103,115 @@ enum JanetInstructionType janet_instructions[JOP_INSTRUCTION_COUNT] = {
     JINT_SSS, /* JOP_NEXT */
     JINT_SSS, /* JOP_NOT_EQUALS, */
     JINT_SSI, /* JOP_NOT_EQUALS_IMMEDIATE, */
-    JINT_SSS /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_CANCEL, */
+    JINT_SSS, /* JOP_LESS_THAN_JUMP_IF_NOT, */
+    JINT_SSI, /* JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT, */
+    JINT_SSU, /* JOP_WIDE, */
+    JINT_SSS, /* JOP_LESS_THAN_JUMP_IF, */
+    JINT_SSI, /* JOP_LESS_THAN_IMMEDIATE_JUMP_IF, */
+    JINT_SSI, /* JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF, */
+    JINT_SSI /* JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF, */
 };
 
+/* Get the first instruction of a superinstruction. The instructions after
+ * it are still in the bytecode, so this is how passes that work on single
+ * instructions see a superinstruction. Other instructions are returned as
+ * they are. */
+uint32_t janet_unfuse(uint32_t instr) {
+    uint32_t op;
+    switch (instr & 0x7F) {
+        default:
+            return instr;
+        case JOP_LESS_THAN_JUMP_IF_NOT:
+        case JOP_LESS_THAN_JUMP_IF:
+            op = JOP_LESS_THAN;
+            break;
+        case JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT:
+        case JOP_LESS_THAN_IMMEDIATE_JUMP_IF:
+            op = JOP_LESS_THAN_IMMEDIATE;
+            break;
+        case JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF:
+        case JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF:
+            op = JOP_ADD_IMMEDIATE;
+            break;
+    }
+    return (instr & ~((uint32_t) 0x7F)) | op;
+}
+
+/* Get the registers of an instruction after a JOP_WIDE prefix, which holds
+ * the high bytes of its A, B and C operands. Returns the number of registers
+ * put in regs, or -1 if the instruction can not follow a prefix. */
+int32_t janet_wide_registers(uint32_t wide, uint32_t instr, int32_t *regs) {
+    int32_t a = (int32_t)(((instr >> 8) & 0xFF) | (wide & 0xFF00));
+    int32_t b = (int32_t)(((instr >> 16) & 0xFF) | ((wide >> 8) & 0xFF00));
+    int32_t c = (int32_t)((instr >> 24) | ((wide >> 16) & 0xFF00));
+    switch (instr & 0x7F) {
+        default:
+            return -1;
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_EQUALS:
+        case JOP_NOT_EQUALS:
+        case JOP_COMPARE:
+        case JOP_IN:
+        case JOP_GET:
+        case JOP_PUT:
+        case JOP_NEXT:
+            regs[0] = a;
+            regs[1] = b;
+            regs[2] = c;
+            return 3;
+        case JOP_ADD_IMMEDIATE:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_GET_INDEX:
+        case JOP_PUT_INDEX:
+            if (wide >> 24) return -1;
+            regs[0] = a;
+            regs[1] = b;
+            return 2;
+        case JOP_MOVE_NEAR:
+        case JOP_MOVE_FAR:
+        case JOP_BNOT:
+        case JOP_LENGTH:
+            if (wide >> 16) return -1;
+            regs[0] = a;
+            regs[1] = (int32_t)(instr >> 16);
+            return 2;
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_TYPECHECK:
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+            if (wide >> 16) return -1;
+            regs[0] = a;
+            return 1;
+    }
+}
+
 /* Verify some bytecode */
 int janet_verify(JanetFuncDef *def) {
     int vargs = !!(def->flags & JANET_FUNCDEF_FLAG_VARARG);
@@ -124,6 +230,45 @@ int janet_verify(JanetFuncDef *def) {
         if ((instr & 0x7F) >= JOP_INSTRUCTION_COUNT) {
             return 3;
         }
+        /* Superinstructions also run the instruction after them */
+        switch (instr & 0x7F) {
+            default:
+                break;
+            case JOP_LESS_THAN_JUMP_IF_NOT:
+            case JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT:
+                if (i + 1 >= def->bytecode_length) return 10;
+                if ((def->bytecode[i + 1] & 0x7F) != JOP_JUMP_IF_NOT) return 10;
+                if (((def->bytecode[i + 1] >> 8) & 0xFF) != ((instr >> 8) & 0xFF)) return 10;
+                break;
+            case JOP_LESS_THAN_JUMP_IF:
+            case JOP_LESS_THAN_IMMEDIATE_JUMP_IF:
+                if (i + 1 >= def->bytecode_length) return 10;
+                if ((def->bytecode[i + 1] & 0x7F) != JOP_JUMP_IF) return 10;
+                if (((def->bytecode[i + 1] >> 8) & 0xFF) != ((instr >> 8) & 0xFF)) return 10;
+                break;
+            case JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF:
+            case JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF: {
+                /* The comparison reads the register the addition writes */
+                uint32_t next = (instr & 0x7F) == JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF
+                                ? JOP_LESS_THAN_JUMP_IF
+                                : JOP_LESS_THAN_IMMEDIATE_JUMP_IF;
+                if (i + 1 >= def->bytecode_length) return 10;
+                if ((def->bytecode[i + 1] & 0x7F) != next) return 10;
+                if (((def->bytecode[i + 1] >> 16) & 0xFF) != ((instr >> 8) & 0xFF)) return 10;
+                break;
+            }
+            case JOP_WIDE: {
+                /* The prefix widens the registers of the next instruction */
+                int32_t regs[3];
+                if (i + 1 >= def->bytecode_length) return 11;
+                int32_t nregs = janet_wide_registers(instr, def->bytecode[i + 1], regs);
+                if (nregs < 0) return 11;
+                for (int32_t j = 0; j < nregs; j++) {
+                    if (regs[j] >= sc) return 4;
+                }
+                continue;
+            }
+        }
         enum JanetInstructionType type = janet_instructions[instr & 0x7F];
         switch (type) {
             case JINT_0:
@@ -208,6 +353,726 @@ int janet_verify(JanetFuncDef *def) {
     return 0;
 }
 
+/* Peephole optimizer. It runs on finished bytecode, so it works the same on
+ * compiled and assembled functions. Each round threads jumps, drops
+ * unreachable instructions and jumps to the next instruction, then uses slot
+ * liveness to fold moves into the instructions next to them and to drop
+ * moves and loads whose result is never read. Deleted instructions fall
+ * through to the next one, which is where jumps to them are moved. When the
+ * rounds are done, slots are renumbered to share registers. */
+
+#define JANET_PEEPHOLE_ROUNDS 8
+/* Skip the liveness based passes for functions that would need too much memory */
+#define JANET_PEEPHOLE_MAX_LIVE 0x100000
+
+/* Operand fields */
+#define JANET_FIELD_A 1
+#define JANET_FIELD_B 2
+#define JANET_FIELD_C 3
+#define JANET_FIELD_D 4
+#define JANET_FIELD_E 5
+
+#define JANET_PEEP_TARGET 1
+#define JANET_PEEP_REACHED 2
+#define JANET_PEEP_DELETE 4
+#define JANET_PEEP_TOUCHED 8
+
+typedef struct {
+    uint8_t reads[3];
+    int32_t nreads;
+    uint8_t write;
+    int pure;
+} JanetPeepholeUse;
+
+typedef struct {
+    uint32_t *bytecode;
+    JanetSourceMapping *sourcemap;
+    int32_t n;
+    int32_t words;
+    const uint32_t *pinned;
+    int pin_all;
+    uint8_t *marks;
+    int32_t *remap;
+    uint32_t *live_in;
+    uint32_t *live_out;
+} JanetPeephole;
+
+static int32_t janet_field_get(uint32_t instr, int field) {
+    switch (field) {
+        default:
+        case JANET_FIELD_A:
+            return (int32_t)((instr >> 8) & 0xFF);
+        case JANET_FIELD_B:
+            return (int32_t)((instr >> 16) & 0xFF);
+        case JANET_FIELD_C:
+            return (int32_t)(instr >> 24);
+        case JANET_FIELD_D:
+            return (int32_t)(instr >> 8);
+        case JANET_FIELD_E:
+            return (int32_t)(instr >> 16);
+    }
+}
+
+/* Put a slot in an operand field. Returns 0 if it does not fit. */
+static int janet_field_set(uint32_t *instr, int field, int32_t value) {
+    uint32_t v = (uint32_t) value;
+    switch (field) {
+        default:
+        case JANET_FIELD_A:
+            if (v > 0xFF) return 0;
+            *instr = (*instr & ~0xFF00u) | (v << 8);
+            return 1;
+        case JANET_FIELD_B:
+            if (v > 0xFF) return 0;
+            *instr = (*instr & ~0xFF0000u) | (v << 16);
+            return 1;
+        case JANET_FIELD_C:
+            if (v > 0xFF) return 0;
+            *instr = (*instr & 0xFFFFFFu) | (v << 24);
+            return 1;
+        case JANET_FIELD_D:
+            if (v > 0xFFFFFF) return 0;
+            *instr = (*instr & 0xFFu) | (v << 8);
+            return 1;
+        case JANET_FIELD_E:
+            if (v > 0xFFFF) return 0;
+            *instr = (*instr & 0xFFFFu) | (v << 16);
+            return 1;
+    }
+}
+
+/* Find the slots an instruction reads and writes. Returns 0 for
+ * instructions the optimizer does not handle. */
+static int janet_peephole_uses(uint32_t instr, JanetPeepholeUse *u) {
+    u->nreads = 0;
+    u->write = 0;
+    u->pure = 0;
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_NOOP:
+        case JOP_RETURN_NIL:
+        case JOP_JUMP:
+            break;
+        case JOP_ERROR:
+        case JOP_TYPECHECK:
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+        case JOP_SET_UPVALUE:
+            u->reads[u->nreads++] = JANET_FIELD_A;
+            break;
+        case JOP_RETURN:
+        case JOP_PUSH:
+        case JOP_PUSH_ARRAY:
+        case JOP_TAILCALL:
+            u->reads[u->nreads++] = JANET_FIELD_D;
+            break;
+        case JOP_ADD_IMMEDIATE:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_GET_INDEX:
+        case JOP_SIGNAL:
+            u->write = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_B;
+            break;
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_EQUALS:
+        case JOP_NOT_EQUALS:
+        case JOP_COMPARE:
+        case JOP_IN:
+        case JOP_GET:
+        case JOP_NEXT:
+        case JOP_RESUME:
+        case JOP_PROPAGATE:
+        case JOP_CANCEL:
+            u->write = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_B;
+            u->reads[u->nreads++] = JANET_FIELD_C;
+            break;
+        case JOP_BNOT:
+        case JOP_LENGTH:
+        case JOP_CALL:
+            u->write = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_E;
+            break;
+        case JOP_MOVE_NEAR:
+            u->write = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_E;
+            u->pure = 1;
+            break;
+        case JOP_MOVE_FAR:
+            u->write = JANET_FIELD_E;
+            u->reads[u->nreads++] = JANET_FIELD_A;
+            u->pure = 1;
+            break;
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+            u->write = JANET_FIELD_A;
+            u->pure = 1;
+            break;
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_SELF:
+            u->write = JANET_FIELD_D;
+            u->pure = 1;
+            break;
+        case JOP_LOAD_UPVALUE:
+        case JOP_CLOSURE:
+            u->write = JANET_FIELD_A;
+            break;
+        case JOP_MAKE_ARRAY:
+        case JOP_MAKE_BUFFER:
+        case JOP_MAKE_STRING:
+        case JOP_MAKE_STRUCT:
+        case JOP_MAKE_TABLE:
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            u->write = JANET_FIELD_D;
+            break;
+        case JOP_PUSH_2:
+            u->reads[u->nreads++] = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_E;
+            break;
+        case JOP_PUSH_3:
+        case JOP_PUT:
+            u->reads[u->nreads++] = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_B;
+            u->reads[u->nreads++] = JANET_FIELD_C;
+            break;
+        case JOP_PUT_INDEX:
+            u->reads[u->nreads++] = JANET_FIELD_A;
+            u->reads[u->nreads++] = JANET_FIELD_B;
+            break;
+    }
+    return 1;
+}
+
+static int janet_peephole_branch(uint32_t op) {
+    return op == JOP_JUMP_IF || op == JOP_JUMP_IF_NOT ||
+           op == JOP_JUMP_IF_NIL || op == JOP_JUMP_IF_NOT_NIL;
+}
+
+/* Get the jump target of an instruction, or -1 */
+static int32_t janet_peephole_target(const uint32_t *bytecode, int32_t i) {
+    uint32_t instr = bytecode[i];
+    if ((instr & 0x7F) == JOP_JUMP) return i + ((int32_t) instr >> 8);
+    if (janet_peephole_branch(instr & 0x7F)) return i + ((int32_t) instr >> 16);
+    return -1;
+}
+
+static int janet_peephole_retarget(uint32_t *bytecode, int32_t i, int32_t target) {
+    int32_t offset = target - i;
+    if ((bytecode[i] & 0x7F) == JOP_JUMP) {
+        if (offset < -0x800000 || offset > 0x7FFFFF) return 0;
+        bytecode[i] = (bytecode[i] & 0xFFu) | ((uint32_t) offset << 8);
+    } else {
+        if (offset < INT16_MIN || offset > INT16_MAX) return 0;
+        bytecode[i] = (bytecode[i] & 0xFFFFu) | ((uint32_t) offset << 16);
+    }
+    return 1;
+}
+
+static int janet_peephole_falls(uint32_t op) {
+    switch (op) {
+        default:
+            return 1;
+        case JOP_JUMP:
+        case JOP_RETURN:
+        case JOP_RETURN_NIL:
+        case JOP_ERROR:
+        case JOP_TAILCALL:
+            return 0;
+    }
+}
+
+/* Branches that jump exactly when the other does not */
+static uint32_t janet_peephole_opposite(uint32_t op) {
+    switch (op) {
+        default:
+            return JOP_INSTRUCTION_COUNT;
+        case JOP_JUMP_IF:
+            return JOP_JUMP_IF_NOT;
+        case JOP_JUMP_IF_NOT:
+            return JOP_JUMP_IF;
+        case JOP_JUMP_IF_NIL:
+            return JOP_JUMP_IF_NOT_NIL;
+        case JOP_JUMP_IF_NOT_NIL:
+            return JOP_JUMP_IF_NIL;
+    }
+}
+
+/* Point jumps past jumps they land on, and replace jumps to a return
+ * with the return. */
+static int janet_peephole_thread(JanetPeephole *p) {
+    uint32_t *bc = p->bytecode;
+    int changed = 0;
+    for (int32_t i = 0; i < p->n; i++) {
+        uint32_t op = bc[i] & 0x7F;
+        int32_t target = janet_peephole_target(bc, i);
+        if (target < 0) continue;
+        int32_t to = target;
+        for (int32_t steps = 0; steps < p->n; steps++) {
+            uint32_t next = bc[to];
+            uint32_t nextop = next & 0x7F;
+            int32_t nextto;
+            if (nextop == JOP_JUMP) {
+                nextto = janet_peephole_target(bc, to);
+            } else if (op != JOP_JUMP && ((next >> 8) & 0xFF) == ((bc[i] >> 8) & 0xFF)) {
+                /* A branch on the same slot has the same outcome */
+                if (nextop == op) {
+                    nextto = janet_peephole_target(bc, to);
+                } else if (nextop == janet_peephole_opposite(op) && to + 1 < p->n) {
+                    nextto = to + 1;
+                } else {
+                    break;
+                }
+            } else {
+                break;
+            }
+            if (nextto == to) break;
+            to = nextto;
+        }
+        uint32_t toop = bc[to] & 0x7F;
+        if (op == JOP_JUMP && (toop == JOP_RETURN || toop == JOP_RETURN_NIL)) {
+            bc[i] = bc[to];
+            changed = 1;
+        } else if (to != target && janet_peephole_retarget(bc, i, to)) {
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Mark unreachable instructions, no-ops and jumps to the next instruction
+ * for deletion. */
+static int janet_peephole_reach(JanetPeephole *p) {
+    uint32_t *bc = p->bytecode;
+    int32_t *stack = p->remap;
+    int32_t top = 0;
+    int changed = 0;
+    for (int32_t i = 0; i < p->n; i++) p->marks[i] = 0;
+    p->marks[0] = JANET_PEEP_REACHED;
+    stack[top++] = 0;
+    while (top) {
+        int32_t i = stack[--top];
+        int32_t succ[2];
+        int32_t nsucc = 0;
+        if (janet_peephole_falls(bc[i] & 0x7F) && i + 1 < p->n) succ[nsucc++] = i + 1;
+        int32_t target = janet_peephole_target(bc, i);
+        if (target >= 0 && target < p->n) succ[nsucc++] = target;
+        for (int32_t j = 0; j < nsucc; j++) {
+            if (!(p->marks[succ[j]] & JANET_PEEP_REACHED)) {
+                p->marks[succ[j]] |= JANET_PEEP_REACHED;
+                stack[top++] = succ[j];
+            }
+        }
+    }
+    for (int32_t i = 0; i < p->n; i++) {
+        if (!(p->marks[i] & JANET_PEEP_REACHED) ||
+                (bc[i] & 0x7F) == JOP_NOOP ||
+                janet_peephole_target(bc, i) == i + 1) {
+            p->marks[i] |= JANET_PEEP_DELETE;
+            changed = 1;
+        }
+    }
+    return changed;
+}
+
+/* Remove the instructions marked for deletion */
+static void janet_peephole_compact(JanetPeephole *p) {
+    uint32_t *bc = p->bytecode;
+    int32_t j = 0;
+    for (int32_t i = 0; i < p->n; i++) {
+        p->remap[i] = j;
+        if (!(p->marks[i] & JANET_PEEP_DELETE)) j++;
+    }
+    p->remap[p->n] = j;
+    for (int32_t i = 0; i < p->n; i++) {
+        if (p->marks[i] & JANET_PEEP_DELETE) continue;
+        int32_t target = janet_peephole_target(bc, i);
+        if (target >= 0) janet_peephole_retarget(bc, i, i + p->remap[target] - p->remap[i]);
+        bc[p->remap[i]] = bc[i];
+        if (NULL != p->sourcemap) p->sourcemap[p->remap[i]] = p->sourcemap[i];
+    }
+    for (int32_t i = 0; i < j; i++) p->marks[i] = 0;
+    p->n = j;
+}
+
+static int janet_peephole_pinned(JanetPeephole *p, int32_t slot) {
+    return p->pin_all || (NULL != p->pinned && (p->pinned[slot >> 5] & (1U << (slot & 31))));
+}
+
+/* Check if a slot is never read after instruction i */
+static int janet_peephole_dead(JanetPeephole *p, int32_t i, int32_t slot) {
+    return !(p->live_out[(size_t) i * p->words + (slot >> 5)] & (1U << (slot & 31))) &&
+           !janet_peephole_pinned(p, slot);
+}
+
+/* Find the slots that are live after each instruction */
+static void janet_peephole_liveness(JanetPeephole *p) {
+    uint32_t *bc = p->bytecode;
+    int32_t words = p->words;
+    size_t size = sizeof(uint32_t) * (size_t) p->n * (size_t) words;
+    memset(p->live_in, 0, size);
+    memset(p->live_out, 0, size);
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int32_t i = p->n - 1; i >= 0; i--) {
+            uint32_t *out = p->live_out + (size_t) i * words;
+            uint32_t *in = p->live_in + (size_t) i * words;
+            int32_t target = janet_peephole_target(bc, i);
+            if (janet_peephole_falls(bc[i] & 0x7F) && i + 1 < p->n) {
+                const uint32_t *next = p->live_in + (size_t)(i + 1) * words;
+                for (int32_t w = 0; w < words; w++) out[w] |= next[w];
+            }
+            if (target >= 0 && target < p->n) {
+                const uint32_t *next = p->live_in + (size_t) target * words;
+                for (int32_t w = 0; w < words; w++) out[w] |= next[w];
+            }
+            JanetPeepholeUse u;
+            janet_peephole_uses(bc[i], &u);
+            int32_t wslot = u.write ? janet_field_get(bc[i], u.write) : -1;
+            for (int32_t w = 0; w < words; w++) {
+                uint32_t bits = out[w];
+                if (wslot >= 0 && (wslot >> 5) == w) bits &= ~(1U << (wslot & 31));
+                for (int32_t r = 0; r < u.nreads; r++) {
+                    int32_t rslot = janet_field_get(bc[i], u.reads[r]);
+                    if ((rslot >> 5) == w) bits |= 1U << (rslot & 31);
+                }
+                if (bits & ~in[w]) {
+                    in[w] |= bits;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static int janet_peephole_move(uint32_t instr, int32_t *dest, int32_t *src) {
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_MOVE_NEAR:
+            *dest = (instr >> 8) & 0xFF;
+            *src = instr >> 16;
+            return 1;
+        case JOP_MOVE_FAR:
+            *dest = instr >> 16;
+            *src = (instr >> 8) & 0xFF;
+            return 1;
+    }
+}
+
+/* Fold moves into the instructions next to them and drop dead stores */
+static int janet_peephole_slots(JanetPeephole *p) {
+    uint32_t *bc = p->bytecode;
+    int changed = 0;
+    for (int32_t i = 0; i < p->n; i++) {
+        int32_t target = janet_peephole_target(bc, i);
+        if (target >= 0 && target < p->n) p->marks[target] |= JANET_PEEP_TARGET;
+    }
+    janet_peephole_liveness(p);
+    for (int32_t i = 0; i < p->n; i++) {
+        if (p->marks[i] & JANET_PEEP_TOUCHED) continue;
+        JanetPeepholeUse u;
+        janet_peephole_uses(bc[i], &u);
+        int32_t wslot = u.write ? janet_field_get(bc[i], u.write) : -1;
+        int32_t dest = -1, src = -1;
+        int move = janet_peephole_move(bc[i], &dest, &src);
+
+        /* Moves to the same slot and dead stores */
+        if ((move && dest == src) || (u.pure && janet_peephole_dead(p, i, wslot))) {
+            p->marks[i] |= JANET_PEEP_DELETE | JANET_PEEP_TOUCHED;
+            changed = 1;
+            continue;
+        }
+        if (i + 1 >= p->n || (p->marks[i + 1] & (JANET_PEEP_TARGET | JANET_PEEP_TOUCHED))) continue;
+
+        /* Write straight to the destination of a following move */
+        int32_t ndest, nsrc;
+        if (wslot >= 0 && janet_peephole_move(bc[i + 1], &ndest, &nsrc) &&
+                nsrc == wslot && ndest != wslot &&
+                janet_peephole_dead(p, i + 1, wslot) &&
+                !janet_peephole_pinned(p, ndest)) {
+            uint32_t instr = bc[i];
+            if (janet_field_set(&instr, u.write, ndest)) {
+                bc[i] = instr;
+                p->marks[i] |= JANET_PEEP_TOUCHED;
+                p->marks[i + 1] |= JANET_PEEP_DELETE | JANET_PEEP_TOUCHED;
+                changed = 1;
+                continue;
+            }
+        }
+
+        /* Read the source of a move in the next instruction */
+        if (move && !janet_peephole_pinned(p, dest)) {
+            JanetPeepholeUse nu;
+            janet_peephole_uses(bc[i + 1], &nu);
+            int32_t nwslot = nu.write ? janet_field_get(bc[i + 1], nu.write) : -1;
+            if (nwslot != dest && !janet_peephole_dead(p, i + 1, dest)) continue;
+            uint32_t instr = bc[i + 1];
+            int found = 0, ok = 1;
+            for (int32_t r = 0; r < nu.nreads; r++) {
+                if (janet_field_get(bc[i + 1], nu.reads[r]) != dest) continue;
+                found = 1;
+                if (!janet_field_set(&instr, nu.reads[r], src)) ok = 0;
+            }
+            if (found && ok) {
+                bc[i + 1] = instr;
+                p->marks[i] |= JANET_PEEP_DELETE | JANET_PEEP_TOUCHED;
+                p->marks[i + 1] |= JANET_PEEP_TOUCHED;
+                changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+/* Slot kinds for register allocation */
+#define JANET_ALLOC_UNUSED 0
+#define JANET_ALLOC_FREE 1
+#define JANET_ALLOC_FIXED 2
+#define JANET_ALLOC_DONE 3
+
+/* Renumber the slots of a function so that slots that are never live at the
+ * same time share a register. The compiler keeps the registers of a scope
+ * until the scope ends, so this mostly packs temporaries and the locals of
+ * sibling scopes. Slots captured by closures keep their place, and so do
+ * slots read before they are written, which hold the arguments or start out
+ * nil. Parameters that are never read can be reused, as the compiler sets
+ * the arity of a function after optimizing it. Slots are colored greedily in
+ * order of first use, preferring the slot a move copies from. Returns 1 if
+ * the function needs fewer slots. */
+static int janet_peephole_allocate(JanetPeephole *p, JanetFuncDef *def) {
+    uint32_t *bc = p->bytecode;
+    int32_t sc = def->slotcount;
+    int32_t words = p->words;
+    if ((int64_t) sc * words > JANET_PEEPHOLE_MAX_LIVE) return 0;
+    uint8_t *kind = janet_calloc((size_t) sc, 1);
+    int32_t *order = janet_malloc(sizeof(int32_t) * (size_t) sc);
+    int32_t *color = janet_malloc(sizeof(int32_t) * (size_t) sc);
+    int32_t *prefer = janet_malloc(sizeof(int32_t) * (size_t) sc);
+    uint32_t *interfere = janet_calloc((size_t) sc * (size_t) words, sizeof(uint32_t));
+    uint32_t *taken = janet_malloc(sizeof(uint32_t) * (size_t) words);
+    uint32_t *copy = janet_malloc(sizeof(uint32_t) * (size_t) p->n);
+    if (NULL == kind || NULL == order || NULL == color || NULL == prefer ||
+            NULL == interfere || NULL == taken || NULL == copy) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_peephole_liveness(p);
+
+    /* Find the slots in use in order of first use */
+    int32_t norder = 0;
+    for (int32_t s = 0; s < sc; s++) {
+        color[s] = s;
+        prefer[s] = -1;
+    }
+    for (int32_t i = 0; i < p->n; i++) {
+        JanetPeepholeUse u;
+        janet_peephole_uses(bc[i], &u);
+        int fields[4];
+        int32_t nfields = 0;
+        if (u.write) fields[nfields++] = u.write;
+        for (int32_t r = 0; r < u.nreads; r++) fields[nfields++] = u.reads[r];
+        for (int32_t f = 0; f < nfields; f++) {
+            int32_t slot = janet_field_get(bc[i], fields[f]);
+            if (kind[slot] != JANET_ALLOC_UNUSED) continue;
+            kind[slot] = JANET_ALLOC_FREE;
+            order[norder++] = slot;
+        }
+    }
+    for (int32_t s = 0; s < sc; s++) {
+        if (janet_peephole_pinned(p, s) || (p->live_in[s >> 5] & (1U << (s & 31)))) {
+            kind[s] = JANET_ALLOC_FIXED;
+        }
+    }
+
+    /* A slot written while another is live interferes with it. A move does
+     * not make its source and destination interfere. */
+    for (int32_t i = 0; i < p->n; i++) {
+        JanetPeepholeUse u;
+        janet_peephole_uses(bc[i], &u);
+        if (!u.write) continue;
+        int32_t w = janet_field_get(bc[i], u.write);
+        int32_t dest = -1, src = -1;
+        if (janet_peephole_move(bc[i], &dest, &src) && prefer[w] < 0) prefer[w] = src;
+        const uint32_t *out = p->live_out + (size_t) i * words;
+        for (int32_t wd = 0; wd < words; wd++) {
+            uint32_t bits = out[wd];
+            while (bits) {
+                int32_t b = 0;
+                while (!(bits & (1U << b))) b++;
+                bits &= ~(1U << b);
+                int32_t other = (wd << 5) + b;
+                if (other == w || other == src) continue;
+                interfere[(size_t) w * words + (other >> 5)] |= 1U << (other & 31);
+                interfere[(size_t) other * words + (w >> 5)] |= 1U << (w & 31);
+            }
+        }
+    }
+
+    /* Color the free slots */
+    int32_t newcount = 0;
+    for (int32_t s = 0; s < sc; s++) {
+        if (kind[s] == JANET_ALLOC_FIXED && s + 1 > newcount) newcount = s + 1;
+    }
+    for (int32_t k = 0; k < norder; k++) {
+        int32_t s = order[k];
+        if (kind[s] != JANET_ALLOC_FREE) continue;
+        for (int32_t wd = 0; wd < words; wd++) taken[wd] = 0;
+        for (int32_t t = 0; t < sc; t++) {
+            if (kind[t] == JANET_ALLOC_FIXED) {
+                taken[t >> 5] |= 1U << (t & 31);
+            } else if (kind[t] == JANET_ALLOC_DONE &&
+                       (interfere[(size_t) s * words + (t >> 5)] & (1U << (t & 31)))) {
+                taken[color[t] >> 5] |= 1U << (color[t] & 31);
+            }
+        }
+        int32_t c = -1;
+        if (prefer[s] >= 0) {
+            int32_t pc = color[prefer[s]];
+            if (!(taken[pc >> 5] & (1U << (pc & 31)))) c = pc;
+        }
+        for (int32_t t = 0; c < 0 && t < sc; t++) {
+            if (!(taken[t >> 5] & (1U << (t & 31)))) c = t;
+        }
+        color[s] = c;
+        kind[s] = JANET_ALLOC_DONE;
+        if (c + 1 > newcount) newcount = c + 1;
+    }
+
+    /* Rename the slots if that saves any */
+    int ok = newcount < sc;
+    for (int32_t i = 0; ok && i < p->n; i++) {
+        copy[i] = bc[i];
+        if (!janet_bytecode_rename(copy + i, color, sc)) ok = 0;
+    }
+    if (ok) {
+        memcpy(bc, copy, sizeof(uint32_t) * (size_t) p->n);
+        def->slotcount = newcount;
+    }
+
+    janet_free(kind);
+    janet_free(order);
+    janet_free(color);
+    janet_free(prefer);
+    janet_free(interfere);
+    janet_free(taken);
+    janet_free(copy);
+    return ok;
+}
+
+static void janet_peephole_rounds(JanetPeephole *p, int slots) {
+    for (int round = 0; round < JANET_PEEPHOLE_ROUNDS; round++) {
+        int changed = janet_peephole_thread(p);
+        if (janet_peephole_reach(p)) {
+            janet_peephole_compact(p);
+            changed = 1;
+        }
+        if (slots && janet_peephole_slots(p)) {
+            janet_peephole_compact(p);
+            changed = 1;
+        }
+        for (int32_t i = 0; i < p->n; i++) p->marks[i] = 0;
+        if (!changed) break;
+    }
+}
+
+/* Optimize the bytecode of a function in place */
+void janet_bytecode_optimize(JanetFuncDef *def) {
+    JanetPeephole p;
+    p.n = def->bytecode_length;
+    if (p.n == 0) return;
+    for (int32_t i = 0; i < p.n; i++) {
+        uint32_t instr = def->bytecode[i];
+        JanetPeepholeUse u;
+        if ((instr & 0x80) || !janet_peephole_uses(instr, &u)) return;
+        if (u.write && janet_field_get(instr, u.write) >= def->slotcount) return;
+        for (int32_t r = 0; r < u.nreads; r++) {
+            if (janet_field_get(instr, u.reads[r]) >= def->slotcount) return;
+        }
+    }
+    p.bytecode = def->bytecode;
+    p.sourcemap = def->sourcemap;
+    p.words = (def->slotcount + 31) >> 5;
+    p.pinned = def->closure_bitset;
+    /* Without a bitset, a closure that captures the frame can read any slot */
+    p.pin_all = 0;
+    if (NULL == def->closure_bitset) {
+        for (int32_t i = 0; i < def->defs_length; i++) {
+            JanetFuncDef *sub = def->defs[i];
+            for (int32_t j = 0; j < sub->environments_length; j++) {
+                if (sub->environments[j] < 0) p.pin_all = 1;
+            }
+        }
+    }
+    int slots = !p.pin_all && p.words > 0 && (int64_t) p.n * p.words <= JANET_PEEPHOLE_MAX_LIVE;
+    p.marks = janet_calloc((size_t) p.n, 1);
+    p.remap = janet_malloc(sizeof(int32_t) * ((size_t) p.n + 1));
+    p.live_in = slots ? janet_malloc(sizeof(uint32_t) * (size_t) p.n * (size_t) p.words) : NULL;
+    p.live_out = slots ? janet_malloc(sizeof(uint32_t) * (size_t) p.n * (size_t) p.words) : NULL;
+    if (NULL == p.marks || NULL == p.remap || (slots && (NULL == p.live_in || NULL == p.live_out))) {
+        JANET_OUT_OF_MEMORY;
+    }
+
+    janet_peephole_rounds(&p, slots);
+    /* Renaming can turn moves into moves to the same slot */
+    if (slots && janet_peephole_allocate(&p, def)) janet_peephole_rounds(&p, slots);
+
+    janet_free(p.marks);
+    janet_free(p.remap);
+    janet_free(p.live_in);
+    janet_free(p.live_out);
+    def->bytecode_length = p.n;
+}
+
+/* Rename the slots of an instruction so that slot s becomes map[s], for
+ * copying bytecode into another function. Superinstructions are split back
+ * into their first half. Returns 0 for instructions the optimizer does not
+ * handle and for slots that are out of range or do not fit their field. */
+int janet_bytecode_rename(uint32_t *instr, const int32_t *map, int32_t count) {
+    uint32_t x = janet_unfuse(*instr);
+    JanetPeepholeUse u;
+    if ((x & 0x80) || !janet_peephole_uses(x, &u)) return 0;
+    int fields[4];
+    int32_t nfields = 0;
+    if (u.write) fields[nfields++] = u.write;
+    for (int32_t r = 0; r < u.nreads; r++) fields[nfields++] = u.reads[r];
+    uint32_t y = x;
+    for (int32_t f = 0; f < nfields; f++) {
+        int32_t slot = janet_field_get(x, fields[f]);
+        if (slot >= count || !janet_field_set(&y, fields[f], map[slot])) return 0;
+    }
+    *instr = y;
+    return 1;
+}
+
 /* Allocate an empty funcdef. This function may have added functionality
  * as commonalities between asm and compile arise. */
 JanetFuncDef *janet_funcdef_alloc(void) {
@@ -216,6 +1081,15 @@ JanetFuncDef *janet_funcdef_alloc(void) {
     def->constants = NULL;
     def->bytecode = NULL;
     def->closure_bitset = NULL;
+    def->icache = NULL;
+    def->noescape = 0;
+#ifdef JANET_VM_COUNTERS
+    def->counters = NULL;
+#endif
+#ifdef JANET_JIT
+    def->jit = NULL;
+    def->jit_hotness = 0;
+#endif
     def->flags = 0;
     def->slotcount = 0;
     def->arity = 0;
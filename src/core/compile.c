@@ -238,6 +238,17 @@ JanetSlot janetc_resolve(
             case JANET_BINDING_DEF:
             case JANET_BINDING_MACRO: /* Macro should function like defs when not in calling pos */
                 ret = janetc_cslot(binding.value);
+                if (binding.type == JANET_BINDING_DEF && janet_checktype(binding.value, JANET_FUNCTION)) {
+                    /* Only functions defined in this environment can be inlined. Bindings
+                     * from the prototype and imported bindings, whose value is in the
+                     * prototype of their entry, keep their calls. */
+                    Janet entry = janet_table_rawget(c->env, janet_wrap_symbol(sym));
+                    if (janet_checktype(entry, JANET_TABLE) &&
+                            !janet_checktype(janet_table_rawget(janet_unwrap_table(entry), janet_ckeywordv("value")), JANET_NIL) &&
+                            !janet_truthy(janet_table_get(janet_unwrap_table(entry), janet_ckeywordv("noinline")))) {
+                        ret.flags |= JANET_SLOT_INLINE;
+                    }
+                }
                 break;
             case JANET_BINDING_VAR: {
                 ret = janetc_cslot(binding.value);
@@ -455,12 +466,323 @@ void janetc_throwaway(JanetFopts opts, Janet x) {
     }
 }
 
+/* Constant folding. A call to a pure core function with constant arguments
+ * is run when it is compiled, and the result becomes a constant. Only
+ * immutable values go in or come out, and calls that raise an error are
+ * left for the runtime so the error happens where it used to. */
+
+#define JANETC_FOLD_MAX_ARGS 16
+
+/* Core C functions that can be folded, sorted by name. Functions that
+ * print their arguments only take scalars, as tuples and structs print with
+ * their address. */
+typedef struct {
+    const char *name;
+    int containers;
+} JanetcFoldCfun;
+
+static const JanetcFoldCfun janetc_fold_cfuns[] = {
+    {"keyword", 0},
+    {"math/abs", 0},
+    {"math/ceil", 0},
+    {"math/floor", 0},
+    {"math/pow", 0},
+    {"math/round", 0},
+    {"math/sqrt", 0},
+    {"math/trunc", 0},
+    {"not", 1},
+    {"string", 0},
+    {"string/ascii-lower", 0},
+    {"string/ascii-upper", 0},
+    {"string/has-prefix?", 0},
+    {"string/has-suffix?", 0},
+    {"string/join", 1},
+    {"string/slice", 0},
+    {"struct", 1},
+    {"symbol", 0},
+    {"tuple", 1},
+    {"tuple/slice", 1}
+};
+
+/* Check if a function can be folded. Returns 0 if not, 1 if it takes any
+ * immutable arguments and 2 if it only takes scalars. */
+static int janetc_fold_fun(Janet fun) {
+    if (janet_checktype(fun, JANET_FUNCTION)) {
+        switch (janet_unwrap_function(fun)->def->flags & JANET_FUNCDEF_FLAG_TAG) {
+            default:
+                return 0;
+            case JANET_FUN_IN:
+            case JANET_FUN_LENGTH:
+            case JANET_FUN_ADD:
+            case JANET_FUN_SUBTRACT:
+            case JANET_FUN_MULTIPLY:
+            case JANET_FUN_DIVIDE:
+            case JANET_FUN_BAND:
+            case JANET_FUN_BOR:
+            case JANET_FUN_BXOR:
+            case JANET_FUN_LSHIFT:
+            case JANET_FUN_RSHIFT:
+            case JANET_FUN_RSHIFTU:
+            case JANET_FUN_BNOT:
+            case JANET_FUN_GT:
+            case JANET_FUN_LT:
+            case JANET_FUN_GTE:
+            case JANET_FUN_LTE:
+            case JANET_FUN_EQ:
+            case JANET_FUN_NEQ:
+            case JANET_FUN_GET:
+            case JANET_FUN_MODULO:
+            case JANET_FUN_REMAINDER:
+            case JANET_FUN_CMP:
+                return 1;
+        }
+    }
+    if (janet_checktype(fun, JANET_CFUNCTION)) {
+        Janet name = janet_table_get(janet_vm.registry, fun);
+        if (!janet_checktype(name, JANET_SYMBOL)) return 0;
+        const uint8_t *sym = janet_unwrap_symbol(name);
+        int32_t lo = 0;
+        int32_t hi = (int32_t)(sizeof(janetc_fold_cfuns) / sizeof(janetc_fold_cfuns[0]));
+        while (lo < hi) {
+            int32_t mid = lo + (hi - lo) / 2;
+            int cmp = janet_cstrcmp(sym, janetc_fold_cfuns[mid].name);
+            if (cmp == 0) return janetc_fold_cfuns[mid].containers ? 1 : 2;
+            if (cmp > 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+    }
+    return 0;
+}
+
+/* Check that a value is immutable all the way down */
+static int janetc_fold_value(Janet x, int depth) {
+    switch (janet_type(x)) {
+        default:
+            return 0;
+        case JANET_NIL:
+        case JANET_BOOLEAN:
+        case JANET_NUMBER:
+        case JANET_STRING:
+        case JANET_SYMBOL:
+        case JANET_KEYWORD:
+            return 1;
+        case JANET_TUPLE: {
+            if (depth <= 0) return 0;
+            const Janet *tup = janet_unwrap_tuple(x);
+            for (int32_t i = 0; i < janet_tuple_length(tup); i++) {
+                if (!janetc_fold_value(tup[i], depth - 1)) return 0;
+            }
+            return 1;
+        }
+        case JANET_STRUCT: {
+            if (depth <= 0) return 0;
+            const JanetKV *st = janet_unwrap_struct(x);
+            for (int32_t i = 0; i < janet_struct_capacity(st); i++) {
+                if (janet_checktype(st[i].key, JANET_NIL)) continue;
+                if (!janetc_fold_value(st[i].key, depth - 1) ||
+                        !janetc_fold_value(st[i].value, depth - 1)) return 0;
+            }
+            return 1;
+        }
+    }
+}
+
+static int janetc_fold(Janet fun, JanetSlot *slots, Janet *out) {
+    Janet argv[JANETC_FOLD_MAX_ARGS];
+    int32_t argc = janet_v_count(slots);
+    int kind = janetc_fold_fun(fun);
+    if (argc > JANETC_FOLD_MAX_ARGS || !kind) return 0;
+    int depth = kind == 2 ? 0 : JANET_RECURSION_GUARD;
+    for (int32_t i = 0; i < argc; i++) {
+        if ((slots[i].flags & (JANET_SLOT_CONSTANT | JANET_SLOT_REF)) != JANET_SLOT_CONSTANT ||
+                !janetc_fold_value(slots[i].constant, depth)) return 0;
+        argv[i] = slots[i].constant;
+    }
+    JanetSignal status;
+    int lock = janet_gclock();
+    if (janet_checktype(fun, JANET_FUNCTION)) {
+        status = janet_pcall(janet_unwrap_function(fun), argc, argv, out, NULL);
+    } else {
+        JanetTryState tstate;
+        status = janet_try(&tstate);
+        if (!status) {
+            *out = janet_unwrap_cfunction(fun)(argc, argv);
+        }
+        janet_restore(&tstate);
+    }
+    janet_gcunlock(lock);
+    return status == JANET_SIGNAL_OK && janetc_fold_value(*out, JANET_RECURSION_GUARD);
+}
+
+/* Inlining. Calls to small leaf functions bound with def or defn in the
+ * environment being compiled copy the body of the callee into the caller
+ * instead. The callee gets fresh registers for its slots, returns become
+ * moves to the target followed by a jump past the body, and the copied
+ * instructions keep the source mapping of the callee. An inlined body has no
+ * frame of its own: if it raises at runtime, for example from arithmetic or
+ * get on an operand of the wrong type, the error is reported in the frame of
+ * the caller at the source line of the callee, and with nested inlining the
+ * frames of every inlined function are folded into the outermost caller.
+ * Functions that call other functions, raise errors explicitly or signal
+ * keep their calls, so that stack traces and profiles show them. Neither are
+ * functions that use closures, upvalues or variadic arguments, refer to
+ * themselves, come from another source or have :noinline set in their
+ * binding. */
+
+#define JANETC_INLINE_MAX_BYTECODE 16
+#define JANETC_INLINE_MAX_SLOTS 16
+
+static int janetc_inline(JanetFopts opts, JanetSlot *slots, JanetFunction *f, JanetSlot *out) {
+    JanetCompiler *c = opts.compiler;
+    JanetFuncDef *def = f->def;
+    int32_t len = def->bytecode_length;
+    int32_t argc = janet_v_count(slots);
+    if ((def->flags & (JANET_FUNCDEF_FLAG_VARARG | JANET_FUNCDEF_FLAG_TAG)) ||
+            def->arity != argc || def->min_arity != argc || def->max_arity != argc ||
+            def->environments_length || def->defs_length ||
+            len == 0 || len > JANETC_INLINE_MAX_BYTECODE ||
+            def->slotcount > JANETC_INLINE_MAX_SLOTS) {
+        return 0;
+    }
+    if (c->source != def->source &&
+            (NULL == c->source || NULL == def->source ||
+             !janet_string_equal(c->source, def->source))) {
+        return 0;
+    }
+
+    /* Give each slot of the callee a register */
+    JanetSlot regs[JANETC_INLINE_MAX_SLOTS];
+    int32_t map[JANETC_INLINE_MAX_SLOTS];
+    uint32_t orig[JANETC_INLINE_MAX_BYTECODE];
+    uint32_t code[JANETC_INLINE_MAX_BYTECODE];
+    int32_t pos[JANETC_INLINE_MAX_BYTECODE + 1];
+    int ok = 1;
+    for (int32_t i = 0; i < def->slotcount; i++) {
+        regs[i] = janetc_farslot(c);
+        map[i] = regs[i].index;
+        if (map[i] > 0xFF) ok = 0;
+    }
+
+    /* Rename the body before emitting anything */
+    for (int32_t i = 0; ok && i < len; i++) {
+        uint32_t instr = janet_unquicken(def->bytecode[i]);
+        orig[i] = instr;
+        code[i] = instr;
+        switch (instr & 0xFF) {
+            case JOP_LOAD_SELF:
+            case JOP_LOAD_UPVALUE:
+            case JOP_SET_UPVALUE:
+            case JOP_CLOSURE:
+            case JOP_CALL:
+            case JOP_TAILCALL:
+            case JOP_ERROR:
+            case JOP_RESUME:
+            case JOP_SIGNAL:
+            case JOP_PROPAGATE:
+            case JOP_CANCEL:
+                ok = 0;
+                break;
+            case JOP_LOAD_CONSTANT:
+                if ((int32_t)(instr >> 16) >= def->constants_length) ok = 0;
+                break;
+            case JOP_JUMP: {
+                int32_t target = i + ((int32_t) instr >> 8);
+                if (target < 0 || target >= len) ok = 0;
+                break;
+            }
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL: {
+                int32_t target = i + ((int32_t) instr >> 16);
+                if (target < 0 || target >= len) ok = 0;
+                break;
+            }
+            default:
+                break;
+        }
+        if (ok && !janet_bytecode_rename(code + i, map, def->slotcount)) ok = 0;
+    }
+    if (!ok) {
+        for (int32_t i = 0; i < def->slotcount; i++) janetc_freeslot(c, regs[i]);
+        return 0;
+    }
+
+    /* Arguments are copied, as the callee may assign to its parameters */
+    JanetSlot target = janetc_gettarget(opts);
+    for (int32_t i = 0; i < def->slotcount; i++) {
+        janetc_copy(c, regs[i], i < argc ? slots[i] : janetc_cslot(janet_wrap_nil()));
+    }
+    int32_t *exits = NULL;
+    JanetSourceMapping mapping = c->current_mapping;
+    for (int32_t i = 0; i < len; i++) {
+        uint32_t instr = code[i];
+        pos[i] = janet_v_count(c->buffer);
+        if (NULL != def->sourcemap) c->current_mapping = def->sourcemap[i];
+        switch (instr & 0xFF) {
+            default:
+                janetc_emit(c, instr);
+                continue;
+            case JOP_LOAD_CONSTANT:
+                janetc_copy(c, regs[(orig[i] >> 8) & 0xFF], janetc_cslot(def->constants[instr >> 16]));
+                continue;
+            case JOP_RETURN:
+                janetc_copy(c, target, regs[orig[i] >> 8]);
+                break;
+            case JOP_RETURN_NIL:
+                janetc_copy(c, target, janetc_cslot(janet_wrap_nil()));
+                break;
+        }
+        if (i + 1 < len) {
+            janet_v_push(exits, janet_v_count(c->buffer));
+            janetc_emit(c, JOP_JUMP);
+        }
+    }
+    pos[len] = janet_v_count(c->buffer);
+    c->current_mapping = mapping;
+
+    /* Point the jumps of the body and the exits at their new targets */
+    for (int32_t i = 0; i < len; i++) {
+        uint32_t instr = code[i];
+        int32_t at = pos[i];
+        switch (instr & 0xFF) {
+            default:
+                break;
+            case JOP_JUMP:
+                c->buffer[at] = JOP_JUMP | ((uint32_t)(pos[i + ((int32_t) instr >> 8)] - at) << 8);
+                break;
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL:
+                c->buffer[at] = (instr & 0xFFFF) | ((uint32_t)(pos[i + ((int32_t) instr >> 16)] - at) << 16);
+                break;
+        }
+    }
+    for (int32_t i = 0; i < janet_v_count(exits); i++) {
+        c->buffer[exits[i]] = JOP_JUMP | ((uint32_t)(pos[len] - exits[i]) << 8);
+    }
+    janet_v_free(exits);
+
+    for (int32_t i = 0; i < def->slotcount; i++) janetc_freeslot(c, regs[i]);
+    *out = target;
+    return 1;
+}
+
 /* Compile a call or tailcall instruction */
 static JanetSlot janetc_call(JanetFopts opts, JanetSlot *slots, JanetSlot fun) {
     JanetSlot retslot;
     JanetCompiler *c = opts.compiler;
     int specialized = 0;
     if (fun.flags & JANET_SLOT_CONSTANT && !has_spliced(slots)) {
+        Janet folded;
+        if (janetc_fold(fun.constant, slots, &folded)) {
+            janetc_freeslots(c, slots);
+            return janetc_cslot(folded);
+        }
         if (janet_checktype(fun.constant, JANET_FUNCTION)) {
             JanetFunction *f = janet_unwrap_function(fun.constant);
             const JanetFunOptimizer *o = janetc_funopt(f->def->flags);
@@ -469,7 +791,10 @@ static JanetSlot janetc_call(JanetFopts opts, JanetSlot *slots, JanetSlot fun) {
                 retslot = o->optimize(opts, slots);
             }
         }
-        /* TODO janet function inlining (no c functions)*/
+        if (!specialized && (fun.flags & JANET_SLOT_INLINE) &&
+                janet_checktype(fun.constant, JANET_FUNCTION)) {
+            specialized = janetc_inline(opts, slots, janet_unwrap_function(fun.constant), &retslot);
+        }
     }
     if (!specialized) {
         int32_t min_arity = janetc_pushslots(c, slots);
@@ -779,6 +1104,432 @@ JanetSlot janetc_value(JanetFopts opts, Janet x) {
     return ret;
 }
 
+/* Escape analysis. Closures capture the stack frame of the function that
+ * creates them, and the frame is copied to the heap when it is popped so the
+ * closures can keep using it. That copy is wasted when all of the closures are
+ * dead by then, as with a lambda only passed to map or called in place. This
+ * pass tracks which slots can hold each parameter, the function itself and each
+ * closure created by the function, forward over the bytecode. A value escapes
+ * when it is returned, stored, captured, passed to a function that is not
+ * known to keep its arguments to itself, or used by anything else but a call
+ * or a test. */
+
+/* Value ids. Parameters use bits 0-30, the function itself bit 31 and
+ * closures bits 32 and up, in order of their JOP_CLOSURE instruction. */
+#define JANETC_ESCAPE_SELF (((uint64_t) 1) << 31)
+#define JANETC_ESCAPE_SITES (~(uint64_t) 0xFFFFFFFFU)
+#define JANETC_ESCAPE_MAX_SITES 32
+
+/* Skip the analysis for functions that would need too much memory */
+#define JANETC_ESCAPE_MAX_STATE 0x40000
+
+typedef struct {
+    JanetFuncDef *def;
+    uint8_t *targets;
+    int32_t *sites;
+    uint64_t escaped;
+} JanetcEscape;
+
+/* Superinstructions behave like their first instruction, the rest of them
+ * follows in the bytecode. */
+static uint32_t janetc_escape_op(uint32_t instr) {
+    return janet_unfuse(instr) & 0x7F;
+}
+
+/* Instructions that only write slot A, and read their other operands */
+static int janetc_escape_writes(uint32_t op) {
+    switch (op) {
+        default:
+            return 0;
+        case JOP_ADD_IMMEDIATE:
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE_IMMEDIATE:
+        case JOP_DIVIDE:
+        case JOP_MODULO:
+        case JOP_REMAINDER:
+        case JOP_BAND:
+        case JOP_BOR:
+        case JOP_BXOR:
+        case JOP_BNOT:
+        case JOP_SHIFT_LEFT:
+        case JOP_SHIFT_LEFT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT:
+        case JOP_SHIFT_RIGHT_IMMEDIATE:
+        case JOP_SHIFT_RIGHT_UNSIGNED:
+        case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_EQUALS:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_COMPARE:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_NOT_EQUALS:
+        case JOP_NOT_EQUALS_IMMEDIATE:
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_UPVALUE:
+        case JOP_IN:
+        case JOP_GET:
+        case JOP_GET_INDEX:
+        case JOP_NEXT:
+        case JOP_LENGTH:
+        case JOP_MAKE_ARRAY:
+        case JOP_MAKE_BUFFER:
+        case JOP_MAKE_STRING:
+        case JOP_MAKE_STRUCT:
+        case JOP_MAKE_TABLE:
+        case JOP_MAKE_TUPLE:
+        case JOP_MAKE_BRACKET_TUPLE:
+            return 1;
+    }
+}
+
+static int janetc_escape_push(uint32_t op) {
+    return op == JOP_PUSH || op == JOP_PUSH_2 || op == JOP_PUSH_3 || op == JOP_PUSH_ARRAY;
+}
+
+/* Instructions the compiler emits between the arguments of a call and the
+ * call itself, to move the arguments and the callee into near slots. Returns
+ * the slot they write, or -1. */
+static int32_t janetc_escape_between(uint32_t instr) {
+    switch (instr & 0x7F) {
+        default:
+            return -1;
+        case JOP_LOAD_NIL:
+        case JOP_LOAD_TRUE:
+        case JOP_LOAD_FALSE:
+        case JOP_LOAD_INTEGER:
+        case JOP_LOAD_CONSTANT:
+        case JOP_LOAD_UPVALUE:
+        case JOP_LOAD_SELF:
+        case JOP_MOVE_NEAR:
+            return (instr >> 8) & 0xFF;
+        case JOP_MOVE_FAR:
+            return instr >> 16;
+    }
+}
+
+static int janetc_escape_run(uint32_t instr) {
+    return janetc_escape_push(instr & 0x7F) || janetc_escape_between(instr) >= 0;
+}
+
+/* Find the function that receives the arguments pushed at pc, if it is a
+ * constant. Sets base to the position of the first argument pushed at pc. */
+static JanetFuncDef *janetc_escape_callee(JanetcEscape *e, int32_t pc, int32_t *base, int *tail) {
+    JanetFuncDef *def = e->def;
+    const uint32_t *bc = def->bytecode;
+    int32_t start = pc;
+    while (start > 0 && !e->targets[start] && janetc_escape_run(bc[start - 1])) start--;
+    *base = 0;
+    for (int32_t i = start; i < pc; i++) {
+        switch (bc[i] & 0x7F) {
+            case JOP_PUSH:
+                *base += 1;
+                break;
+            case JOP_PUSH_2:
+                *base += 2;
+                break;
+            case JOP_PUSH_3:
+                *base += 3;
+                break;
+            case JOP_PUSH_ARRAY:
+                return NULL;
+        }
+    }
+    int32_t end = pc + 1;
+    while (end < def->bytecode_length && !e->targets[end] && janetc_escape_run(bc[end])) {
+        if ((bc[end] & 0x7F) == JOP_PUSH_ARRAY) return NULL;
+        end++;
+    }
+    if (end >= def->bytecode_length || e->targets[end]) return NULL;
+    int32_t callee;
+    switch (bc[end] & 0x7F) {
+        case JOP_CALL:
+            callee = bc[end] >> 16;
+            *tail = 0;
+            break;
+        case JOP_TAILCALL:
+            callee = bc[end] >> 8;
+            *tail = 1;
+            break;
+        default:
+            return NULL;
+    }
+    for (int32_t i = end - 1; i >= start; i--) {
+        if (janetc_escape_between(bc[i]) == callee) {
+            if ((bc[i] & 0x7F) != JOP_LOAD_CONSTANT) return NULL;
+            Janet fn = def->constants[bc[i] >> 16];
+            return janet_checktype(fn, JANET_FUNCTION) ? janet_unwrap_function(fn)->def : NULL;
+        }
+    }
+    return NULL;
+}
+
+static void janetc_escape_set(JanetcEscape *e, uint64_t *state, int32_t slot, uint64_t value) {
+    const uint32_t *bitset = e->def->closure_bitset;
+    if (value && bitset && (bitset[slot >> 5] & (1U << (slot & 31)))) {
+        /* Captured by a closure */
+        e->escaped |= value;
+    }
+    state[slot] = value;
+}
+
+/* Pass arguments to a call */
+static void janetc_escape_args(JanetcEscape *e, uint64_t *state, int32_t pc, const int32_t *slots, int32_t count) {
+    int32_t base = 0;
+    int tail = 0;
+    JanetFuncDef *callee = janetc_escape_callee(e, pc, &base, &tail);
+    for (int32_t i = 0; i < count; i++) {
+        uint64_t value = state[slots[i]];
+        int32_t position = base + i;
+        int kept = NULL == callee ||
+                   position >= callee->arity ||
+                   position >= 31 ||
+                   !(callee->noescape & (1U << position));
+        if (kept) {
+            e->escaped |= value;
+        } else if (tail) {
+            /* The frame is gone before the callee runs */
+            e->escaped |= value & JANETC_ESCAPE_SITES;
+        }
+    }
+}
+
+/* Apply one instruction to the slot state */
+static void janetc_escape_step(JanetcEscape *e, uint64_t *state, int32_t pc) {
+    uint32_t instr = e->def->bytecode[pc];
+    uint32_t op = janetc_escape_op(instr);
+    int32_t a = (instr >> 8) & 0xFF;
+    int32_t b = (instr >> 16) & 0xFF;
+    int32_t c = instr >> 24;
+    int32_t slots[3];
+    switch (op) {
+        case JOP_MOVE_NEAR:
+            janetc_escape_set(e, state, a, state[instr >> 16]);
+            return;
+        case JOP_MOVE_FAR:
+            janetc_escape_set(e, state, instr >> 16, state[a]);
+            return;
+        case JOP_CALL:
+            janetc_escape_set(e, state, a, 0);
+            return;
+        case JOP_TAILCALL:
+            e->escaped |= state[instr >> 8] & JANETC_ESCAPE_SITES;
+            return;
+        case JOP_PUSH:
+            slots[0] = instr >> 8;
+            janetc_escape_args(e, state, pc, slots, 1);
+            return;
+        case JOP_PUSH_2:
+            slots[0] = a;
+            slots[1] = instr >> 16;
+            janetc_escape_args(e, state, pc, slots, 2);
+            return;
+        case JOP_PUSH_3:
+            slots[0] = a;
+            slots[1] = b;
+            slots[2] = c;
+            janetc_escape_args(e, state, pc, slots, 3);
+            return;
+        case JOP_JUMP_IF:
+        case JOP_JUMP_IF_NOT:
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL:
+        case JOP_TYPECHECK:
+            return;
+        case JOP_CLOSURE:
+            janetc_escape_set(e, state, a, e->sites[pc] < 0 ? 0 : ((uint64_t) 1) << (32 + e->sites[pc]));
+            return;
+        case JOP_LOAD_SELF:
+            janetc_escape_set(e, state, a, JANETC_ESCAPE_SELF);
+            return;
+        default:
+            break;
+    }
+    /* Everything else lets its operands escape */
+    int writes = janetc_escape_writes(op);
+    switch (janet_instructions[op]) {
+        case JINT_0:
+        case JINT_L:
+            break;
+        case JINT_S:
+            if (!writes) e->escaped |= state[instr >> 8];
+            break;
+        case JINT_SS:
+            if (!writes) e->escaped |= state[a];
+            e->escaped |= state[instr >> 16];
+            break;
+        case JINT_SSI:
+        case JINT_SSU:
+            if (!writes) e->escaped |= state[a];
+            e->escaped |= state[b];
+            break;
+        case JINT_SSS:
+            if (!writes) e->escaped |= state[a];
+            e->escaped |= state[b] | state[c];
+            break;
+        default:
+            if (!writes) e->escaped |= state[a];
+            break;
+    }
+    if (writes) janetc_escape_set(e, state, a, 0);
+}
+
+/* Find which parameters, and whether the function itself, never outlive a
+ * call, and whether the closures created by the function die with its frame.
+ * Called on each compiled function after its arity is set, and after the
+ * functions it contains have been analyzed. */
+void janetc_analyze_escapes(JanetFuncDef *def) {
+    int32_t n = def->bytecode_length;
+    int32_t sc = def->slotcount;
+    def->noescape = 0;
+    def->flags &= ~JANET_FUNCDEF_FLAG_STACKENV;
+    if (n == 0 || sc == 0 || (int64_t) n * sc > JANETC_ESCAPE_MAX_STATE) return;
+    /* Widened registers are not tracked */
+    for (int32_t i = 0; i < n; i++) {
+        if ((def->bytecode[i] & 0x7F) == JOP_WIDE) return;
+    }
+
+    JanetcEscape e;
+    e.def = def;
+    e.escaped = 0;
+    e.targets = janet_calloc((size_t) n, 3);
+    e.sites = janet_malloc(sizeof(int32_t) * (size_t) n);
+    uint64_t *in = janet_calloc((size_t) n * (size_t) sc, sizeof(uint64_t));
+    uint64_t *state = janet_malloc(sizeof(uint64_t) * (size_t) sc);
+    int32_t *work = janet_malloc(sizeof(int32_t) * (size_t) n);
+    if (NULL == e.targets || NULL == e.sites || NULL == in || NULL == state || NULL == work) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint8_t *queued = e.targets + n;
+    uint8_t *visited = queued + n;
+
+    /* Mark jump targets and number closures */
+    int32_t nsites = 0;
+    for (int32_t i = 0; i < n; i++) {
+        uint32_t instr = def->bytecode[i];
+        int32_t to = -1;
+        e.sites[i] = -1;
+        switch (instr & 0x7F) {
+            case JOP_JUMP:
+                to = i + ((int32_t) instr >> 8);
+                break;
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL:
+                to = i + ((int32_t) instr >> 16);
+                break;
+            case JOP_CLOSURE:
+                if (nsites < JANETC_ESCAPE_MAX_SITES) e.sites[i] = nsites;
+                nsites++;
+                break;
+        }
+        if (to >= 0 && to < n) e.targets[to] = 1;
+    }
+
+    /* Parameters start out in their slots */
+    int32_t nparams = def->arity < 31 ? def->arity : 31;
+    if (nparams > sc) nparams = sc;
+    for (int32_t i = 0; i < nparams; i++) {
+        janetc_escape_set(&e, in, i, ((uint64_t) 1) << i);
+    }
+
+    /* Propagate slot state until nothing changes */
+    int32_t nwork = 0;
+    work[nwork++] = 0;
+    queued[0] = 1;
+    visited[0] = 1;
+    while (nwork) {
+        int32_t pc = work[--nwork];
+        queued[pc] = 0;
+        memcpy(state, in + (size_t) pc * sc, sizeof(uint64_t) * (size_t) sc);
+        janetc_escape_step(&e, state, pc);
+        uint32_t instr = def->bytecode[pc];
+        int32_t next[2];
+        int32_t nnext = 0;
+        switch (instr & 0x7F) {
+            case JOP_RETURN:
+            case JOP_RETURN_NIL:
+            case JOP_ERROR:
+            case JOP_TAILCALL:
+                break;
+            case JOP_JUMP:
+                next[nnext++] = pc + ((int32_t) instr >> 8);
+                break;
+            case JOP_JUMP_IF:
+            case JOP_JUMP_IF_NOT:
+            case JOP_JUMP_IF_NIL:
+            case JOP_JUMP_IF_NOT_NIL:
+                next[nnext++] = pc + ((int32_t) instr >> 16);
+                next[nnext++] = pc + 1;
+                break;
+            default:
+                next[nnext++] = pc + 1;
+                break;
+        }
+        for (int32_t j = 0; j < nnext; j++) {
+            int32_t to = next[j];
+            if (to < 0 || to >= n) continue;
+            uint64_t *target = in + (size_t) to * sc;
+            int changed = !visited[to];
+            visited[to] = 1;
+            for (int32_t k = 0; k < sc; k++) {
+                uint64_t merged = target[k] | state[k];
+                if (merged != target[k]) {
+                    target[k] = merged;
+                    changed = 1;
+                }
+            }
+            if (changed && !queued[to]) {
+                queued[to] = 1;
+                work[nwork++] = to;
+            }
+        }
+    }
+
+    /* Collect results */
+    for (int32_t i = 0; i < nparams; i++) {
+        if (!(e.escaped & (((uint64_t) 1) << i))) def->noescape |= 1U << i;
+    }
+    if (!(e.escaped & JANETC_ESCAPE_SELF)) def->noescape |= 1U << 31;
+    int stackenv = nsites <= JANETC_ESCAPE_MAX_SITES;
+    for (int32_t i = 0; stackenv && i < n; i++) {
+        if ((def->bytecode[i] & 0x7F) != JOP_CLOSURE) continue;
+        JanetFuncDef *sub = def->defs[def->bytecode[i] >> 16];
+        int captures = 0;
+        for (int32_t j = 0; j < sub->environments_length; j++) {
+            if (sub->environments[j] < 0) captures = 1;
+        }
+        if (!captures) continue;
+        /* The closure must not escape, nor let itself or its own closures escape */
+        if (e.escaped & (((uint64_t) 1) << (32 + e.sites[i]))) stackenv = 0;
+        if (!(sub->noescape & (1U << 31))) stackenv = 0;
+        for (int32_t j = 0; stackenv && j < sub->defs_length; j++) {
+            JanetFuncDef *subsub = sub->defs[j];
+            for (int32_t k = 0; k < subsub->environments_length; k++) {
+                if (subsub->environments[k] >= 0) stackenv = 0;
+            }
+        }
+    }
+    if (stackenv) def->flags |= JANET_FUNCDEF_FLAG_STACKENV;
+
+    janet_free(e.targets);
+    janet_free(e.sites);
+    janet_free(in);
+    janet_free(state);
+    janet_free(work);
+}
+
 /* Add function flags to janet functions */
 void janet_def_addflags(JanetFuncDef *def) {
     int32_t set_flags = 0;
@@ -790,6 +1541,7 @@ void janet_def_addflags(JanetFuncDef *def) {
     if (def->environments)    set_flags |= JANET_FUNCDEF_FLAG_HASENVS;
     if (def->sourcemap)       set_flags |= JANET_FUNCDEF_FLAG_HASSOURCEMAP;
     if (def->closure_bitset)  set_flags |= JANET_FUNCDEF_FLAG_HASCLOBITSET;
+    if (def->noescape)        set_flags |= JANET_FUNCDEF_FLAG_HASNOESCAPE;
     /* negative checks */
     if (!def->name)           unset_flags |= JANET_FUNCDEF_FLAG_HASNAME;
     if (!def->source)         unset_flags |= JANET_FUNCDEF_FLAG_HASSOURCE;
@@ -797,6 +1549,7 @@ void janet_def_addflags(JanetFuncDef *def) {
     if (!def->environments)   unset_flags |= JANET_FUNCDEF_FLAG_HASENVS;
     if (!def->sourcemap)      unset_flags |= JANET_FUNCDEF_FLAG_HASSOURCEMAP;
     if (!def->closure_bitset) unset_flags |= JANET_FUNCDEF_FLAG_HASCLOBITSET;
+    if (!def->noescape)       unset_flags |= JANET_FUNCDEF_FLAG_HASNOESCAPE;
     /* Update flags */
     def->flags |= set_flags;
     def->flags &= ~unset_flags;
@@ -869,6 +1622,10 @@ JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c) {
         def->closure_bitset = chunks;
     }
 
+    /* Clean up the bytecode */
+    janet_bytecode_optimize(def);
+    janetc_superinstructions(def);
+
     /* Pop the scope */
     janetc_popscope(c);
 
@@ -925,6 +1682,7 @@ JanetCompileResult janet_compile_lint(Janet source,
     if (c.result.status == JANET_COMPILE_OK) {
         JanetFuncDef *def = janetc_pop_funcdef(&c);
         def->name = janet_cstring("_thunk");
+        janetc_analyze_escapes(def);
         janet_def_addflags(def);
         c.result.funcdef = def;
     } else {
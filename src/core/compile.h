@@ -89,6 +89,7 @@ typedef struct JanetSpecial JanetSpecial;
 #define JANET_SLOT_DEP_WARN 0x400000
 #define JANET_SLOT_DEP_ERROR 0x800000
 #define JANET_SLOT_SPLICED 0x1000000
+#define JANET_SLOT_INLINE 0x2000000
 
 #define JANET_SLOTTYPE_ANY 0xFFFF
 
@@ -251,6 +252,7 @@ void janetc_scope(JanetScope *s, JanetCompiler *c, int flags, const char *name);
 void janetc_popscope(JanetCompiler *c);
 void janetc_popscope_keepslot(JanetCompiler *c, JanetSlot retslot);
 JanetFuncDef *janetc_pop_funcdef(JanetCompiler *c);
+void janetc_analyze_escapes(JanetFuncDef *def);
 
 /* Create a destory slots */
 JanetSlot janetc_cslot(Janet x);
@@ -104,6 +104,7 @@ JanetModule janet_native(const char *name, const uint8_t **error) {
     JanetBuildConfig host = janet_config_current();
     if (host.major != modconf.major ||
             host.minor < modconf.minor ||
+            modconf.minor < JANET_ABI_MINOR ||
             host.bits != modconf.bits) {
         char errbuf[128];
         sprintf(errbuf, "config mismatch - host %d.%.d.%d(%.4x) vs. module %d.%d.%d(%.4x)",
@@ -429,6 +430,7 @@ static Janet janet_core_gcsetinterval(int32_t argc, Janet *argv) {
     }
 #endif
     janet_vm.gc_interval = s;
+    janet_vm.gc_trigger = s;
     return janet_wrap_nil();
 }
 
@@ -438,6 +440,145 @@ static Janet janet_core_gcinterval(int32_t argc, Janet *argv) {
     return janet_wrap_number((double) janet_vm.gc_interval);
 }
 
+static Janet janet_core_gcsetpause(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    janet_vm.gc_pause = janet_getsize(argv, 0);
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gcpause(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_number((double) janet_vm.gc_pause);
+}
+
+static Janet janet_core_gcstats(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    JanetGCStats stats;
+    janet_gc_stats(&stats);
+    JanetTable *t = janet_table(16);
+    JanetTable *types = janet_table(JANET_GC_MEMORY_TYPES);
+    JanetArray *histogram = janet_array(JANET_GC_HISTOGRAM_SIZE);
+    size_t bytes = 0;
+    for (int i = 0; i < JANET_GC_MEMORY_TYPES; i++) {
+        const char *name = janet_gc_type_name(i);
+        if (NULL == name) continue;
+        JanetKV *st = janet_struct_begin(2);
+        janet_struct_put(st, janet_ckeywordv("blocks"), janet_wrap_number((double) stats.blocks[i]));
+        janet_struct_put(st, janet_ckeywordv("bytes"), janet_wrap_number((double) stats.bytes[i]));
+        janet_table_put(types, janet_ckeywordv(name), janet_wrap_struct(janet_struct_end(st)));
+        bytes += stats.bytes[i];
+    }
+    for (int i = 0; i < JANET_GC_HISTOGRAM_SIZE; i++)
+        janet_array_push(histogram, janet_wrap_number((double) stats.pause_histogram[i]));
+    janet_table_put(t, janet_ckeywordv("minor-collections"), janet_wrap_number((double) stats.minor_collections));
+    janet_table_put(t, janet_ckeywordv("full-collections"), janet_wrap_number((double) stats.full_collections));
+    janet_table_put(t, janet_ckeywordv("pauses"), janet_wrap_number((double) stats.pauses));
+    janet_table_put(t, janet_ckeywordv("pause-total"), janet_wrap_number(stats.pause_total / 1e9));
+    janet_table_put(t, janet_ckeywordv("pause-max"), janet_wrap_number(stats.pause_max / 1e9));
+    janet_table_put(t, janet_ckeywordv("pause-histogram"), janet_wrap_array(histogram));
+    janet_table_put(t, janet_ckeywordv("types"), janet_wrap_table(types));
+    janet_table_put(t, janet_ckeywordv("blocks"), janet_wrap_number((double) stats.block_count));
+    janet_table_put(t, janet_ckeywordv("old-blocks"), janet_wrap_number((double) stats.old_block_count));
+    janet_table_put(t, janet_ckeywordv("bytes"), janet_wrap_number((double) bytes));
+    janet_table_put(t, janet_ckeywordv("live-bytes"), janet_wrap_number((double) stats.live_bytes));
+    janet_table_put(t, janet_ckeywordv("roots"), janet_wrap_number((double) stats.root_count));
+    janet_table_put(t, janet_ckeywordv("scratch-blocks"), janet_wrap_number((double) stats.scratch_count));
+    janet_table_put(t, janet_ckeywordv("scratch-bytes"), janet_wrap_number((double) stats.scratch_bytes));
+    janet_table_put(t, janet_ckeywordv("large-blocks"), janet_wrap_number((double) stats.large_count));
+    janet_table_put(t, janet_ckeywordv("large-bytes"), janet_wrap_number((double) stats.large_bytes));
+    return janet_wrap_table(t);
+}
+
+static Janet janet_core_gcsetlimit(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    janet_gc_set_limit(janet_checktype(argv[0], JANET_NIL) ? 0 : janet_getsize(argv, 0));
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gclimit(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    if (0 == janet_vm.gc_limit) return janet_wrap_nil();
+    return janet_wrap_number((double) janet_vm.gc_limit);
+}
+
+static Janet janet_core_gcsettarget(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    janet_gc_set_target(janet_getsize(argv, 0));
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gctarget(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_number((double) janet_vm.gc_target);
+}
+
+static Janet janet_core_gcregionbegin(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_integer(janet_region_begin());
+}
+
+static Janet janet_core_gcregionend(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int32_t handle = janet_getinteger(argv, 0);
+    if (handle < 0) {
+        janet_panicf("invalid region handle %d", handle);
+    }
+    janet_region_end(handle);
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gcprofile(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    janet_gc_profile(janet_checktype(argv[0], JANET_NIL) ? 0 : janet_getsize(argv, 0));
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gcprofiledump(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 2);
+    static const char *const kinds[] = {
+        "inuse-space", "inuse-objects", "alloc-space",
+        "alloc-objects", "survived-space", "survived-objects"
+    };
+    JanetGCProfileKind kind = JANET_GC_PROFILE_INUSE_SPACE;
+    if (argc > 0 && !janet_checktype(argv[0], JANET_NIL)) {
+        const uint8_t *kw = janet_getkeyword(argv, 0);
+        size_t i;
+        for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+            if (!janet_cstrcmp(kw, kinds[i])) break;
+        }
+        if (i == sizeof(kinds) / sizeof(kinds[0])) {
+            janet_panicf("unknown profile kind %v", argv[0]);
+        }
+        kind = (JanetGCProfileKind) i;
+    }
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 1, 0);
+    janet_gc_profile_dump(buffer, kind);
+    return janet_wrap_buffer(buffer);
+}
+
+#ifdef JANET_PARALLEL_GC
+static Janet janet_core_gcsetthreads(int32_t argc, Janet *argv) {
+    janet_fixarity(argc, 1);
+    int32_t n = janet_getnat(argv, 0);
+    if (n > 256) {
+        janet_panic("too many threads");
+    }
+    janet_vm.gc_threads = n;
+    return janet_wrap_nil();
+}
+
+static Janet janet_core_gcthreads(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    return janet_wrap_integer(janet_vm.gc_threads);
+}
+#endif
+
 static Janet janet_core_type(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     JanetType t = janet_type(argv[0]);
@@ -492,6 +633,114 @@ static Janet janet_core_untrace(int32_t argc, Janet *argv) {
     return argv[0];
 }
 
+#ifdef JANET_VM_COUNTERS
+
+static Janet janet_core_vm_counting(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int old = janet_vm.counting;
+    if (argc) janet_vm.counting = janet_truthy(argv[0]);
+    /* Do not pair the first instruction with one from before the pause */
+    if (!old) janet_vm.last_op = -1;
+    return janet_wrap_boolean(old);
+}
+
+static Janet janet_counted_opcode(uint32_t op) {
+    uint32_t generic = janet_unquicken(op) & 0x7F;
+#ifdef JANET_ASSEMBLER
+    const char *name = janet_opcode_name(generic);
+    return name ? janet_csymbolv(name) : janet_wrap_integer(generic);
+#else
+    return janet_wrap_integer(generic);
+#endif
+}
+
+typedef struct {
+    JanetFuncDef *def;
+    uint64_t count;
+} JanetDefCount;
+
+static int janet_defcount_cmp(const void *a, const void *b) {
+    uint64_t x = ((const JanetDefCount *) a)->count;
+    uint64_t y = ((const JanetDefCount *) b)->count;
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static Janet janet_core_vm_counters(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int pcs = argc > 0 && janet_truthy(argv[0]);
+
+    /* Opcodes. Quickened instructions are counted as the instruction they
+     * were quickened from. */
+    JanetTable *opcodes = janet_table(0);
+    for (uint32_t op = 0; op < 128; op++) {
+        if (!janet_vm.op_counts[op]) continue;
+        Janet key = janet_counted_opcode(op);
+        Janet old = janet_table_get(opcodes, key);
+        double count = janet_checktype(old, JANET_NUMBER) ? janet_unwrap_number(old) : 0.0;
+        janet_table_put(opcodes, key, janet_wrap_number(count + (double) janet_vm.op_counts[op]));
+    }
+
+    /* Pairs of opcodes executed one after the other, including across calls
+     * and returns */
+    JanetTable *pairs = janet_table(0);
+    for (uint32_t i = 0; NULL != janet_vm.pair_counts && i < 128 * 128; i++) {
+        if (!janet_vm.pair_counts[i]) continue;
+        Janet *tup = janet_tuple_begin(2);
+        tup[0] = janet_counted_opcode(i / 128);
+        tup[1] = janet_counted_opcode(i % 128);
+        Janet key = janet_wrap_tuple(janet_tuple_end(tup));
+        Janet old = janet_table_get(pairs, key);
+        double count = janet_checktype(old, JANET_NUMBER) ? janet_unwrap_number(old) : 0.0;
+        janet_table_put(pairs, key, janet_wrap_number(count + (double) janet_vm.pair_counts[i]));
+    }
+
+    /* Function definitions, most executed first */
+    size_t n = janet_vm.counted_count;
+    JanetDefCount *defs = janet_smalloc((n ? n : 1) * sizeof(JanetDefCount));
+    for (size_t i = 0; i < n; i++) {
+        JanetFuncDef *def = janet_vm.counted_defs[i];
+        uint64_t total = 0;
+        for (int32_t j = 0; j < def->bytecode_length; j++) total += def->counters[j];
+        defs[i].def = def;
+        defs[i].count = total;
+    }
+    qsort(defs, n, sizeof(JanetDefCount), janet_defcount_cmp);
+    JanetArray *functions = janet_array((int32_t) n);
+    for (size_t i = 0; i < n; i++) {
+        JanetFuncDef *def = defs[i].def;
+        JanetTable *t = janet_table(5);
+        janet_table_put(t, janet_ckeywordv("name"),
+                        def->name ? janet_wrap_string(def->name) : janet_cstringv("<anonymous>"));
+        if (def->source) janet_table_put(t, janet_ckeywordv("source"), janet_wrap_string(def->source));
+        if (def->sourcemap) janet_table_put(t, janet_ckeywordv("line"), janet_wrap_integer(def->sourcemap[0].line));
+        janet_table_put(t, janet_ckeywordv("count"), janet_wrap_number((double) defs[i].count));
+        if (pcs) {
+            JanetArray *counts = janet_array(def->bytecode_length);
+            for (int32_t j = 0; j < def->bytecode_length; j++) {
+                janet_array_push(counts, janet_wrap_number((double) def->counters[j]));
+            }
+            janet_table_put(t, janet_ckeywordv("pcs"), janet_wrap_array(counts));
+        }
+        janet_array_push(functions, janet_wrap_table(t));
+    }
+    janet_sfree(defs);
+
+    JanetTable *result = janet_table(3);
+    janet_table_put(result, janet_ckeywordv("opcodes"), janet_wrap_table(opcodes));
+    janet_table_put(result, janet_ckeywordv("pairs"), janet_wrap_table(pairs));
+    janet_table_put(result, janet_ckeywordv("functions"), janet_wrap_array(functions));
+    return janet_wrap_table(result);
+}
+
+static Janet janet_core_vm_counters_reset(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    janet_counters_reset();
+    return janet_wrap_nil();
+}
+
+#endif
+
 static Janet janet_core_check_int(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     if (!janet_checktype(argv[0], JANET_NUMBER)) goto ret_false;
@@ -634,7 +883,8 @@ static const JanetReg corelib_cfuns[] = {
         JDOC("(gcsetinterval interval)\n\n"
              "Set an integer number of bytes to allocate before running garbage collection. "
              "Low values for interval will be slower but use less memory. "
-             "High values will be faster but use more memory.")
+             "High values will be faster but use more memory. The interval is a minimum, as "
+             "it is raised automatically for large heaps, see gc/set-target.")
     },
     {
         "gcinterval", janet_core_gcinterval,
@@ -642,6 +892,115 @@ static const JanetReg corelib_cfuns[] = {
              "Returns the integer number of bytes to allocate before running an iteration "
              "of garbage collection.")
     },
+    {
+        "gcsetpause", janet_core_gcsetpause,
+        JDOC("(gcsetpause pause)\n\n"
+             "Set the maximum number of objects traced in one slice of incremental garbage "
+             "collection. Once the heap has grown enough to need a full collection, it is "
+             "marked a slice at a time between minor collections and event loop iterations, "
+             "which bounds how long the program is paused. Low values give shorter pauses "
+             "but take longer to reclaim memory. A pause of 0 disables incremental collection.")
+    },
+    {
+        "gcpause", janet_core_gcpause,
+        JDOC("(gcpause)\n\n"
+             "Returns the maximum number of objects traced in one slice of incremental "
+             "garbage collection.")
+    },
+    {
+        "gc/stats", janet_core_gcstats,
+        JDOC("(gc/stats)\n\n"
+             "Returns a table of garbage collector statistics:\n\n"
+             "* :minor-collections and :full-collections - number of collections so far\n\n"
+             "* :pauses - number of times the program was paused for garbage collection, "
+             "including slices of incremental collections\n\n"
+             "* :pause-total and :pause-max - total and longest pause in seconds\n\n"
+             "* :pause-histogram - array of pause counts, where index i counts pauses shorter "
+             "than 2^i microseconds that do not fit in an earlier index\n\n"
+             "* :types - table from memory type to a struct of :blocks and :bytes in use\n\n"
+             "* :blocks, :old-blocks and :bytes - totals for the whole heap\n\n"
+             "* :live-bytes - size of the heap after the last full collection, including "
+             "data owned by arrays, tables, buffers and fibers\n\n"
+             "* :roots - number of values rooted with janet_gcroot\n\n"
+             "* :scratch-blocks and :scratch-bytes - scratch memory in use\n\n"
+             "* :large-blocks and :large-bytes - data of big arrays, buffers and fiber stacks "
+             "that is mapped directly from the operating system")
+    },
+    {
+        "gc/set-limit", janet_core_gcsetlimit,
+        JDOC("(gc/set-limit limit)\n\n"
+             "Set a soft limit on the size of the heap in bytes, or nil for no limit. As the "
+             "heap nears the limit, garbage is collected more often, and the whole heap is "
+             "collected once it is over the limit. The heap may still grow past the limit "
+             "if that much memory is reachable.")
+    },
+    {
+        "gc/limit", janet_core_gclimit,
+        JDOC("(gc/limit)\n\n"
+             "Returns the soft limit on the size of the heap in bytes, or nil if there is none.")
+    },
+    {
+        "gc/set-target", janet_core_gcsettarget,
+        JDOC("(gc/set-target percent)\n\n"
+             "Set how much the heap may grow between full garbage collections, as a percentage "
+             "of the heap that was live after the last one. The default is 100, which lets the "
+             "heap double. Lower values use less memory and collect more often. The young "
+             "generation also grows with the live heap, but never shrinks below gcinterval "
+             "unless the heap is close to its limit.")
+    },
+    {
+        "gc/target", janet_core_gctarget,
+        JDOC("(gc/target)\n\n"
+             "Returns how much the heap may grow between full garbage collections, in percent.")
+    },
+    {
+        "gc/region-begin", janet_core_gcregionbegin,
+        JDOC("(gc/region-begin)\n\n"
+             "Start a memory region and return a handle for gc/region-end. A region is a hint "
+             "to put off automatic garbage collection until it ends, not a separate arena. It "
+             "belongs to the fiber that started it, and is paused while that fiber is suspended. "
+             "Prefer the with-region macro.")
+    },
+    {
+        "gc/region-end", janet_core_gcregionend,
+        JDOC("(gc/region-end handle)\n\n"
+             "End the memory region started by the gc/region-begin call that returned handle, "
+             "along with any regions nested in it. Does nothing if the region was already ended. "
+             "If regions allocated enough memory, run the minor collection that was put off.")
+    },
+    {
+        "gc/profile", janet_core_gcprofile,
+        JDOC("(gc/profile rate)\n\n"
+             "Start sampling allocations for a heap profile, on average once every rate "
+             "bytes allocated. Each sample records the stack of the current fiber, and whether "
+             "the sampled object is still alive. Starting a profile discards the previous one. "
+             "Pass nil or 0 to stop sampling but keep the profile for gc/profile-dump.")
+    },
+    {
+        "gc/profile-dump", janet_core_gcprofiledump,
+        JDOC("(gc/profile-dump &opt kind buffer)\n\n"
+             "Write the heap profile to a buffer in folded stack format, as read by flame "
+             "graph tools. Each line is a stack of frames separated by semicolons, outermost "
+             "first and ending in the type of the allocated object, then a space and an estimate "
+             "of the bytes or objects allocated there. kind is one of :inuse-space (the default), "
+             ":inuse-objects, :alloc-space, :alloc-objects, :survived-space or :survived-objects. "
+             "In use counts objects that are still alive, alloc counts every sampled object, and "
+             "survived counts objects that lived through at least one garbage collection. "
+             "Returns the buffer.")
+    },
+#ifdef JANET_PARALLEL_GC
+    {
+        "gcsetthreads", janet_core_gcsetthreads,
+        JDOC("(gcsetthreads n)\n\n"
+             "Set the number of helper threads used to mark the heap in parallel during full "
+             "garbage collections of large heaps. A value of 0 disables parallel marking.")
+    },
+    {
+        "gcthreads", janet_core_gcthreads,
+        JDOC("(gcthreads)\n\n"
+             "Returns the number of helper threads used to mark the heap in parallel.")
+    },
+#endif
     {
         "type", janet_core_type,
         JDOC("(type x)\n\n"
@@ -697,6 +1056,32 @@ static const JanetReg corelib_cfuns[] = {
         JDOC("(untrace func)\n\n"
              "Disables tracing on a function. Returns the function.")
     },
+#ifdef JANET_VM_COUNTERS
+    {
+        "vm/counting", janet_core_vm_counting,
+        JDOC("(vm/counting &opt on)\n\n"
+             "Turn execution counters on or off. While they are on, the interpreter counts "
+             "every instruction it executes per opcode and per instruction of each function, "
+             "and hot functions are not compiled to native code. Returns whether counters "
+             "were on before the call. Without an argument, only returns whether counters are on.")
+    },
+    {
+        "vm/counters", janet_core_vm_counters,
+        JDOC("(vm/counters &opt pcs)\n\n"
+             "Get the execution counters as a table with three keys. `:opcodes` maps the name "
+             "of each instruction to how often it ran, with specialized forms of an instruction "
+             "counted as the instruction. `:pairs` maps tuples of two instruction names to how "
+             "often the second ran right after the first. `:functions` is an array of tables, one per function "
+             "definition that ran, with the most executed first. Each has the keys `:name`, `:source`, "
+             "`:line` and `:count`, the number of instructions it ran. If `pcs` is truthy, each "
+             "also has `:pcs`, an array with the execution count of each bytecode instruction.")
+    },
+    {
+        "vm/counters-reset", janet_core_vm_counters_reset,
+        JDOC("(vm/counters-reset)\n\n"
+             "Set all execution counters to zero. Returns nil.")
+    },
+#endif
     {
         "module/expand-path", janet_core_expand_path,
         JDOC("(module/expand-path path template)\n\n"
@@ -1038,6 +1423,9 @@ static void janet_load_libs(JanetTable *env) {
 #ifdef JANET_NET
     janet_lib_net(env);
 #endif
+#ifdef JANET_PROFILE
+    janet_lib_profile(env);
+#endif
 }
 
 #ifdef JANET_BOOTSTRAP
@@ -38,6 +38,9 @@ void janet_debug_break(JanetFuncDef *def, int32_t pc) {
     if (pc >= def->bytecode_length || pc < 0)
         janet_panic("invalid bytecode offset");
     def->bytecode[pc] |= 0x80;
+#ifdef JANET_JIT
+    janet_jit_discard(def);
+#endif
 }
 
 /* Remove a break point from a function */
@@ -47,6 +50,46 @@ void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
     def->bytecode[pc] &= ~((uint32_t)0x80);
 }
 
+/* State for searching the heap for a breakpoint location */
+typedef struct {
+    const uint8_t *source;
+    int32_t line;
+    int32_t column;
+    /* Keep track of the best source mapping we have seen so far */
+    int32_t besti;
+    int32_t best_line;
+    int32_t best_column;
+    JanetFuncDef *best_def;
+} JanetBreakSearch;
+
+static void janet_debug_find_visit(JanetGCObject *mem, void *data) {
+    JanetBreakSearch *search = (JanetBreakSearch *) data;
+    if ((mem->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
+        JanetFuncDef *def = (JanetFuncDef *)(mem);
+        if (def->sourcemap &&
+                def->source &&
+                !janet_string_compare(search->source, def->source)) {
+            /* Correct source file, check mappings. The chosen
+             * pc index is the instruction closest to the given line column, but
+             * not after. */
+            int32_t i;
+            for (i = 0; i < def->bytecode_length; i++) {
+                int32_t line = def->sourcemap[i].line;
+                int32_t column = def->sourcemap[i].column;
+                if (line <= search->line && line >= search->best_line) {
+                    if (column <= search->column &&
+                            (line > search->best_line || column > search->best_column)) {
+                        search->best_line = line;
+                        search->best_column = column;
+                        search->besti = i;
+                        search->best_def = def;
+                    }
+                }
+            }
+        }
+    }
+}
+
 /*
  * Find a location for a breakpoint given a source file an
  * location.
@@ -54,43 +97,19 @@ void janet_debug_unbreak(JanetFuncDef *def, int32_t pc) {
 void janet_debug_find(
     JanetFuncDef **def_out, int32_t *pc_out,
     const uint8_t *source, int32_t sourceLine, int32_t sourceColumn) {
+    JanetBreakSearch search;
+    search.source = source;
+    search.line = sourceLine;
+    search.column = sourceColumn;
+    search.besti = -1;
+    search.best_line = -1;
+    search.best_column = -1;
+    search.best_def = NULL;
     /* Scan the heap for right func def */
-    JanetGCObject *current = janet_vm.blocks;
-    /* Keep track of the best source mapping we have seen so far */
-    int32_t besti = -1;
-    int32_t best_line = -1;
-    int32_t best_column = -1;
-    JanetFuncDef *best_def = NULL;
-    while (NULL != current) {
-        if ((current->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_FUNCDEF) {
-            JanetFuncDef *def = (JanetFuncDef *)(current);
-            if (def->sourcemap &&
-                    def->source &&
-                    !janet_string_compare(source, def->source)) {
-                /* Correct source file, check mappings. The chosen
-                 * pc index is the instruction closest to the given line column, but
-                 * not after. */
-                int32_t i;
-                for (i = 0; i < def->bytecode_length; i++) {
-                    int32_t line = def->sourcemap[i].line;
-                    int32_t column = def->sourcemap[i].column;
-                    if (line <= sourceLine && line >= best_line) {
-                        if (column <= sourceColumn &&
-                                (line > best_line || column > best_column)) {
-                            best_line = line;
-                            best_column = column;
-                            besti = i;
-                            best_def = def;
-                        }
-                    }
-                }
-            }
-        }
-        current = current->next;
-    }
-    if (best_def) {
-        *def_out = best_def;
-        *pc_out = besti;
+    janet_gc_foreach(janet_debug_find_visit, &search);
+    if (search.best_def) {
+        *def_out = search.best_def;
+        *pc_out = search.besti;
     } else {
         janet_panic("could not find breakpoint");
     }
@@ -26,6 +26,7 @@
 #include "emit.h"
 #include "vector.h"
 #include "regalloc.h"
+#include "util.h"
 #endif
 
 /* Get a register */
@@ -48,6 +49,21 @@ void janetc_emit(JanetCompiler *c, uint32_t instr) {
     janet_v_push(c->mapbuffer, c->current_mapping);
 }
 
+/* Emit the prefix that carries the high bytes of the registers of the
+ * next instruction, if any of them is above 0xFF. */
+static void janetc_emit_wide(JanetCompiler *c, int32_t a, int32_t b, int32_t cc) {
+    uint32_t hi = ((uint32_t) a & 0xFF00) |
+                  (((uint32_t) b & 0xFF00) << 8) |
+                  (((uint32_t) cc & 0xFF00) << 16);
+    if (hi) janetc_emit(c, hi | JOP_WIDE);
+}
+
+/* Check if an instruction can take count registers from a prefix */
+static int janetc_widens(uint8_t op, int32_t count) {
+    int32_t regs[3];
+    return janet_wide_registers(0, op, regs) == count;
+}
+
 /* Add a constant to the current scope. Return the index of the constant. */
 static int32_t janetc_const(JanetCompiler *c, Janet x) {
     JanetScope *scope = c->scope;
@@ -91,18 +107,20 @@ static void janetc_loadconst(JanetCompiler *c, Janet k, int32_t reg) {
             if (dval != i)
                 goto do_constant;
             uint32_t iu = (uint32_t)i;
+            janetc_emit_wide(c, reg, 0, 0);
             janetc_emit(c,
                         (iu << 16) |
-                        (reg << 8) |
+                        ((reg & 0xFF) << 8) |
                         JOP_LOAD_INTEGER);
             break;
         }
         default:
         do_constant: {
                 int32_t cindex = janetc_const(c, k);
+                janetc_emit_wide(c, reg, 0, 0);
                 janetc_emit(c,
                             (cindex << 16) |
-                            (reg << 8) |
+                            ((reg & 0xFF) << 8) |
                             JOP_LOAD_CONSTANT);
                 break;
             }
@@ -204,6 +222,15 @@ static int32_t janetc_regnear(JanetCompiler *c, JanetSlot s, JanetcRegisterTemp
     return reg;
 }
 
+/* Convert a slot to a register for an instruction that may be widened.
+ * Local slots are used in place, with their high byte in a prefix. */
+static int32_t janetc_regwide(JanetCompiler *c, JanetSlot s, JanetcRegisterTemp tag, int wide) {
+    if (wide && s.envindex < 0 && s.index >= 0) {
+        return s.index;
+    }
+    return janetc_regnear(c, s, tag);
+}
+
 /* Check if two slots are equal */
 int janetc_sequal(JanetSlot lhs, JanetSlot rhs) {
     if ((lhs.flags & ~JANET_SLOTTYPE_ANY) == (rhs.flags & ~JANET_SLOTTYPE_ANY) &&
@@ -239,6 +266,21 @@ void janetc_copy(
         janetc_moveback(c, dest, src.index);
         return;
     }
+    /* If dest is a far register, move or load into it directly */
+    if (dest.envindex < 0 && dest.index >= 0 && !(dest.flags & JANET_SLOT_REF)) {
+        if (src.envindex < 0 && src.index >= 0 && !(src.flags & (JANET_SLOT_CONSTANT | JANET_SLOT_REF))) {
+            janetc_emit_wide(c, dest.index, 0, 0);
+            janetc_emit(c,
+                        ((uint32_t)(src.index) << 16) |
+                        ((uint32_t)(dest.index & 0xFF) << 8) |
+                        JOP_MOVE_NEAR);
+            return;
+        }
+        if ((src.flags & (JANET_SLOT_CONSTANT | JANET_SLOT_REF)) == JANET_SLOT_CONSTANT) {
+            janetc_loadconst(c, src.constant, dest.index);
+            return;
+        }
+    }
     /* Process: src -> near -> dest */
     int32_t nearreg = janetc_allocnear(c, JANETC_REGTEMP_3);
     janetc_movenear(c, nearreg, src);
@@ -250,9 +292,10 @@ void janetc_copy(
 /* Instruction templated emitters */
 
 static int32_t emit1s(JanetCompiler *c, uint8_t op, JanetSlot s, int32_t rest, int wr) {
-    int32_t reg = janetc_regnear(c, s, JANETC_REGTEMP_0);
+    int32_t reg = janetc_regwide(c, s, JANETC_REGTEMP_0, janetc_widens(op, 1));
+    janetc_emit_wide(c, reg, 0, 0);
     int32_t label = janet_v_count(c->buffer);
-    janetc_emit(c, op | (reg << 8) | ((uint32_t)rest << 16));
+    janetc_emit(c, op | ((reg & 0xFF) << 8) | ((uint32_t)rest << 16));
     if (wr)
         janetc_moveback(c, s, reg);
     janetc_free_regnear(c, s, reg, JANETC_REGTEMP_0);
@@ -291,10 +334,12 @@ int32_t janetc_emit_su(JanetCompiler *c, uint8_t op, JanetSlot s, uint16_t immed
 }
 
 static int32_t emit2s(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2, int32_t rest, int wr) {
-    int32_t reg1 = janetc_regnear(c, s1, JANETC_REGTEMP_0);
-    int32_t reg2 = janetc_regnear(c, s2, JANETC_REGTEMP_1);
+    int wide = janetc_widens(op, 2);
+    int32_t reg1 = janetc_regwide(c, s1, JANETC_REGTEMP_0, wide);
+    int32_t reg2 = janetc_regwide(c, s2, JANETC_REGTEMP_1, wide);
+    janetc_emit_wide(c, reg1, reg2, 0);
     int32_t label = janet_v_count(c->buffer);
-    janetc_emit(c, op | (reg1 << 8) | (reg2 << 16) | ((uint32_t)rest << 24));
+    janetc_emit(c, op | ((reg1 & 0xFF) << 8) | ((reg2 & 0xFF) << 16) | ((uint32_t)rest << 24));
     janetc_free_regnear(c, s2, reg2, JANETC_REGTEMP_1);
     if (wr)
         janetc_moveback(c, s1, reg1);
@@ -303,10 +348,11 @@ static int32_t emit2s(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2,
 }
 
 int32_t janetc_emit_ss(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2, int wr) {
-    int32_t reg1 = janetc_regnear(c, s1, JANETC_REGTEMP_0);
+    int32_t reg1 = janetc_regwide(c, s1, JANETC_REGTEMP_0, janetc_widens(op, 2));
     int32_t reg2 = janetc_regfar(c, s2, JANETC_REGTEMP_1);
+    janetc_emit_wide(c, reg1, 0, 0);
     int32_t label = janet_v_count(c->buffer);
-    janetc_emit(c, op | (reg1 << 8) | (reg2 << 16));
+    janetc_emit(c, op | ((reg1 & 0xFF) << 8) | (reg2 << 16));
     janetc_free_regnear(c, s2, reg2, JANETC_REGTEMP_1);
     if (wr)
         janetc_moveback(c, s1, reg1);
@@ -323,11 +369,13 @@ int32_t janetc_emit_ssu(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2
 }
 
 int32_t janetc_emit_sss(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2, JanetSlot s3, int wr) {
-    int32_t reg1 = janetc_regnear(c, s1, JANETC_REGTEMP_0);
-    int32_t reg2 = janetc_regnear(c, s2, JANETC_REGTEMP_1);
-    int32_t reg3 = janetc_regnear(c, s3, JANETC_REGTEMP_2);
+    int wide = janetc_widens(op, 3);
+    int32_t reg1 = janetc_regwide(c, s1, JANETC_REGTEMP_0, wide);
+    int32_t reg2 = janetc_regwide(c, s2, JANETC_REGTEMP_1, wide);
+    int32_t reg3 = janetc_regwide(c, s3, JANETC_REGTEMP_2, wide);
+    janetc_emit_wide(c, reg1, reg2, reg3);
     int32_t label = janet_v_count(c->buffer);
-    janetc_emit(c, op | (reg1 << 8) | (reg2 << 16) | ((uint32_t)reg3 << 24));
+    janetc_emit(c, op | ((reg1 & 0xFF) << 8) | ((reg2 & 0xFF) << 16) | ((uint32_t)(reg3 & 0xFF) << 24));
     janetc_free_regnear(c, s2, reg2, JANETC_REGTEMP_1);
     janetc_free_regnear(c, s3, reg3, JANETC_REGTEMP_2);
     if (wr)
@@ -335,3 +383,53 @@ int32_t janetc_emit_sss(JanetCompiler *c, uint8_t op, JanetSlot s1, JanetSlot s2
     janetc_free_regnear(c, s1, reg1, JANETC_REGTEMP_0);
     return label;
 }
+
+/* Fuse common pairs of instructions in the bytecode of a function into
+ * superinstructions. Counting opcode pairs with tools/oppairs.janet puts lt
+ * or ltim followed by a jmpno or jmpif on the result at the top, so these
+ * are fused. Loops compiled by while test their condition at the bottom,
+ * where a counting loop ends in addim, lt or ltim on the new value and a
+ * jmpif back to the body. Those three become one instruction. The
+ * instructions after the first one stay in place, which keeps jumps to them
+ * and breakpoints on them working. This runs once the bytecode of a function
+ * is complete and optimized, as the compiler may still discard or patch
+ * instructions before then. */
+void janetc_superinstructions(JanetFuncDef *def) {
+    uint32_t *bytecode = def->bytecode;
+    for (int32_t i = 0; i + 1 < def->bytecode_length; i++) {
+        uint32_t instr = bytecode[i];
+        uint32_t next = bytecode[i + 1];
+        uint8_t fused, fusedif;
+        /* Widened instructions are not fused */
+        if (i > 0 && (bytecode[i - 1] & 0xFF) == JOP_WIDE) continue;
+        switch (instr & 0xFF) {
+            default:
+                continue;
+            case JOP_LESS_THAN:
+                fused = JOP_LESS_THAN_JUMP_IF_NOT;
+                fusedif = JOP_LESS_THAN_JUMP_IF;
+                break;
+            case JOP_LESS_THAN_IMMEDIATE:
+                fused = JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT;
+                fusedif = JOP_LESS_THAN_IMMEDIATE_JUMP_IF;
+                break;
+            case JOP_ADD_IMMEDIATE:
+                if (i + 2 < def->bytecode_length &&
+                        ((next & 0xFF) == JOP_LESS_THAN || (next & 0xFF) == JOP_LESS_THAN_IMMEDIATE) &&
+                        ((next >> 16) & 0xFF) == ((instr >> 8) & 0xFF) &&
+                        (bytecode[i + 2] & 0xFF) == JOP_JUMP_IF &&
+                        ((bytecode[i + 2] >> 8) & 0xFF) == ((next >> 8) & 0xFF)) {
+                    bytecode[i] = (instr & ~0xFFu) | ((next & 0xFF) == JOP_LESS_THAN
+                                                      ? JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF
+                                                      : JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF);
+                }
+                continue;
+        }
+        if (((next >> 8) & 0xFF) != ((instr >> 8) & 0xFF)) continue;
+        if ((next & 0xFF) == JOP_JUMP_IF_NOT) {
+            bytecode[i] = (instr & ~0xFFu) | fused;
+        } else if ((next & 0xFF) == JOP_JUMP_IF) {
+            bytecode[i] = (instr & ~0xFFu) | fusedif;
+        }
+    }
+}
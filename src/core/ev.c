@@ -865,6 +865,9 @@ static Janet janet_chanat_next(void *p, Janet key) {
 void janet_loop1_impl(int has_timeout, JanetTimestamp timeout);
 
 void janet_loop1(void) {
+    /* Advance incremental marking between iterations */
+    janet_collect_step();
+
     /* Schedule expired timers */
     JanetTimeout to;
     JanetTimestamp now = ts_now();
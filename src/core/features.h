@@ -45,6 +45,16 @@
 #define _XOPEN_SOURCE 500
 #endif
 
+/* Needed for MAP_ANONYMOUS on linux */
+#if !defined(_DEFAULT_SOURCE) && (defined(__linux__) || defined(__EMSCRIPTEN__))
+#define _DEFAULT_SOURCE
+#endif
+
+/* Needed for mremap on linux */
+#if !defined(_GNU_SOURCE) && defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
 /* Needed for timegm and other extensions when building with -std=c99.
  * It also defines realpath, etc, which would normally require
  * _XOPEN_SOURCE >= 500. */
@@ -38,6 +38,7 @@ static void fiber_reset(JanetFiber *fiber) {
     fiber->flags = JANET_FIBER_MASK_YIELD | JANET_FIBER_RESUME_NO_USEVAL | JANET_FIBER_RESUME_NO_SKIP;
     fiber->env = NULL;
     fiber->last_value = janet_wrap_nil();
+    fiber->region = 0;
 #ifdef JANET_EV
     fiber->waiting = NULL;
     fiber->sched_id = 0;
@@ -46,17 +47,79 @@ static void fiber_reset(JanetFiber *fiber) {
     janet_fiber_set_status(fiber, JANET_STATUS_NEW);
 }
 
+/*
+ * Stack pool
+ *
+ * Programs that start a fiber per request or generator create and drop many
+ * fibers with small stacks. Their stacks are recycled instead of going back
+ * to malloc. Small capacities are rounded up to a power of two times
+ * JANET_FIBER_POOL_MIN so that each freed stack fits one bucket, and a free
+ * stack stores the pointer to the next one of its bucket in its first slot.
+ */
+
+/* Round a stack capacity up to the size of a pool bucket, if one fits */
+static int32_t janet_fiber_stack_capacity(int32_t capacity) {
+    int32_t c = JANET_FIBER_POOL_MIN;
+    for (int i = 0; i < JANET_FIBER_POOL_BUCKETS; i++, c <<= 1) {
+        if (capacity <= c) return c;
+    }
+    return capacity;
+}
+
+/* Get the pool bucket of a stack capacity, or -1 if it has none */
+static int janet_fiber_pool_bucket(int32_t capacity) {
+    int32_t c = JANET_FIBER_POOL_MIN;
+    for (int i = 0; i < JANET_FIBER_POOL_BUCKETS; i++, c <<= 1) {
+        if (capacity == c) return i;
+    }
+    return -1;
+}
+
+static Janet *janet_fiber_stack_alloc(int32_t capacity) {
+    int bucket = janet_fiber_pool_bucket(capacity);
+    if (bucket >= 0 && NULL != janet_vm.fiber_pool[bucket]) {
+        Janet *data = janet_vm.fiber_pool[bucket];
+        memcpy(janet_vm.fiber_pool + bucket, data, sizeof(Janet *));
+        janet_vm.fiber_pool_bytes -= sizeof(Janet) * (size_t) capacity;
+        return data;
+    }
+    return janet_gc_data_alloc(sizeof(Janet) * (size_t) capacity);
+}
+
+void janet_fiber_stack_free(Janet *data, int32_t capacity) {
+    size_t size = sizeof(Janet) * (size_t) capacity;
+    int bucket = janet_fiber_pool_bucket(capacity);
+    if (NULL != data && bucket >= 0 && janet_vm.fiber_pool_bytes + size <= JANET_FIBER_POOL_BYTES) {
+        memcpy(data, janet_vm.fiber_pool + bucket, sizeof(Janet *));
+        janet_vm.fiber_pool[bucket] = data;
+        janet_vm.fiber_pool_bytes += size;
+    } else {
+        janet_gc_data_free(data, size);
+    }
+}
+
+/* Free all pooled stacks */
+void janet_fiber_pool_clear(void) {
+    int32_t capacity = JANET_FIBER_POOL_MIN;
+    for (int i = 0; i < JANET_FIBER_POOL_BUCKETS; i++, capacity <<= 1) {
+        Janet *data = janet_vm.fiber_pool[i];
+        while (NULL != data) {
+            Janet *next;
+            memcpy(&next, data, sizeof(Janet *));
+            janet_gc_data_free(data, sizeof(Janet) * (size_t) capacity);
+            data = next;
+        }
+        janet_vm.fiber_pool[i] = NULL;
+    }
+    janet_vm.fiber_pool_bytes = 0;
+}
+
 static JanetFiber *fiber_alloc(int32_t capacity) {
     Janet *data;
     JanetFiber *fiber = janet_gcalloc(JANET_MEMORY_FIBER, sizeof(JanetFiber));
-    if (capacity < 32) {
-        capacity = 32;
-    }
+    capacity = janet_fiber_stack_capacity(capacity);
     fiber->capacity = capacity;
-    data = janet_malloc(sizeof(Janet) * (size_t) capacity);
-    if (NULL == data) {
-        JANET_OUT_OF_MEMORY;
-    }
+    data = janet_fiber_stack_alloc(capacity);
     janet_vm.next_collection += sizeof(Janet) * capacity;
     fiber->data = data;
     return fiber;
@@ -100,12 +163,9 @@ JanetFiber *janet_fiber(JanetFunction *callee, int32_t capacity, int32_t argc, c
 static void janet_fiber_refresh_memory(JanetFiber *fiber) {
     int32_t n = fiber->capacity;
     if (n) {
-        Janet *newData = janet_malloc(sizeof(Janet) * n);
-        if (NULL == newData) {
-            JANET_OUT_OF_MEMORY;
-        }
+        Janet *newData = janet_gc_data_alloc(sizeof(Janet) * n);
         memcpy(newData, fiber->data, fiber->capacity * sizeof(Janet));
-        janet_free(fiber->data);
+        janet_gc_data_free(fiber->data, sizeof(Janet) * n);
         fiber->data = newData;
     }
 }
@@ -114,10 +174,16 @@ static void janet_fiber_refresh_memory(JanetFiber *fiber) {
 /* Ensure that the fiber has enough extra capacity */
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n) {
     int32_t old_size = fiber->capacity;
+    n = janet_fiber_stack_capacity(n);
     int32_t diff = n - old_size;
-    Janet *newData = janet_realloc(fiber->data, sizeof(Janet) * n);
-    if (NULL == newData) {
-        JANET_OUT_OF_MEMORY;
+    Janet *newData;
+    if (janet_fiber_pool_bucket(n) >= 0) {
+        newData = janet_fiber_stack_alloc(n);
+        memcpy(newData, fiber->data, sizeof(Janet) * (size_t)(old_size < n ? old_size : n));
+        janet_fiber_stack_free(fiber->data, old_size);
+    } else {
+        newData = janet_gc_data_realloc(fiber->data, sizeof(Janet) * (size_t) old_size,
+                                        sizeof(Janet) * (size_t) n);
     }
     fiber->data = newData;
     fiber->capacity = n;
@@ -278,6 +344,21 @@ static void janet_env_detach(JanetFuncEnv *env) {
     }
 }
 
+/* Release the closure environment of a frame that is being popped. When the
+ * compiler has shown that no closure over the frame outlives it, the values
+ * are not needed anymore and need not be copied off the stack. */
+static void janet_env_release(JanetStackFrame *frame) {
+    JanetFuncEnv *env = frame->env;
+    if (NULL == env) return;
+    if (frame->func->def->flags & JANET_FUNCDEF_FLAG_STACKENV) {
+        env->offset = 0;
+        env->length = 0;
+        env->as.values = NULL;
+    } else {
+        janet_env_detach(env);
+    }
+}
+
 /* Validate potentially untrusted func env (unmarshalled envs are difficult to verify) */
 int janet_env_valid(JanetFuncEnv *env) {
     if (env->offset < 0) {
@@ -349,7 +430,7 @@ int janet_fiber_funcframe_tail(JanetFiber *fiber, JanetFunction *func) {
 
     /* Detach old function */
     if (NULL != janet_fiber_frame(fiber)->func)
-        janet_env_detach(janet_fiber_frame(fiber)->env);
+        janet_env_release(janet_fiber_frame(fiber));
     janet_fiber_frame(fiber)->env = NULL;
 
     /* Check varargs */
@@ -430,7 +511,7 @@ void janet_fiber_popframe(JanetFiber *fiber) {
 
     /* Clean up the frame (detach environments) */
     if (NULL != frame->func)
-        janet_env_detach(frame->env);
+        janet_env_release(frame);
 
     /* Shrink stack */
     fiber->stacktop = fiber->stackstart = fiber->frame;
@@ -62,9 +62,19 @@
     (f)->flags |= (s) << JANET_FIBER_STATUS_OFFSET;\
 } while (0)
 
+/* Fiber stacks with a capacity of JANET_FIBER_POOL_MIN times a power of two,
+ * up to JANET_FIBER_POOL_BUCKETS sizes, are recycled through a pool of at
+ * most JANET_FIBER_POOL_BYTES bytes. */
+#define JANET_FIBER_POOL_MIN 32
+#ifndef JANET_FIBER_POOL_BYTES
+#define JANET_FIBER_POOL_BYTES 0x100000
+#endif
+
 #define janet_stack_frame(s) ((JanetStackFrame *)((s) - JANET_FRAME_SIZE))
 #define janet_fiber_frame(f) janet_stack_frame((f)->data + (f)->frame)
 void janet_fiber_setcapacity(JanetFiber *fiber, int32_t n);
+void janet_fiber_stack_free(Janet *data, int32_t capacity);
+void janet_fiber_pool_clear(void);
 void janet_fiber_push(JanetFiber *fiber, Janet x);
 void janet_fiber_push2(JanetFiber *fiber, Janet x, Janet y);
 void janet_fiber_push3(JanetFiber *fiber, Janet x, Janet y, Janet z);
@@ -31,6 +31,45 @@
 #include "vector.h"
 #endif
 
+#ifdef JANET_WINDOWS
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#if defined(JANET_THREADS) || defined(JANET_PARALLEL_GC)
+#include <pthread.h>
+#endif
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if defined(JANET_THREADS) || defined(JANET_PARALLEL_GC)
+/* Thread primitives used by parallel marking and background finalization */
+#ifdef JANET_WINDOWS
+typedef CRITICAL_SECTION JanetGCLock;
+typedef CONDITION_VARIABLE JanetGCCond;
+#define janet_gc_lock_init(l) InitializeCriticalSection(l)
+#define janet_gc_lock_deinit(l) DeleteCriticalSection(l)
+#define janet_gc_lock(l) EnterCriticalSection(l)
+#define janet_gc_unlock(l) LeaveCriticalSection(l)
+#define janet_gc_cond_init(c) InitializeConditionVariable(c)
+#define janet_gc_cond_deinit(c) ((void) 0)
+#define janet_gc_wait(c, l) SleepConditionVariableCS((c), (l), INFINITE)
+#define janet_gc_wake(c) WakeAllConditionVariable(c)
+#else
+typedef pthread_mutex_t JanetGCLock;
+typedef pthread_cond_t JanetGCCond;
+#define janet_gc_lock_init(l) pthread_mutex_init((l), NULL)
+#define janet_gc_lock_deinit(l) pthread_mutex_destroy(l)
+#define janet_gc_lock(l) pthread_mutex_lock(l)
+#define janet_gc_unlock(l) pthread_mutex_unlock(l)
+#define janet_gc_cond_init(c) pthread_cond_init((c), NULL)
+#define janet_gc_cond_deinit(c) pthread_cond_destroy(c)
+#define janet_gc_wait(c, l) pthread_cond_wait((c), (l))
+#define janet_gc_wake(c) pthread_cond_broadcast(c)
+#endif
+#endif
+
 /* Helpers for marking the various gc types */
 static void janet_mark_funcenv(JanetFuncEnv *env);
 static void janet_mark_funcdef(JanetFuncDef *def);
@@ -44,9 +83,76 @@ static void janet_mark_string(const uint8_t *str);
 static void janet_mark_fiber(JanetFiber *fiber);
 static void janet_mark_abstract(void *adata);
 
+/* How reached objects are handled while marking. See janet_gc_grey. */
+#define JANET_GC_TRACE 0 /* Trace right away */
+#define JANET_GC_GREY_OLD 1 /* Slice of incremental marking */
+#define JANET_GC_GREY_ALL 2 /* Parallel marking */
+
 /* Local state that is only temporary for gc */
 static JANET_THREAD_LOCAL uint32_t depth = JANET_RECURSION_GUARD;
 static JANET_THREAD_LOCAL size_t orig_rootcount;
+static JANET_THREAD_LOCAL int32_t visited_mask = JANET_MEM_REACHABLE;
+static JANET_THREAD_LOCAL int grey_mode = JANET_GC_TRACE;
+
+/* During a minor collection, old objects are treated as already marked so
+ * that tracing stops at the boundary of the young generation. */
+#if defined(JANET_PARALLEL_GC) && !defined(JANET_WINDOWS)
+#define janet_gc_visited(m) (__atomic_load_n(&janet_gc_header(m)->flags, __ATOMIC_RELAXED) & visited_mask)
+#else
+#define janet_gc_visited(m) (janet_gc_header(m)->flags & visited_mask)
+#endif
+
+/* During a slice of incremental marking or parallel marking, objects are not
+ * traced right away. See janet_gc_grey. */
+#define janet_gc_defer(m, leaf) (grey_mode && janet_gc_grey(janet_gc_header(m), (leaf)))
+
+/* Push an object on a growable vector of gc objects */
+static void janet_gc_push(JanetGCObject ***vec, size_t *count, size_t *capacity, JanetGCObject *mem) {
+    if (*count == *capacity) {
+        size_t newcap = 2 * *capacity + 64;
+        JanetGCObject **newmem = janet_realloc(*vec, newcap * sizeof(JanetGCObject *));
+        if (NULL == newmem) {
+            JANET_OUT_OF_MEMORY;
+        }
+        *vec = newmem;
+        *capacity = newcap;
+    }
+    (*vec)[(*count)++] = mem;
+}
+
+#ifdef JANET_PARALLEL_GC
+/* Atomically set the mark bit of an object. Returns non-zero if this thread
+ * was the one to set it. */
+static int janet_gc_claim(JanetGCObject *mem) {
+#ifdef JANET_WINDOWS
+    return !(InterlockedOr((LONG volatile *) &mem->flags, JANET_MEM_REACHABLE) & JANET_MEM_REACHABLE);
+#else
+    return !(__atomic_fetch_or(&mem->flags, JANET_MEM_REACHABLE, __ATOMIC_RELAXED) & JANET_MEM_REACHABLE);
+#endif
+}
+#endif
+
+/* Mark an object and push it on the grey stack to be traced later. During
+ * incremental marking, only old objects are greyed and young objects are
+ * skipped, as the final pause of an incremental collection traces the young
+ * generation anyway. During parallel marking, every object is greyed, and
+ * marking is atomic as other threads may reach the same object. Objects
+ * without references (leaves) never need to be traced. */
+static int janet_gc_grey(JanetGCObject *mem, int leaf) {
+#ifdef JANET_PARALLEL_GC
+    if (grey_mode == JANET_GC_GREY_ALL) {
+        if (janet_gc_claim(mem) && !leaf)
+            janet_gc_push(&janet_vm.gc_grey, &janet_vm.gc_grey_count, &janet_vm.gc_grey_capacity, mem);
+        return 1;
+    }
+#endif
+    if (mem->flags & JANET_MEM_OLD) {
+        mem->flags |= JANET_MEM_REACHABLE;
+        if (!leaf)
+            janet_gc_push(&janet_vm.gc_grey, &janet_vm.gc_grey_count, &janet_vm.gc_grey_capacity, mem);
+    }
+    return 1;
+}
 
 /* Hint to the GC that we may need to collect */
 void janet_gcpressure(size_t s) {
@@ -97,19 +203,30 @@ void janet_mark(Janet x) {
 }
 
 static void janet_mark_string(const uint8_t *str) {
+    if (janet_gc_visited(janet_string_head(str)))
+        return;
+    if (janet_gc_defer(janet_string_head(str), 1))
+        return;
     janet_gc_mark(janet_string_head(str));
 }
 
 static void janet_mark_buffer(JanetBuffer *buffer) {
+    if (janet_gc_visited(buffer))
+        return;
+    if (janet_gc_defer(buffer, 1))
+        return;
     janet_gc_mark(buffer);
 }
 
 static void janet_mark_abstract(void *adata) {
-    if (janet_gc_reachable(janet_abstract_head(adata)))
+    JanetAbstractHead *head = janet_abstract_head(adata);
+    if (janet_gc_visited(head))
         return;
-    janet_gc_mark(janet_abstract_head(adata));
-    if (janet_abstract_head(adata)->type->gcmark) {
-        janet_abstract_head(adata)->type->gcmark(adata, janet_abstract_size(adata));
+    if (janet_gc_defer(head, NULL == head->type->gcmark))
+        return;
+    janet_gc_mark(head);
+    if (head->type->gcmark) {
+        head->type->gcmark(adata, janet_abstract_size(adata));
     }
 }
 
@@ -133,18 +250,50 @@ static void janet_mark_kvs(const JanetKV *kvs, int32_t n) {
 }
 
 static void janet_mark_array(JanetArray *array) {
-    if (janet_gc_reachable(array))
+    if (janet_gc_visited(array))
+        return;
+    if (janet_gc_defer(array, 0))
         return;
     janet_gc_mark(array);
     janet_mark_many(array->data, array->count);
 }
 
+/* Mark the strong half of a weak table, and remember the table so that its
+ * dead entries are removed once marking is done. Slices of incremental
+ * marking do not remember it, as the final pause traces every marked table
+ * again. The entries of an ephemeron table are marked by janet_mark_end. */
+static void janet_mark_weak_table(JanetTable *table) {
+    int32_t flags = table->gc.flags;
+    if (grey_mode != JANET_GC_GREY_OLD)
+        janet_gc_push(&janet_vm.gc_weak, &janet_vm.gc_weak_count, &janet_vm.gc_weak_capacity, &table->gc);
+    if (flags & JANET_TABLE_FLAG_EPHEMERON)
+        return;
+    const JanetKV *end = table->data + table->capacity;
+    for (const JanetKV *kv = table->data; kv < end; kv++) {
+        if (!(flags & JANET_TABLE_FLAG_WEAK_K))
+            janet_mark(kv->key);
+        if (!(flags & JANET_TABLE_FLAG_WEAK_V))
+            janet_mark(kv->value);
+    }
+}
+
+/* Mark the entries of a table */
+static void janet_mark_table_contents(JanetTable *table) {
+    if (table->gc.flags & JANET_TABLE_FLAG_WEAK) {
+        janet_mark_weak_table(table);
+    } else {
+        janet_mark_kvs(table->data, table->capacity);
+    }
+}
+
 static void janet_mark_table(JanetTable *table) {
 recur: /* Manual tail recursion */
-    if (janet_gc_reachable(table))
+    if (janet_gc_visited(table))
+        return;
+    if (janet_gc_defer(table, 0))
         return;
     janet_gc_mark(table);
-    janet_mark_kvs(table->data, table->capacity);
+    janet_mark_table_contents(table);
     if (table->proto) {
         table = table->proto;
         goto recur;
@@ -152,24 +301,25 @@ recur: /* Manual tail recursion */
 }
 
 static void janet_mark_struct(const JanetKV *st) {
-    if (janet_gc_reachable(janet_struct_head(st)))
+    if (janet_gc_visited(janet_struct_head(st)))
+        return;
+    if (janet_gc_defer(janet_struct_head(st), 0))
         return;
     janet_gc_mark(janet_struct_head(st));
     janet_mark_kvs(st, janet_struct_capacity(st));
 }
 
 static void janet_mark_tuple(const Janet *tuple) {
-    if (janet_gc_reachable(janet_tuple_head(tuple)))
+    if (janet_gc_visited(janet_tuple_head(tuple)))
+        return;
+    if (janet_gc_defer(janet_tuple_head(tuple), 0))
         return;
     janet_gc_mark(janet_tuple_head(tuple));
     janet_mark_many(tuple, janet_tuple_length(tuple));
 }
 
-/* Helper to mark function environments */
-static void janet_mark_funcenv(JanetFuncEnv *env) {
-    if (janet_gc_reachable(env))
-        return;
-    janet_gc_mark(env);
+/* Mark the values captured by a function environment */
+static void janet_mark_funcenv_contents(JanetFuncEnv *env) {
     /* If closure env references a dead fiber, we can just copy out the stack frame we need so
      * we don't need to keep around the whole dead fiber. */
     janet_env_maybe_detach(env);
@@ -182,12 +332,19 @@ static void janet_mark_funcenv(JanetFuncEnv *env) {
     }
 }
 
-/* GC helper to mark a FuncDef */
-static void janet_mark_funcdef(JanetFuncDef *def) {
-    int32_t i;
-    if (janet_gc_reachable(def))
+/* Helper to mark function environments */
+static void janet_mark_funcenv(JanetFuncEnv *env) {
+    if (janet_gc_visited(env))
         return;
-    janet_gc_mark(def);
+    if (janet_gc_defer(env, 0))
+        return;
+    janet_gc_mark(env);
+    janet_mark_funcenv_contents(env);
+}
+
+/* Mark the constants and sub definitions of a FuncDef */
+static void janet_mark_funcdef_contents(JanetFuncDef *def) {
+    int32_t i;
     janet_mark_many(def->constants, def->constants_length);
     for (i = 0; i < def->defs_length; ++i) {
         janet_mark_funcdef(def->defs[i]);
@@ -198,12 +355,20 @@ static void janet_mark_funcdef(JanetFuncDef *def) {
         janet_mark_string(def->name);
 }
 
-static void janet_mark_function(JanetFunction *func) {
+/* GC helper to mark a FuncDef */
+static void janet_mark_funcdef(JanetFuncDef *def) {
+    if (janet_gc_visited(def))
+        return;
+    if (janet_gc_defer(def, 0))
+        return;
+    janet_gc_mark(def);
+    janet_mark_funcdef_contents(def);
+}
+
+/* Mark the environments and definition of a function */
+static void janet_mark_function_contents(JanetFunction *func) {
     int32_t i;
     int32_t numenvs;
-    if (janet_gc_reachable(func))
-        return;
-    janet_gc_mark(func);
     if (NULL != func->def) {
         /* this should always be true, except if function is only partially constructed */
         numenvs = func->def->environments_length;
@@ -214,13 +379,19 @@ static void janet_mark_function(JanetFunction *func) {
     }
 }
 
-static void janet_mark_fiber(JanetFiber *fiber) {
+static void janet_mark_function(JanetFunction *func) {
+    if (janet_gc_visited(func))
+        return;
+    if (janet_gc_defer(func, 0))
+        return;
+    janet_gc_mark(func);
+    janet_mark_function_contents(func);
+}
+
+/* Mark everything a fiber references except for its child fiber */
+static void janet_mark_fiber_contents(JanetFiber *fiber) {
     int32_t i, j;
     JanetStackFrame *frame;
-recur:
-    if (janet_gc_reachable(fiber))
-        return;
-    janet_gc_mark(fiber);
 
     janet_mark(fiber->last_value);
 
@@ -250,6 +421,17 @@ recur:
         janet_mark_abstract(fiber->supervisor_channel);
     }
 #endif
+}
+
+static void janet_mark_fiber(JanetFiber *fiber) {
+recur:
+    if (janet_gc_visited(fiber))
+        return;
+    if (janet_gc_defer(fiber, 0))
+        return;
+    janet_gc_mark(fiber);
+
+    janet_mark_fiber_contents(fiber);
 
     /* Explicit tail recursion */
     if (fiber->child) {
@@ -258,6 +440,58 @@ recur:
     }
 }
 
+/* Mark everything referenced by an object that is already marked */
+static void janet_gc_trace(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            break;
+        case JANET_MEMORY_ARRAY: {
+            JanetArray *array = (JanetArray *) mem;
+            janet_mark_many(array->data, array->count);
+            break;
+        }
+        case JANET_MEMORY_TABLE: {
+            JanetTable *table = (JanetTable *) mem;
+            janet_mark_table_contents(table);
+            if (table->proto)
+                janet_mark_table(table->proto);
+            break;
+        }
+        case JANET_MEMORY_STRUCT: {
+            JanetStructHead *head = (JanetStructHead *) mem;
+            janet_mark_kvs(head->data, head->capacity);
+            break;
+        }
+        case JANET_MEMORY_TUPLE: {
+            JanetTupleHead *head = (JanetTupleHead *) mem;
+            janet_mark_many(head->data, head->length);
+            break;
+        }
+        case JANET_MEMORY_FIBER: {
+            JanetFiber *fiber = (JanetFiber *) mem;
+            janet_mark_fiber_contents(fiber);
+            if (fiber->child)
+                janet_mark_fiber(fiber->child);
+            break;
+        }
+        case JANET_MEMORY_FUNCTION:
+            janet_mark_function_contents((JanetFunction *) mem);
+            break;
+        case JANET_MEMORY_FUNCENV:
+            janet_mark_funcenv_contents((JanetFuncEnv *) mem);
+            break;
+        case JANET_MEMORY_FUNCDEF:
+            janet_mark_funcdef_contents((JanetFuncDef *) mem);
+            break;
+        case JANET_MEMORY_ABSTRACT: {
+            JanetAbstractHead *head = (JanetAbstractHead *) mem;
+            if (head->type->gcmark)
+                head->type->gcmark(head->data, head->size);
+            break;
+        }
+    }
+}
+
 /* Deinitialize a block of memory */
 static void janet_deinit_block(JanetGCObject *mem) {
     switch (mem->flags & JANET_MEM_TYPEBITS) {
@@ -267,22 +501,27 @@ static void janet_deinit_block(JanetGCObject *mem) {
         case JANET_MEMORY_SYMBOL:
             janet_symbol_deinit(((JanetStringHead *) mem)->data);
             break;
-        case JANET_MEMORY_ARRAY:
-            janet_free(((JanetArray *) mem)->data);
-            break;
+        case JANET_MEMORY_ARRAY: {
+            JanetArray *array = (JanetArray *) mem;
+            janet_gc_data_free(array->data, (size_t) array->capacity * sizeof(Janet));
+        }
+        break;
         case JANET_MEMORY_TABLE:
             janet_free(((JanetTable *) mem)->data);
             break;
-        case JANET_MEMORY_FIBER:
-            janet_free(((JanetFiber *)mem)->data);
-            break;
+        case JANET_MEMORY_FIBER: {
+            JanetFiber *fiber = (JanetFiber *) mem;
+            janet_fiber_stack_free(fiber->data, fiber->capacity);
+        }
+        break;
         case JANET_MEMORY_BUFFER:
             janet_buffer_deinit((JanetBuffer *) mem);
             break;
         case JANET_MEMORY_ABSTRACT: {
             JanetAbstractHead *head = (JanetAbstractHead *)mem;
-            if (head->type->gc) {
-                janet_assert(!head->type->gc(head->data, head->size), "finalizer failed");
+            int (*gc)(void *data, size_t len) = head->type->gc ? head->type->gc : head->type->gcasync;
+            if (gc) {
+                janet_assert(!gc(head->data, head->size), "finalizer failed");
             }
         }
         break;
@@ -301,143 +540,1838 @@ static void janet_deinit_block(JanetGCObject *mem) {
             janet_free(def->bytecode);
             janet_free(def->sourcemap);
             janet_free(def->closure_bitset);
+            janet_free(def->icache);
+#ifdef JANET_JIT
+            janet_jit_discard(def);
+#endif
+#ifdef JANET_VM_COUNTERS
+            janet_counters_discard(def);
+#endif
         }
         break;
     }
 }
 
-/* Iterate over all allocated memory, and free memory that is not
- * marked as reachable. Flip the gc color flag for next sweep. */
-void janet_sweep() {
-    JanetGCObject *previous = NULL;
-    JanetGCObject *current = janet_vm.blocks;
-    JanetGCObject *next;
-    while (NULL != current) {
-        next = current->next;
-        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
-            previous = current;
-            current->flags &= ~JANET_MEM_REACHABLE;
-        } else {
-            janet_vm.block_count--;
-            janet_deinit_block(current);
-            if (NULL != previous) {
-                previous->next = next;
-            } else {
-                janet_vm.blocks = next;
-            }
-            janet_free(current);
-        }
-        current = next;
+/*
+ * Statistics
+ */
+
+static const char *const janet_gc_type_names[JANET_GC_MEMORY_TYPES] = {
+    "none", "string", "symbol", "array", "tuple", "table", "struct",
+    "fiber", "buffer", "function", "abstract", "funcenv", "funcdef"
+};
+
+/* Get the name of a memory type, or NULL if there is no such type */
+const char *janet_gc_type_name(int type) {
+    if (type <= JANET_MEMORY_NONE || type > JANET_MEMORY_FUNCDEF) return NULL;
+    return janet_gc_type_names[type];
+}
+
+/* Abstract values have no type until janet_abstract_end */
+#define janet_gc_stats_type(t) ((t) == JANET_MEMORY_NONE ? JANET_MEMORY_ABSTRACT : (t))
+
+static void janet_gc_count_alloc(int type, size_t size) {
+    type = janet_gc_stats_type(type);
+    janet_vm.gc_stats.blocks[type]++;
+    janet_vm.gc_stats.bytes[type] += size;
+}
+
+static void janet_gc_count_free(int type, size_t size) {
+    type = janet_gc_stats_type(type);
+    janet_vm.gc_stats.blocks[type]--;
+    janet_vm.gc_stats.bytes[type] -= size;
+}
+
+/* Current time in nanoseconds, for timing pauses */
+static uint64_t janet_gc_now(void) {
+#ifdef JANET_GETTIME
+    struct timespec now;
+    if (janet_gettime(&now)) return 0;
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+/* Record a pause that started at start */
+static void janet_gc_record_pause(uint64_t start) {
+    JanetGCStats *stats = &janet_vm.gc_stats;
+    uint64_t end = janet_gc_now();
+    uint64_t ns = end > start ? end - start : 0;
+    uint64_t us = ns / 1000;
+    int bucket = 0;
+    while (us && bucket < JANET_GC_HISTOGRAM_SIZE - 1) {
+        us >>= 1;
+        bucket++;
     }
+    stats->pauses++;
+    stats->pause_total += ns;
+    if (ns > stats->pause_max) stats->pause_max = ns;
+    stats->pause_histogram[bucket]++;
 }
 
-/* Allocate some memory that is tracked for garbage collection */
-void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
-    JanetGCObject *mem;
+/* Get a snapshot of garbage collector statistics */
+void janet_gc_stats(JanetGCStats *stats) {
+    *stats = janet_vm.gc_stats;
+    stats->block_count = janet_vm.block_count;
+    stats->old_block_count = janet_vm.old_block_count;
+    stats->root_count = janet_vm.root_count;
+    stats->live_bytes = janet_vm.gc_live_bytes;
+    stats->scratch_count = janet_vm.scratch_len;
+    stats->scratch_bytes = 0;
+    for (size_t i = 0; i < janet_vm.scratch_len; i++)
+        stats->scratch_bytes += janet_vm.scratch_mem[i]->size;
+}
 
-    /* Make sure everything is inited */
-    janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
-    mem = janet_malloc(size);
+/*
+ * Collection scheduling
+ *
+ * After each full collection the live heap is measured as the bytes in
+ * garbage collected objects, plus the data owned by the arrays, tables,
+ * buffers and fibers that survived the sweep. The next full collection comes
+ * once the old generation has grown by gc_target percent, or sooner if the
+ * heap reaches the soft limit. Minor collections are spaced out as the live
+ * heap grows and brought closer together as it nears the limit.
+ */
 
-    /* Check for bad malloc */
-    if (NULL == mem) {
-        JANET_OUT_OF_MEMORY;
+/* Bytes of data owned by an object outside of its block */
+static size_t janet_gc_data_size(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return 0;
+        case JANET_MEMORY_ARRAY:
+            return (size_t)((JanetArray *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_TABLE:
+            return (size_t)((JanetTable *) mem)->capacity * sizeof(JanetKV);
+        case JANET_MEMORY_FIBER:
+            return (size_t)((JanetFiber *) mem)->capacity * sizeof(Janet);
+        case JANET_MEMORY_BUFFER:
+            return (size_t)((JanetBuffer *) mem)->capacity;
     }
+}
 
-    /* Configure block */
-    mem->flags = type;
+/* Estimate of the bytes in the heap. Data owned by objects is only measured
+ * by full collections, so the estimate uses the amount found by the last one. */
+static size_t janet_gc_heap_bytes(void) {
+    size_t bytes = janet_vm.gc_data_bytes;
+    for (int i = 0; i < JANET_GC_MEMORY_TYPES; i++)
+        bytes += janet_vm.gc_stats.bytes[i];
+    return bytes;
+}
 
-    /* Prepend block to heap list */
-    janet_vm.next_collection += size;
-    mem->next = janet_vm.blocks;
-    janet_vm.blocks = mem;
-    janet_vm.block_count++;
+/* Check if the heap is past the soft limit. Only count it once the heap has
+ * grown a little since the last full collection, so that a live heap bigger
+ * than the limit does not make every minor collection a full one. */
+static int janet_gc_over_limit(void) {
+    if (0 == janet_vm.gc_limit) return 0;
+    size_t heap = janet_gc_heap_bytes();
+    return heap >= janet_vm.gc_limit &&
+           heap - janet_vm.gc_live_bytes >= janet_vm.gc_limit / JANET_GC_LIMIT_GROWTH;
+}
 
-    return (void *)mem;
+/* Check if the heap has grown enough to need a full collection */
+static int janet_gc_heap_full(void) {
+    return janet_vm.old_block_count > janet_vm.old_block_limit || janet_gc_over_limit();
 }
 
-static void free_one_scratch(JanetScratch *s) {
-    if (NULL != s->finalize) {
-        s->finalize((char *) s->mem);
+/* Decide how many bytes to allocate before the next minor collection. Minor
+ * collections trace the remembered set, so a larger live heap gets a larger
+ * young generation. gc_interval is the smallest young generation used, unless
+ * the heap is close to the soft limit. */
+static void janet_gc_schedule(void) {
+    size_t trigger = janet_vm.gc_live_bytes / 100 * janet_vm.gc_target / JANET_GC_MINOR_SPLIT;
+    if (trigger < janet_vm.gc_interval)
+        trigger = janet_vm.gc_interval;
+    if (janet_vm.gc_limit) {
+        size_t heap = janet_gc_heap_bytes();
+        size_t room = heap < janet_vm.gc_limit ? (janet_vm.gc_limit - heap) / 2 : 0;
+        size_t floor = janet_vm.gc_interval < JANET_GC_TRIGGER_MIN ? janet_vm.gc_interval : JANET_GC_TRIGGER_MIN;
+        if (trigger > room)
+            trigger = room;
+        if (trigger < floor)
+            trigger = floor;
     }
-    janet_free(s);
+    janet_vm.gc_trigger = trigger;
 }
 
-/* Free all allocated scratch memory */
-static void janet_free_all_scratch(void) {
-    for (size_t i = 0; i < janet_vm.scratch_len; i++) {
-        free_one_scratch(janet_vm.scratch_mem[i]);
-    }
-    janet_vm.scratch_len = 0;
+/* Let the old generation grow by gc_target percent before the next full
+ * collection */
+static void janet_gc_update_old_limit(void) {
+    janet_vm.old_block_limit = janet_vm.old_block_count +
+                               janet_vm.old_block_count / 100 * janet_vm.gc_target;
+    if (janet_vm.old_block_limit < JANET_GC_OLD_MIN)
+        janet_vm.old_block_limit = JANET_GC_OLD_MIN;
 }
 
-static JanetScratch *janet_mem2scratch(void *mem) {
-    JanetScratch *s = (JanetScratch *)mem;
-    return s - 1;
+/* Record the live heap once a full collection has been swept */
+static void janet_gc_set_old_limit(void) {
+    janet_vm.gc_data_bytes = janet_vm.gc_swept_data;
+    janet_vm.gc_swept_data = 0;
+    janet_vm.gc_live_bytes = janet_gc_heap_bytes();
+    janet_gc_update_old_limit();
 }
 
-/* Run garbage collection */
-void janet_collect(void) {
-    uint32_t i;
-    if (janet_vm.gc_suspend) return;
-    depth = JANET_RECURSION_GUARD;
-    /* Try and prevent many major collections back to back.
-     * A full collection will take O(janet_vm.block_count) time.
-     * If we have a large heap, make sure our interval is not too
-     * small so we won't make many collections over it. This is just a
-     * heuristic for automatically changing the gc interval */
-    if (janet_vm.block_count * 8 > janet_vm.gc_interval) {
-        janet_vm.gc_interval = janet_vm.block_count * sizeof(JanetGCObject);
+/* Set the soft heap limit in bytes, or 0 for no limit */
+void janet_gc_set_limit(size_t limit) {
+    janet_vm.gc_limit = limit;
+    janet_gc_schedule();
+}
+
+/* Set how much the heap may grow between full collections, in percent of the
+ * live heap */
+void janet_gc_set_target(size_t target) {
+    janet_vm.gc_target = target;
+    janet_gc_update_old_limit();
+    janet_gc_schedule();
+}
+
+/*
+ * Heap profiling
+ *
+ * While enabled, janet_gcalloc samples allocations at random intervals that
+ * average rate bytes, so the chance of an object being sampled is proportional
+ * to its size. Each sample records the stack of the current fiber, resolved
+ * through source maps and folded into a single string. Sampled objects are
+ * flagged so that sweeping them tells the profiler they are gone. Nothing in
+ * here may allocate garbage collected memory, as it runs inside janet_gcalloc.
+ */
+
+typedef struct {
+    JanetGCObject *mem; /* NULL once the object is freed */
+    uint32_t stack;
+    int survived; /* Lived through at least one collection */
+    uint64_t born; /* Number of collections before the allocation */
+    double bytes; /* Estimate of the bytes allocated that the sample stands for */
+    double count; /* Estimate of the objects allocated that the sample stands for */
+} JanetGCSample;
+
+typedef struct {
+    JanetGCObject *mem;
+    uint32_t sample;
+} JanetGCSampleSlot;
+
+struct JanetGCProfile {
+    size_t rate;
+    JanetRNG rng;
+    /* All samples */
+    JanetGCSample *samples;
+    uint32_t sample_count;
+    uint32_t sample_capacity;
+    /* Interned stacks, and a hash set of their indices plus one */
+    char **stacks;
+    uint32_t stack_count;
+    uint32_t stack_capacity;
+    uint32_t *stack_table;
+    uint32_t stack_table_capacity;
+    /* Map from live sampled objects to their samples */
+    JanetGCSampleSlot *live;
+    size_t live_count;
+    size_t live_capacity;
+    /* Stack being built */
+    JanetStackFrame **frames;
+    size_t frame_capacity;
+    char *text;
+    size_t text_count;
+    size_t text_capacity;
+};
+
+static void *janet_gc_profile_grow(void *mem, size_t count, size_t *capacity, size_t itemsize) {
+    if (count < *capacity) return mem;
+    size_t newcap = 2 * count + 8;
+    mem = janet_realloc(mem, newcap * itemsize);
+    if (NULL == mem) {
+        JANET_OUT_OF_MEMORY;
     }
-    orig_rootcount = janet_vm.root_count;
-#ifdef JANET_EV
-    janet_ev_mark();
-#endif
-    janet_mark_fiber(janet_vm.root_fiber);
-    for (i = 0; i < orig_rootcount; i++)
-        janet_mark(janet_vm.roots[i]);
-    while (orig_rootcount < janet_vm.root_count) {
-        Janet x = janet_vm.roots[--janet_vm.root_count];
-        janet_mark(x);
+    *capacity = newcap;
+    return mem;
+}
+
+static void janet_gc_profile_text(JanetGCProfile *prof, const char *str, size_t len) {
+    prof->text = janet_gc_profile_grow(prof->text, prof->text_count + len, &prof->text_capacity, 1);
+    for (size_t i = 0; i < len; i++) {
+        /* Keep the folded format parseable */
+        char c = str[i];
+        prof->text[prof->text_count++] = (c == ';' || c == '\n') ? ',' : c;
     }
-    janet_sweep();
-    janet_vm.next_collection = 0;
-    janet_free_all_scratch();
 }
 
-/* Add a root value to the GC. This prevents the GC from removing a value
- * and all of its children. If gcroot is called on a value n times, unroot
- * must also be called n times to remove it as a gc root. */
-void janet_gcroot(Janet root) {
-    size_t newcount = janet_vm.root_count + 1;
-    if (newcount > janet_vm.root_capacity) {
-        size_t newcap = 2 * newcount;
-        janet_vm.roots = janet_realloc(janet_vm.roots, sizeof(Janet) * newcap);
-        if (NULL == janet_vm.roots) {
-            JANET_OUT_OF_MEMORY;
+static void janet_gc_profile_cstring(JanetGCProfile *prof, const char *str) {
+    janet_gc_profile_text(prof, str, strlen(str));
+}
+
+static void janet_gc_profile_separator(JanetGCProfile *prof) {
+    prof->text = janet_gc_profile_grow(prof->text, prof->text_count + 1, &prof->text_capacity, 1);
+    prof->text[prof->text_count++] = ';';
+}
+
+/* Write one stack frame, such as "map boot.janet:12" */
+static void janet_gc_profile_frame(JanetGCProfile *prof, JanetStackFrame *frame) {
+    if (frame->func) {
+        JanetFuncDef *def = frame->func->def;
+        if (def->name) {
+            janet_gc_profile_text(prof, (const char *) def->name, janet_string_length(def->name));
+        } else {
+            janet_gc_profile_cstring(prof, "<anonymous>");
+        }
+        if (def->source) {
+            janet_gc_profile_cstring(prof, " ");
+            janet_gc_profile_text(prof, (const char *) def->source, janet_string_length(def->source));
+            if (def->sourcemap && frame->pc) {
+                char line[16];
+                JanetSourceMapping mapping = def->sourcemap[frame->pc - def->bytecode];
+                snprintf(line, sizeof(line), ":%d", (int) mapping.line);
+                janet_gc_profile_cstring(prof, line);
+            }
+        }
+    } else {
+        JanetCFunction cfun = (JanetCFunction)(frame->pc);
+        Janet name = cfun
+                     ? janet_table_get(janet_vm.registry, janet_wrap_cfunction(cfun))
+                     : janet_wrap_nil();
+        if (janet_checktype(name, JANET_SYMBOL)) {
+            const uint8_t *sym = janet_unwrap_symbol(name);
+            janet_gc_profile_text(prof, (const char *) sym, janet_string_length(sym));
+        } else {
+            janet_gc_profile_cstring(prof, "<cfunction>");
         }
-        janet_vm.root_capacity = newcap;
     }
-    janet_vm.roots[janet_vm.root_count] = root;
-    janet_vm.root_count = newcount;
 }
 
-/* Identity equality for GC purposes */
-static int janet_gc_idequals(Janet lhs, Janet rhs) {
-    if (janet_type(lhs) != janet_type(rhs))
-        return 0;
-    switch (janet_type(lhs)) {
-        case JANET_BOOLEAN:
-        case JANET_NIL:
-        case JANET_NUMBER:
-            /* These values don't really matter to the gc so returning 1 all the time is fine. */
-            return 1;
-        default:
-            return janet_unwrap_pointer(lhs) == janet_unwrap_pointer(rhs);
+/* Get the interned stack for the current text */
+static uint32_t janet_gc_profile_intern(JanetGCProfile *prof) {
+    const char *text = prof->text;
+    size_t len = prof->text_count;
+    if (2 * prof->stack_count >= prof->stack_table_capacity) {
+        uint32_t newcap = 2 * prof->stack_table_capacity + 64;
+        uint32_t *table = janet_calloc(newcap, sizeof(uint32_t));
+        if (NULL == table) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (uint32_t i = 0; i < prof->stack_count; i++) {
+            const char *s = prof->stacks[i];
+            uint32_t j = (uint32_t) janet_string_calchash((const uint8_t *) s, (int32_t) strlen(s));
+            while (table[j & (newcap - 1)]) j++;
+            table[j & (newcap - 1)] = i + 1;
+        }
+        janet_free(prof->stack_table);
+        prof->stack_table = table;
+        prof->stack_table_capacity = newcap;
+    }
+    uint32_t mask = prof->stack_table_capacity - 1;
+    uint32_t j = (uint32_t) janet_string_calchash((const uint8_t *) text, (int32_t) len);
+    for (;; j++) {
+        uint32_t index = prof->stack_table[j & mask];
+        if (!index) break;
+        const char *s = prof->stacks[index - 1];
+        if (!strncmp(s, text, len) && s[len] == '\0') return index - 1;
     }
+    char *s = janet_malloc(len + 1);
+    if (NULL == s) {
+        JANET_OUT_OF_MEMORY;
+    }
+    memcpy(s, text, len);
+    s[len] = '\0';
+    size_t cap = prof->stack_capacity;
+    prof->stacks = janet_gc_profile_grow(prof->stacks, prof->stack_count, &cap, sizeof(char *));
+    prof->stack_capacity = (uint32_t) cap;
+    prof->stacks[prof->stack_count] = s;
+    prof->stack_table[j & mask] = ++prof->stack_count;
+    return prof->stack_count - 1;
 }
 
-/* Remove a root value from the GC. This allows the gc to potentially reclaim
+/* Fold the stack of the current fiber, outermost frame first, followed by the
+ * type of the allocated object */
+static uint32_t janet_gc_profile_stack(JanetGCProfile *prof, int type) {
+    JanetFiber *fiber = janet_vm.fiber;
+    prof->text_count = 0;
+    if (NULL == fiber) {
+        janet_gc_profile_cstring(prof, "<native>");
+        janet_gc_profile_separator(prof);
+    } else {
+        /* Frames link from the innermost outwards, so collect them first */
+        size_t depth = 0;
+        for (int32_t i = fiber->frame; i > 0; depth++) {
+            JanetStackFrame *frame = (JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE);
+            prof->frames = janet_gc_profile_grow(prof->frames, depth, &prof->frame_capacity, sizeof(JanetStackFrame *));
+            prof->frames[depth] = frame;
+            i = frame->prevframe;
+        }
+        while (depth--) {
+            janet_gc_profile_frame(prof, prof->frames[depth]);
+            janet_gc_profile_separator(prof);
+        }
+    }
+    janet_gc_profile_cstring(prof, "[");
+    janet_gc_profile_cstring(prof, janet_gc_type_names[janet_gc_stats_type(type)]);
+    janet_gc_profile_cstring(prof, "]");
+    return janet_gc_profile_intern(prof);
+}
+
+#define janet_gc_profile_hash(mem) ((size_t)(((uintptr_t)(mem) >> 4) * 2654435761u))
+
+static void janet_gc_profile_live_put(JanetGCProfile *prof, JanetGCObject *mem, uint32_t sample) {
+    size_t mask = prof->live_capacity - 1;
+    size_t i = janet_gc_profile_hash(mem) & mask;
+    while (NULL != prof->live[i].mem) i = (i + 1) & mask;
+    prof->live[i].mem = mem;
+    prof->live[i].sample = sample;
+}
+
+static void janet_gc_profile_live_add(JanetGCProfile *prof, JanetGCObject *mem, uint32_t sample) {
+    if (2 * (prof->live_count + 1) > prof->live_capacity) {
+        JanetGCSampleSlot *old = prof->live;
+        size_t oldcap = prof->live_capacity;
+        prof->live_capacity = oldcap ? 2 * oldcap : 64;
+        prof->live = janet_calloc(prof->live_capacity, sizeof(JanetGCSampleSlot));
+        if (NULL == prof->live) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (size_t i = 0; i < oldcap; i++)
+            if (NULL != old[i].mem)
+                janet_gc_profile_live_put(prof, old[i].mem, old[i].sample);
+        janet_free(old);
+    }
+    janet_gc_profile_live_put(prof, mem, sample);
+    prof->live_count++;
+}
+
+static uint64_t janet_gc_profile_clock(void) {
+    return janet_vm.gc_stats.minor_collections + janet_vm.gc_stats.full_collections;
+}
+
+/* Pick the number of bytes until the next sample */
+static void janet_gc_profile_next(JanetGCProfile *prof) {
+    double u = (janet_rng_u32(&prof->rng) + 1.0) / 4294967296.0;
+    double next = -log(u) * (double) prof->rate;
+    janet_vm.gc_sample_left = next < 1.0 ? 1 : (next >= (double) SIZE_MAX ? SIZE_MAX : (size_t) next);
+}
+
+/* Sample an allocation that used up the bytes left until the next sample */
+static void janet_gc_profile_sample(JanetGCObject *mem, size_t size) {
+    JanetGCProfile *prof = janet_vm.gc_profile;
+    if (NULL == prof || 0 == prof->rate) {
+        janet_vm.gc_sample_left = SIZE_MAX;
+        return;
+    }
+    size_t cap = prof->sample_capacity;
+    prof->samples = janet_gc_profile_grow(prof->samples, prof->sample_count, &cap, sizeof(JanetGCSample));
+    prof->sample_capacity = (uint32_t) cap;
+    /* Undo the bias towards large objects */
+    double p = 1.0 - exp(-(double) size / (double) prof->rate);
+    JanetGCSample *sample = prof->samples + prof->sample_count;
+    sample->mem = mem;
+    sample->stack = janet_gc_profile_stack(prof, mem->flags & JANET_MEM_TYPEBITS);
+    sample->survived = 0;
+    sample->born = janet_gc_profile_clock();
+    sample->bytes = (double) size / p;
+    sample->count = 1.0 / p;
+    janet_gc_profile_live_add(prof, mem, prof->sample_count++);
+    mem->flags |= JANET_MEM_SAMPLED;
+    janet_gc_profile_next(prof);
+}
+
+/* Tell the profiler that a sampled object is being freed */
+static void janet_gc_profile_free(JanetGCObject *mem) {
+    JanetGCProfile *prof = janet_vm.gc_profile;
+    if (NULL == prof || 0 == prof->live_count) return;
+    size_t mask = prof->live_capacity - 1;
+    size_t i = janet_gc_profile_hash(mem) & mask;
+    while (prof->live[i].mem != mem) {
+        if (NULL == prof->live[i].mem) return;
+        i = (i + 1) & mask;
+    }
+    JanetGCSample *sample = prof->samples + prof->live[i].sample;
+    sample->mem = NULL;
+    sample->survived = janet_gc_profile_clock() > sample->born;
+    prof->live_count--;
+    /* Shift back entries that were displaced past the removed slot */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (NULL == prof->live[j].mem) break;
+        size_t k = janet_gc_profile_hash(prof->live[j].mem) & mask;
+        if ((j > i && (k <= i || k > j)) || (j < i && k <= i && k > j)) {
+            prof->live[i] = prof->live[j];
+            i = j;
+        }
+    }
+    prof->live[i].mem = NULL;
+}
+
+static void janet_gc_profile_deinit(void) {
+    JanetGCProfile *prof = janet_vm.gc_profile;
+    if (NULL == prof) return;
+    for (uint32_t i = 0; i < prof->stack_count; i++)
+        janet_free(prof->stacks[i]);
+    janet_free(prof->stacks);
+    janet_free(prof->stack_table);
+    janet_free(prof->samples);
+    janet_free(prof->live);
+    janet_free(prof->frames);
+    janet_free(prof->text);
+    janet_free(prof);
+    janet_vm.gc_profile = NULL;
+    janet_vm.gc_sample_left = SIZE_MAX;
+}
+
+/* Start sampling allocations every rate bytes on average, discarding the
+ * previous profile. A rate of 0 stops sampling but keeps the profile. */
+void janet_gc_profile(size_t rate) {
+    if (0 == rate) {
+        if (NULL != janet_vm.gc_profile) janet_vm.gc_profile->rate = 0;
+        janet_vm.gc_sample_left = SIZE_MAX;
+        return;
+    }
+    janet_gc_profile_deinit();
+    JanetGCProfile *prof = janet_calloc(1, sizeof(JanetGCProfile));
+    if (NULL == prof) {
+        JANET_OUT_OF_MEMORY;
+    }
+    prof->rate = rate;
+    janet_rng_seed(&prof->rng, 0);
+    janet_vm.gc_profile = prof;
+    janet_gc_profile_next(prof);
+}
+
+/* Write the profile in folded stack format, one stack per line followed by
+ * its estimated bytes or object count */
+void janet_gc_profile_dump(JanetBuffer *buffer, JanetGCProfileKind kind) {
+    JanetGCProfile *prof = janet_vm.gc_profile;
+    if (NULL == prof || 0 == prof->stack_count) return;
+    double *totals = janet_calloc(prof->stack_count, sizeof(double));
+    if (NULL == totals) {
+        JANET_OUT_OF_MEMORY;
+    }
+    uint64_t now = janet_gc_profile_clock();
+    int objects = kind == JANET_GC_PROFILE_INUSE_OBJECTS ||
+                  kind == JANET_GC_PROFILE_ALLOC_OBJECTS ||
+                  kind == JANET_GC_PROFILE_SURVIVED_OBJECTS;
+    for (uint32_t i = 0; i < prof->sample_count; i++) {
+        JanetGCSample *sample = prof->samples + i;
+        switch (kind) {
+            case JANET_GC_PROFILE_INUSE_SPACE:
+            case JANET_GC_PROFILE_INUSE_OBJECTS:
+                if (NULL == sample->mem) continue;
+                break;
+            case JANET_GC_PROFILE_SURVIVED_SPACE:
+            case JANET_GC_PROFILE_SURVIVED_OBJECTS:
+                if (!sample->survived && (NULL == sample->mem || now == sample->born)) continue;
+                break;
+            default:
+                break;
+        }
+        totals[sample->stack] += objects ? sample->count : sample->bytes;
+    }
+    for (uint32_t i = 0; i < prof->stack_count; i++) {
+        if (totals[i] < 0.5) continue;
+        char value[32];
+        snprintf(value, sizeof(value), " %.0f\n", totals[i]);
+        janet_buffer_push_cstring(buffer, prof->stacks[i]);
+        janet_buffer_push_cstring(buffer, value);
+    }
+    janet_free(totals);
+}
+
+/*
+ * Finalization
+ *
+ * Explicit collections finalize dead objects right away. Automatic
+ * collections hand abstract types with a gcasync finalizer, along with a copy
+ * of their data, to a background thread. Pages swept on demand by the
+ * allocator may be swept in the middle of any C function, so finalizers that
+ * must run on the main thread are put off until the next collection, which
+ * happens at a safe point. Such objects are marked pending and keep their
+ * slot until then.
+ */
+
+#define JANET_GC_FINALIZE_NOW 0
+#define JANET_GC_FINALIZE_AUTO 1
+#define JANET_GC_FINALIZE_ALLOC 2
+
+static JANET_THREAD_LOCAL int finalize_mode = JANET_GC_FINALIZE_NOW;
+
+#ifdef JANET_THREADS
+
+typedef struct JanetGCFinalizer JanetGCFinalizer;
+struct JanetGCFinalizer {
+    JanetGCFinalizer *next;
+    int (*gcasync)(void *data, size_t len);
+    size_t size;
+    long long data[]; /* Copy of the abstract data */
+};
+
+struct JanetGCBackground {
+    JanetGCLock lock;
+    JanetGCCond cond;
+    JanetGCCond idle;
+    JanetGCFinalizer *head;
+    JanetGCFinalizer *tail;
+    int busy;
+    int stop;
+#ifdef JANET_WINDOWS
+    HANDLE thread;
+#else
+    pthread_t thread;
+#endif
+};
+
+/* Run queued finalizers until asked to stop */
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_gc_background(LPVOID param) {
+#else
+static void *janet_gc_background(void *param) {
+#endif
+    JanetGCBackground *bg = (JanetGCBackground *) param;
+    janet_gc_lock(&bg->lock);
+    for (;;) {
+        JanetGCFinalizer *fin = bg->head;
+        if (NULL == fin) {
+            janet_gc_wake(&bg->idle);
+            if (bg->stop) break;
+            janet_gc_wait(&bg->cond, &bg->lock);
+            continue;
+        }
+        bg->head = fin->next;
+        if (NULL == bg->head) bg->tail = NULL;
+        bg->busy = 1;
+        janet_gc_unlock(&bg->lock);
+        fin->gcasync(fin->data, fin->size);
+        janet_free(fin);
+        janet_gc_lock(&bg->lock);
+        bg->busy = 0;
+    }
+    janet_gc_unlock(&bg->lock);
+#ifdef JANET_WINDOWS
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Start the background finalizer thread. Returns NULL on failure. */
+static JanetGCBackground *janet_gc_background_init(void) {
+    JanetGCBackground *bg = janet_malloc(sizeof(JanetGCBackground));
+    if (NULL == bg) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_gc_lock_init(&bg->lock);
+    janet_gc_cond_init(&bg->cond);
+    janet_gc_cond_init(&bg->idle);
+    bg->head = NULL;
+    bg->tail = NULL;
+    bg->busy = 0;
+    bg->stop = 0;
+#ifdef JANET_WINDOWS
+    bg->thread = CreateThread(NULL, 0, janet_gc_background, bg, 0, NULL);
+    if (NULL != bg->thread) return bg;
+#else
+    if (!pthread_create(&bg->thread, NULL, janet_gc_background, bg)) return bg;
+#endif
+    janet_gc_lock_deinit(&bg->lock);
+    janet_gc_cond_deinit(&bg->cond);
+    janet_gc_cond_deinit(&bg->idle);
+    janet_free(bg);
+    return NULL;
+}
+
+/* Run the remaining finalizers and stop the background thread */
+static void janet_gc_background_deinit(void) {
+    JanetGCBackground *bg = janet_vm.gc_background;
+    if (NULL == bg) return;
+    janet_gc_lock(&bg->lock);
+    bg->stop = 1;
+    janet_gc_wake(&bg->cond);
+    janet_gc_unlock(&bg->lock);
+#ifdef JANET_WINDOWS
+    WaitForSingleObject(bg->thread, INFINITE);
+    CloseHandle(bg->thread);
+#else
+    pthread_join(bg->thread, NULL);
+#endif
+    janet_gc_lock_deinit(&bg->lock);
+    janet_gc_cond_deinit(&bg->cond);
+    janet_gc_cond_deinit(&bg->idle);
+    janet_free(bg);
+    janet_vm.gc_background = NULL;
+}
+
+/* Wait until every queued finalizer has run */
+static void janet_gc_background_wait(void) {
+    JanetGCBackground *bg = janet_vm.gc_background;
+    if (NULL == bg) return;
+    janet_gc_lock(&bg->lock);
+    while (NULL != bg->head || bg->busy)
+        janet_gc_wait(&bg->idle, &bg->lock);
+    janet_gc_unlock(&bg->lock);
+}
+
+/* Queue a dead abstract value to be finalized on the background thread */
+static void janet_gc_finalize_async(JanetAbstractHead *head) {
+    JanetGCBackground *bg = janet_vm.gc_background;
+    if (NULL == bg) {
+        bg = janet_vm.gc_background = janet_gc_background_init();
+        if (NULL == bg) {
+            head->type->gcasync(head->data, head->size);
+            return;
+        }
+    }
+    JanetGCFinalizer *fin = janet_malloc(sizeof(JanetGCFinalizer) + head->size);
+    if (NULL == fin) {
+        JANET_OUT_OF_MEMORY;
+    }
+    fin->next = NULL;
+    fin->gcasync = head->type->gcasync;
+    fin->size = head->size;
+    memcpy(fin->data, head->data, head->size);
+    janet_gc_lock(&bg->lock);
+    if (NULL == bg->tail) {
+        bg->head = fin;
+    } else {
+        bg->tail->next = fin;
+    }
+    bg->tail = fin;
+    janet_gc_wake(&bg->cond);
+    janet_gc_unlock(&bg->lock);
+}
+
+#endif
+
+/* Finalize a dead object. Returns 0 if the object may not be finalized yet. */
+static int janet_gc_finalize(JanetGCObject *mem) {
+    if ((mem->flags & JANET_MEM_TYPEBITS) == JANET_MEMORY_ABSTRACT) {
+        JanetAbstractHead *head = (JanetAbstractHead *) mem;
+#ifdef JANET_THREADS
+        if (finalize_mode != JANET_GC_FINALIZE_NOW && NULL != head->type->gcasync) {
+            janet_gc_finalize_async(head);
+            return 1;
+        }
+#endif
+        if (finalize_mode == JANET_GC_FINALIZE_ALLOC &&
+                (NULL != head->type->gc || NULL != head->type->gcasync))
+            return 0;
+    }
+    janet_deinit_block(mem);
+    return 1;
+}
+
+/* Check if an old object may be mutated to reference young objects. Such
+ * objects are kept in the remembered set and rescanned on every minor
+ * collection. Strings, buffers, tuples, structs, functions and funcdefs
+ * cannot change what they reference after creation. */
+static int janet_gc_mutable(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return 0;
+        case JANET_MEMORY_ARRAY:
+        case JANET_MEMORY_TABLE:
+        case JANET_MEMORY_FIBER:
+        case JANET_MEMORY_FUNCENV:
+            return 1;
+        case JANET_MEMORY_ABSTRACT:
+            return NULL != ((JanetAbstractHead *) mem)->type->gcmark;
+    }
+}
+
+/* Mark everything referenced by the remembered set. Old objects themselves
+ * are not marked, only traced, so minor collections never need to clear them.
+ * If only_marked is set, skip objects that have not been marked, which is
+ * how an incremental collection rescans objects it has already traced. */
+static void janet_mark_remembered(int only_marked) {
+    for (size_t i = 0; i < janet_vm.remembered_count; i++) {
+        JanetGCObject *current = janet_vm.remembered[i];
+        if (only_marked && !(current->flags & JANET_MEM_REACHABLE))
+            continue;
+        janet_gc_trace(current);
+    }
+}
+
+/* Add a newly promoted object to the remembered set if needed */
+static void janet_gc_remember(JanetGCObject *mem) {
+    if (!janet_gc_mutable(mem)) return;
+    janet_gc_push(&janet_vm.remembered, &janet_vm.remembered_count, &janet_vm.remembered_capacity, mem);
+}
+
+/* Drop unreachable objects from the remembered set. Must run after marking
+ * and before sweeping, while mark bits are still valid. */
+static void janet_gc_prune_remembered(void) {
+    size_t j = 0;
+    for (size_t i = 0; i < janet_vm.remembered_count; i++) {
+        JanetGCObject *mem = janet_vm.remembered[i];
+        if (mem->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            janet_vm.remembered[j++] = mem;
+        }
+    }
+    janet_vm.remembered_count = j;
+}
+
+/* Promote a surviving young object to the old generation */
+static void janet_gc_promote(JanetGCObject *mem) {
+    mem->flags &= ~JANET_MEM_REACHABLE;
+    mem->flags |= JANET_MEM_OLD;
+    janet_vm.old_block_count++;
+    janet_gc_remember(mem);
+}
+
+/*
+ * Slab allocator
+ *
+ * Small objects are carved out of pages of equally sized slots, one set of
+ * pages per size class. Pages are obtained from and returned directly to the
+ * operating system. Allocation pops a slot from a page free list, or bumps
+ * into the never used tail of the page. Sweeping walks pages linearly
+ * instead of chasing a list through the heap, and a page that becomes
+ * completely empty during a full collection is unmapped. Objects larger
+ * than JANET_GC_SLAB_MAX use janet_malloc and are kept in linked lists.
+ */
+
+#define JANET_GC_PAGE_SIZE 0x10000
+#define JANET_GC_SLAB_MAX 512
+
+/* Large objects are preceded by their size, padded to keep alignment */
+#define JANET_GC_LARGE_HEADER 16
+#define janet_gc_large_base(mem) ((void *)((char *)(mem) - JANET_GC_LARGE_HEADER))
+#define janet_gc_large_size(mem) (*((size_t *) janet_gc_large_base(mem)))
+
+/* Page flags */
+#define JANET_GC_PAGE_YOUNG 0x1
+#define JANET_GC_PAGE_AVAILABLE 0x2
+#define JANET_GC_PAGE_UNSWEPT 0x4
+
+/* Unswept pages to sweep on each minor collection */
+#define JANET_GC_SWEEP_STEP 16
+
+struct JanetGCPage {
+    JanetGCPage *next; /* All pages in the pool */
+    JanetGCPage *next_available; /* Pages with free slots */
+    JanetGCPage *next_young; /* Pages that young objects were allocated in */
+    JanetGCObject *free; /* Free list of swept slots */
+    uint32_t slot_size;
+    uint32_t slot_count;
+    uint32_t bump; /* Slots at or after this index have never been used */
+    uint32_t live;
+    uint32_t flags;
+};
+
+#define JANET_GC_PAGE_HEADER ((sizeof(JanetGCPage) + 15) & ~((size_t) 15))
+#define janet_gc_page_slot(page, i) \
+    ((JanetGCObject *)((char *)(page) + JANET_GC_PAGE_HEADER + (size_t)(i) * (page)->slot_size))
+
+static const uint32_t janet_gc_class_sizes[JANET_GC_SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512
+};
+
+/* Map an allocation size to a size class */
+static int janet_gc_size_class(size_t size) {
+    if (size <= 128) return (int)((size + 15) >> 4) - 1;
+    if (size <= 256) return 8 + (int)((size - 129) >> 5);
+    return 12 + (int)((size - 257) >> 6);
+}
+
+static void *janet_gc_page_map(void) {
+#ifdef JANET_WINDOWS
+    void *mem = VirtualAlloc(NULL, JANET_GC_PAGE_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *mem = mmap(NULL, JANET_GC_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) mem = NULL;
+#endif
+    if (NULL == mem) {
+        JANET_OUT_OF_MEMORY;
+    }
+    return mem;
+}
+
+static void janet_gc_page_unmap(void *mem) {
+#ifdef JANET_WINDOWS
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, JANET_GC_PAGE_SIZE);
+#endif
+}
+
+/*
+ * Large data space
+ *
+ * The data of big arrays, buffers and fiber stacks is mapped straight from
+ * the OS instead of coming from malloc, so that freeing it returns the memory
+ * right away and it never fragments the malloc heap. On Linux, growing it
+ * remaps the pages instead of copying them, so resizing does not need the old
+ * and new copies at the same time. Whether data lives here depends only on its
+ * size, which the owning object always knows.
+ */
+
+#define janet_gc_data_large(size) ((size) >= JANET_GC_LARGE_DATA)
+
+static void *janet_gc_data_map(size_t size) {
+#ifdef JANET_WINDOWS
+    void *mem = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) mem = NULL;
+#endif
+    if (NULL == mem) {
+        JANET_OUT_OF_MEMORY;
+    }
+    janet_vm.gc_stats.large_count++;
+    janet_vm.gc_stats.large_bytes += size;
+    return mem;
+}
+
+static void janet_gc_data_unmap(void *mem, size_t size) {
+#ifdef JANET_WINDOWS
+    VirtualFree(mem, 0, MEM_RELEASE);
+#else
+    munmap(mem, size);
+#endif
+    janet_vm.gc_stats.large_count--;
+    janet_vm.gc_stats.large_bytes -= size;
+}
+
+void *janet_gc_data_alloc(size_t size) {
+    if (janet_gc_data_large(size))
+        return janet_gc_data_map(size);
+    void *mem = janet_malloc(size);
+    if (NULL == mem && size) {
+        JANET_OUT_OF_MEMORY;
+    }
+    return mem;
+}
+
+void *janet_gc_data_realloc(void *mem, size_t oldsize, size_t size) {
+    if (NULL == mem)
+        return janet_gc_data_alloc(size);
+    if (!janet_gc_data_large(oldsize) && !janet_gc_data_large(size)) {
+        void *newmem = janet_realloc(mem, size);
+        if (NULL == newmem && size) {
+            JANET_OUT_OF_MEMORY;
+        }
+        return newmem;
+    }
+#if defined(JANET_LINUX) && defined(MREMAP_MAYMOVE)
+    if (janet_gc_data_large(oldsize) && janet_gc_data_large(size)) {
+        void *newmem = mremap(mem, oldsize, size, MREMAP_MAYMOVE);
+        if (newmem == MAP_FAILED) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.gc_stats.large_bytes += size;
+        janet_vm.gc_stats.large_bytes -= oldsize;
+        return newmem;
+    }
+#endif
+    void *newmem = janet_gc_data_alloc(size);
+    memcpy(newmem, mem, oldsize < size ? oldsize : size);
+    janet_gc_data_free(mem, oldsize);
+    return newmem;
+}
+
+void janet_gc_data_free(void *mem, size_t size) {
+    if (NULL == mem) return;
+    if (janet_gc_data_large(size)) {
+        janet_gc_data_unmap(mem, size);
+    } else {
+        janet_free(mem);
+    }
+}
+
+/* Get a fresh page for a size class */
+static JanetGCPage *janet_gc_page_new(JanetGCPool *pool, uint32_t slot_size) {
+    JanetGCPage *page = janet_gc_page_map();
+    page->slot_size = slot_size;
+    page->slot_count = (uint32_t)((JANET_GC_PAGE_SIZE - JANET_GC_PAGE_HEADER) / slot_size);
+    page->free = NULL;
+    page->bump = 0;
+    page->live = 0;
+    page->flags = JANET_GC_PAGE_AVAILABLE;
+    page->next_young = NULL;
+    page->next = pool->pages;
+    pool->pages = page;
+    page->next_available = pool->available;
+    pool->available = page;
+    return page;
+}
+
+/* Make a swept page available for allocation again */
+static void janet_gc_page_release_slots(JanetGCPool *pool, JanetGCPage *page) {
+    if ((page->free || page->bump < page->slot_count) &&
+            !(page->flags & JANET_GC_PAGE_AVAILABLE)) {
+        page->flags |= JANET_GC_PAGE_AVAILABLE;
+        page->next_available = pool->available;
+        pool->available = page;
+    }
+}
+
+static void janet_gc_sweep_unswept(JanetGCPool *pool, int on_demand);
+
+/* Allocate a slot of the given size class */
+static JanetGCObject *janet_gc_slab_alloc(int sclass) {
+    JanetGCPool *pool = janet_vm.gc_pools + sclass;
+    JanetGCPage *page = pool->available;
+    JanetGCObject *mem;
+    while (NULL != page && NULL == page->free && page->bump == page->slot_count) {
+        page->flags &= ~JANET_GC_PAGE_AVAILABLE;
+        page = page->next_available;
+    }
+    pool->available = page;
+    /* Sweep pages left over from the last full collection before asking
+     * the OS for more memory */
+    if (NULL == page && NULL != pool->unswept) {
+        uint64_t start = janet_gc_now();
+        do {
+            janet_gc_sweep_unswept(pool, 1);
+            page = pool->available;
+        } while (NULL == page && NULL != pool->unswept);
+        janet_gc_record_pause(start);
+    }
+    if (NULL == page) {
+        page = janet_gc_page_new(pool, janet_gc_class_sizes[sclass]);
+    }
+    if (NULL != page->free) {
+        mem = page->free;
+        page->free = mem->next;
+    } else {
+        mem = janet_gc_page_slot(page, page->bump++);
+    }
+    page->live++;
+    if (!(page->flags & JANET_GC_PAGE_YOUNG)) {
+        page->flags |= JANET_GC_PAGE_YOUNG;
+        page->next_young = janet_vm.young_pages;
+        janet_vm.young_pages = page;
+    }
+    return mem;
+}
+
+/* Free a slot during a sweep. An object that may not be finalized yet is
+ * marked pending instead, with its page kept in the otherwise unused next
+ * field, and freed by janet_gc_free_pending. */
+static void janet_gc_slab_free(JanetGCPage *page, JanetGCObject *mem) {
+    if (!janet_gc_finalize(mem)) {
+        mem->flags |= JANET_MEM_PENDING;
+        mem->next = (JanetGCObject *) page;
+        janet_gc_push(&janet_vm.gc_pending, &janet_vm.gc_pending_count, &janet_vm.gc_pending_capacity, mem);
+        return;
+    }
+    if (mem->flags & JANET_MEM_OLD)
+        janet_vm.old_block_count--;
+    janet_gc_count_free(mem->flags & JANET_MEM_TYPEBITS, page->slot_size);
+    if (mem->flags & JANET_MEM_SAMPLED)
+        janet_gc_profile_free(mem);
+    mem->flags = JANET_MEM_FREE;
+    mem->next = page->free;
+    page->free = mem;
+    page->live--;
+    janet_vm.block_count--;
+}
+
+/* Sweep all slots of a page. If young_only is set, old objects are left
+ * alone, as they have not been marked. */
+static void janet_gc_page_sweep(JanetGCPage *page, int young_only) {
+    for (uint32_t i = 0; i < page->bump; i++) {
+        JanetGCObject *mem = janet_gc_page_slot(page, i);
+        int32_t flags = mem->flags;
+        if (flags & (JANET_MEM_FREE | JANET_MEM_PENDING)) continue;
+        if (flags & JANET_MEM_OLD) {
+            if (young_only) continue;
+            if (flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+                mem->flags &= ~JANET_MEM_REACHABLE;
+                janet_vm.gc_swept_data += janet_gc_data_size(mem);
+            } else {
+                janet_gc_slab_free(page, mem);
+            }
+        } else if (flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            janet_gc_promote(mem);
+            if (!young_only) janet_vm.gc_swept_data += janet_gc_data_size(mem);
+        } else {
+            janet_gc_slab_free(page, mem);
+        }
+    }
+    page->flags &= ~JANET_GC_PAGE_YOUNG;
+}
+
+/* Sweep only the pages that received allocations since the last collection */
+static void janet_gc_sweep_young_pages(void) {
+    JanetGCPage *page = janet_vm.young_pages;
+    while (NULL != page) {
+        JanetGCPage *next = page->next_young;
+        janet_gc_page_sweep(page, 1);
+        janet_gc_page_release_slots(janet_vm.gc_pools + janet_gc_size_class(page->slot_size), page);
+        page = next;
+    }
+    janet_vm.young_pages = NULL;
+}
+
+/* Sweep every page, unmapping pages that end up empty */
+static void janet_gc_sweep_pages(void) {
+    for (int c = 0; c < JANET_GC_SIZE_CLASSES; c++) {
+        JanetGCPool *pool = janet_vm.gc_pools + c;
+        JanetGCPage *page = pool->pages;
+        pool->pages = NULL;
+        pool->available = NULL;
+        while (NULL != page) {
+            JanetGCPage *next = page->next;
+            janet_gc_page_sweep(page, 0);
+            if (page->live == 0) {
+                janet_gc_page_unmap(page);
+            } else {
+                page->next = pool->pages;
+                pool->pages = page;
+                page->flags &= ~JANET_GC_PAGE_AVAILABLE;
+                janet_gc_page_release_slots(pool, page);
+            }
+            page = next;
+        }
+    }
+    janet_vm.young_pages = NULL;
+}
+
+/* Finalize and free the objects that sweeps from the allocator left pending */
+static void janet_gc_free_pending(void) {
+    while (janet_vm.gc_pending_count) {
+        JanetGCObject *mem = janet_vm.gc_pending[--janet_vm.gc_pending_count];
+        JanetGCPage *page = (JanetGCPage *) mem->next;
+        mem->flags &= ~JANET_MEM_PENDING;
+        janet_gc_slab_free(page, mem);
+        janet_gc_page_release_slots(janet_vm.gc_pools + janet_gc_size_class(page->slot_size), page);
+    }
+}
+
+/* Sweep one of the pages an automatic full collection left unswept. Pages
+ * swept on demand by the allocator are kept even if empty, as the allocator
+ * is about to use them. */
+static void janet_gc_sweep_unswept(JanetGCPool *pool, int on_demand) {
+    JanetGCPage *page = pool->unswept;
+    int mode = finalize_mode;
+    pool->unswept = page->next;
+    page->flags &= ~JANET_GC_PAGE_UNSWEPT;
+    if (on_demand) finalize_mode = JANET_GC_FINALIZE_ALLOC;
+    janet_gc_page_sweep(page, 0);
+    finalize_mode = mode;
+    if (page->live == 0 && !on_demand) {
+        janet_gc_page_unmap(page);
+    } else {
+        page->next = pool->pages;
+        pool->pages = page;
+        janet_gc_page_release_slots(pool, page);
+    }
+    /* Only now is the size of the old generation known */
+    if (0 == --janet_vm.gc_unswept)
+        janet_gc_set_old_limit();
+}
+
+/* Sweep up to count unswept pages */
+static void janet_gc_sweep_lazily(size_t count) {
+    for (int c = 0; c < JANET_GC_SIZE_CLASSES && count && janet_vm.gc_unswept; c++) {
+        JanetGCPool *pool = janet_vm.gc_pools + c;
+        while (count && NULL != pool->unswept) {
+            janet_gc_sweep_unswept(pool, 0);
+            count--;
+        }
+    }
+}
+
+/* Sweep after an automatic full collection. Young pages and large objects
+ * are swept right away, all other pages are left unswept. Live objects on
+ * unswept pages keep their mark bits until their page is swept, so there
+ * can be no other full collection until every page is swept. */
+static void janet_gc_sweep_pages_lazy(void) {
+    for (int c = 0; c < JANET_GC_SIZE_CLASSES; c++) {
+        JanetGCPool *pool = janet_vm.gc_pools + c;
+        JanetGCPage *page = pool->pages;
+        pool->pages = NULL;
+        pool->available = NULL;
+        while (NULL != page) {
+            JanetGCPage *next = page->next;
+            page->flags &= ~JANET_GC_PAGE_AVAILABLE;
+            if (page->flags & JANET_GC_PAGE_YOUNG) {
+                janet_gc_page_sweep(page, 0);
+                if (page->live == 0) {
+                    janet_gc_page_unmap(page);
+                } else {
+                    page->next = pool->pages;
+                    pool->pages = page;
+                    janet_gc_page_release_slots(pool, page);
+                }
+            } else {
+                page->flags |= JANET_GC_PAGE_UNSWEPT;
+                page->next = pool->unswept;
+                pool->unswept = page;
+                janet_vm.gc_unswept++;
+            }
+            page = next;
+        }
+    }
+    janet_vm.young_pages = NULL;
+}
+
+/* Free a large block that is no longer reachable. Large blocks are never
+ * swept from the allocator, so they can always be finalized. */
+static void janet_free_block(JanetGCObject *mem) {
+    janet_vm.block_count--;
+    janet_gc_count_free(mem->flags & JANET_MEM_TYPEBITS, janet_gc_large_size(mem));
+    if (mem->flags & JANET_MEM_SAMPLED)
+        janet_gc_profile_free(mem);
+    janet_gc_finalize(mem);
+    janet_free(janet_gc_large_base(mem));
+}
+
+/* Sweep the young large objects. Every survivor is promoted. */
+static void janet_sweep_young_blocks(void) {
+    JanetGCObject *current = janet_vm.blocks;
+    JanetGCObject *next;
+    while (NULL != current) {
+        next = current->next;
+        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            janet_gc_promote(current);
+            janet_vm.gc_swept_data += janet_gc_data_size(current);
+            current->next = janet_vm.old_blocks;
+            janet_vm.old_blocks = current;
+        } else {
+            janet_free_block(current);
+        }
+        current = next;
+    }
+    janet_vm.blocks = NULL;
+}
+
+/* Sweep the old large objects */
+static void janet_sweep_old_blocks(void) {
+    JanetGCObject *previous = NULL;
+    JanetGCObject *current = janet_vm.old_blocks;
+    JanetGCObject *next;
+    while (NULL != current) {
+        next = current->next;
+        if (current->flags & (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)) {
+            previous = current;
+            current->flags &= ~JANET_MEM_REACHABLE;
+            janet_vm.gc_swept_data += janet_gc_data_size(current);
+        } else {
+            janet_vm.old_block_count--;
+            janet_free_block(current);
+            if (NULL != previous) {
+                previous->next = next;
+            } else {
+                janet_vm.old_blocks = next;
+            }
+        }
+        current = next;
+    }
+}
+
+/* Sweep after an automatic full collection */
+static void janet_sweep_lazy(void) {
+    janet_gc_prune_remembered();
+    janet_gc_sweep_pages_lazy();
+    janet_sweep_old_blocks();
+    janet_sweep_young_blocks();
+}
+
+/* Sweep the young generation after a minor collection */
+static void janet_sweep_young(void) {
+    janet_gc_sweep_young_pages();
+    janet_sweep_young_blocks();
+}
+
+/* Iterate over all allocated memory, and free memory that is not
+ * marked as reachable. Survivors are promoted to the old generation. */
+void janet_sweep() {
+    janet_gc_prune_remembered();
+    janet_gc_sweep_pages();
+    janet_sweep_old_blocks();
+    janet_sweep_young_blocks();
+}
+
+/* Allocate some memory that is tracked for garbage collection */
+void *janet_gcalloc(enum JanetMemoryType type, size_t size) {
+    JanetGCObject *mem;
+
+    /* Make sure everything is inited */
+    janet_assert(NULL != janet_vm.cache, "please initialize janet before use");
+
+    if (size <= JANET_GC_SLAB_MAX) {
+        int sclass = janet_gc_size_class(size);
+        mem = janet_gc_slab_alloc(sclass);
+        janet_gc_count_alloc(type, janet_gc_class_sizes[sclass]);
+    } else {
+        char *base = janet_malloc(JANET_GC_LARGE_HEADER + size);
+
+        /* Check for bad malloc */
+        if (NULL == base) {
+            JANET_OUT_OF_MEMORY;
+        }
+        *((size_t *) base) = size;
+        mem = (JanetGCObject *)(base + JANET_GC_LARGE_HEADER);
+        janet_gc_count_alloc(type, size);
+
+        /* Prepend block to the young generation */
+        mem->next = janet_vm.blocks;
+        janet_vm.blocks = mem;
+    }
+
+    /* Configure block */
+    mem->flags = type;
+    janet_vm.next_collection += size;
+    janet_vm.block_count++;
+    if (size >= janet_vm.gc_sample_left) {
+        janet_gc_profile_sample(mem, size);
+    } else {
+        janet_vm.gc_sample_left -= size;
+    }
+
+    return (void *)mem;
+}
+
+/* Call a function on every object in the heap */
+static void janet_gc_foreach_page(JanetGCPage *page, JanetGCVisitor visitor, void *data) {
+    for (; NULL != page; page = page->next) {
+        /* Unmarked objects on unswept pages are dead */
+        int32_t skip = JANET_MEM_FREE | JANET_MEM_PENDING;
+        int32_t live = (page->flags & JANET_GC_PAGE_UNSWEPT)
+                       ? (JANET_MEM_REACHABLE | JANET_MEM_DISABLED)
+                       : 0;
+        for (uint32_t i = 0; i < page->bump; i++) {
+            JanetGCObject *mem = janet_gc_page_slot(page, i);
+            if (mem->flags & skip) continue;
+            if (live && !(mem->flags & live)) continue;
+            visitor(mem, data);
+        }
+    }
+}
+
+void janet_gc_foreach(JanetGCVisitor visitor, void *data) {
+    for (int c = 0; c < JANET_GC_SIZE_CLASSES; c++) {
+        janet_gc_foreach_page(janet_vm.gc_pools[c].pages, visitor, data);
+        janet_gc_foreach_page(janet_vm.gc_pools[c].unswept, visitor, data);
+    }
+    for (JanetGCObject *mem = janet_vm.blocks; NULL != mem; mem = mem->next)
+        visitor(mem, data);
+    for (JanetGCObject *mem = janet_vm.old_blocks; NULL != mem; mem = mem->next)
+        visitor(mem, data);
+}
+
+static void free_one_scratch(JanetScratch *s) {
+    if (NULL != s->finalize) {
+        s->finalize((char *) s->mem);
+    }
+    janet_free(s);
+}
+
+/* Free all allocated scratch memory */
+static void janet_free_all_scratch(void) {
+    for (size_t i = 0; i < janet_vm.scratch_len; i++) {
+        free_one_scratch(janet_vm.scratch_mem[i]);
+    }
+    janet_vm.scratch_len = 0;
+}
+
+static JanetScratch *janet_mem2scratch(void *mem) {
+    JanetScratch *s = (JanetScratch *)mem;
+    return s - 1;
+}
+
+/* Prepare the root stack for marking. Values nested too deeply to be marked
+ * recursively are pushed onto the root stack and handled in janet_mark_end. */
+static void janet_mark_begin(void) {
+    depth = JANET_RECURSION_GUARD;
+    orig_rootcount = janet_vm.root_count;
+}
+
+/* Mark all roots */
+static void janet_mark_roots(void) {
+    uint32_t i;
+#ifdef JANET_EV
+    janet_ev_mark();
+#endif
+    janet_mark_fiber(janet_vm.root_fiber);
+    for (i = 0; i < orig_rootcount; i++)
+        janet_mark(janet_vm.roots[i]);
+}
+
+/* Check if a value survives the collection being marked */
+static int janet_gc_alive(Janet x) {
+    JanetGCObject *mem;
+    switch (janet_type(x)) {
+        default:
+            return 1;
+        case JANET_STRING:
+        case JANET_KEYWORD:
+        case JANET_SYMBOL:
+            mem = janet_gc_header(janet_string_head(janet_unwrap_string(x)));
+            break;
+        case JANET_FUNCTION:
+        case JANET_ARRAY:
+        case JANET_TABLE:
+        case JANET_BUFFER:
+        case JANET_FIBER:
+            mem = janet_gc_header(janet_unwrap_pointer(x));
+            break;
+        case JANET_STRUCT:
+            mem = janet_gc_header(janet_struct_head(janet_unwrap_struct(x)));
+            break;
+        case JANET_TUPLE:
+            mem = janet_gc_header(janet_tuple_head(janet_unwrap_tuple(x)));
+            break;
+        case JANET_ABSTRACT:
+            mem = janet_gc_header(janet_abstract_head(janet_unwrap_abstract(x)));
+            break;
+    }
+    return 0 != (mem->flags & (visited_mask | JANET_MEM_DISABLED));
+}
+
+/* Mark the values of ephemeron entries whose keys are alive. Returns non-zero
+ * if anything was marked, as that may bring more keys to life. */
+static int janet_mark_ephemerons(void) {
+    int marked = 0;
+    for (size_t i = 0; i < janet_vm.gc_weak_count; i++) {
+        JanetTable *table = (JanetTable *) janet_vm.gc_weak[i];
+        if (!(table->gc.flags & JANET_TABLE_FLAG_EPHEMERON))
+            continue;
+        for (int32_t j = 0; j < table->capacity; j++) {
+            JanetKV *kv = table->data + j;
+            if (janet_checktype(kv->key, JANET_NIL)) continue;
+            if (janet_gc_alive(kv->key) && !janet_gc_alive(kv->value)) {
+                janet_mark(kv->value);
+                marked = 1;
+            }
+        }
+    }
+    return marked;
+}
+
+/* Remove the entries of weak tables that refer to dead objects. This runs
+ * before sweeping, so no weak table is left holding an object that is about
+ * to be freed, including on pages that are swept lazily. */
+static void janet_gc_clear_weak(void) {
+    for (size_t i = 0; i < janet_vm.gc_weak_count; i++) {
+        JanetTable *table = (JanetTable *) janet_vm.gc_weak[i];
+        int32_t flags = table->gc.flags;
+        for (int32_t j = 0; j < table->capacity; j++) {
+            JanetKV *kv = table->data + j;
+            if (janet_checktype(kv->key, JANET_NIL)) continue;
+            if (((flags & (JANET_TABLE_FLAG_WEAK_K | JANET_TABLE_FLAG_EPHEMERON)) && !janet_gc_alive(kv->key)) ||
+                    ((flags & JANET_TABLE_FLAG_WEAK_V) && !janet_gc_alive(kv->value))) {
+                kv->key = janet_wrap_nil();
+                kv->value = janet_wrap_false();
+                table->count--;
+                table->deleted++;
+            }
+        }
+    }
+    janet_vm.gc_weak_count = 0;
+}
+
+/* Mark the values that were pushed on the root stack during marking, and
+ * the values that ephemeron tables keep alive, then clear weak tables */
+static void janet_mark_end(void) {
+    do {
+        while (orig_rootcount < janet_vm.root_count) {
+            Janet x = janet_vm.roots[--janet_vm.root_count];
+            janet_mark(x);
+        }
+    } while (janet_mark_ephemerons());
+    janet_gc_clear_weak();
+}
+
+/*
+ * Incremental marking
+ *
+ * Once the old generation outgrows its budget, a full collection is spread
+ * over several slices instead of being done all at once. Starting a cycle
+ * marks the old objects directly referenced by the roots grey, and each slice
+ * traces at most gc_pause grey objects. Minor collections keep running in
+ * between, and objects they promote start out unmarked.
+ *
+ * There are no write barriers, so the mutator may store an unmarked object in
+ * an object that has already been traced. To account for that, the final
+ * pause marks the roots again and retraces every marked object in the
+ * remembered set, which holds all old objects that can be mutated. Young
+ * objects are not traced by slices at all, and immutable objects cannot change
+ * after they are traced. The final pause therefore costs about as much as a
+ * minor collection, plus whatever is left on the grey stack, followed by a
+ * full sweep.
+ */
+
+/* Trace up to budget grey objects. Returns non-zero once the grey stack is empty. */
+static int janet_gc_mark_slice(size_t budget) {
+    visited_mask = JANET_MEM_REACHABLE;
+    depth = JANET_RECURSION_GUARD;
+    grey_mode = JANET_GC_GREY_OLD;
+    while (budget-- && janet_vm.gc_grey_count)
+        janet_gc_trace(janet_vm.gc_grey[--janet_vm.gc_grey_count]);
+    grey_mode = JANET_GC_TRACE;
+    return 0 == janet_vm.gc_grey_count;
+}
+
+/* Start an incremental collection by marking the roots grey */
+static void janet_gc_start_marking(void) {
+    visited_mask = JANET_MEM_REACHABLE;
+    janet_mark_begin();
+    grey_mode = JANET_GC_GREY_OLD;
+    janet_mark_roots();
+    grey_mode = JANET_GC_TRACE;
+    janet_vm.gc_marking = 1;
+}
+
+/* Take one slice of an incremental mark if one is in progress. This never
+ * frees memory, so it may run outside of the VM, such as in the event loop. */
+void janet_collect_step(void) {
+    if (janet_vm.gc_suspend || !janet_vm.gc_marking) return;
+    uint64_t start = janet_gc_now();
+    janet_gc_mark_slice(janet_vm.gc_pause);
+    janet_gc_record_pause(start);
+}
+
+#ifdef JANET_PARALLEL_GC
+
+/*
+ * Parallel marking
+ *
+ * Full collections of large heaps can spread marking over helper threads.
+ * Every thread, including the main thread, drains its own grey stack, which
+ * lives in its thread local janet_vm. Threads with a surplus of work hand half
+ * of it to a shared pool whenever another thread is idle, and idle threads take
+ * work back out of the pool. Marking is done once every thread is idle and the
+ * pool is empty. Objects that may only be traced on the main thread, namely
+ * abstract types with a gcmark hook, which may run arbitrary code, and closure
+ * environments that still point into a fiber stack, which may be detached, are
+ * set aside and traced serially once the helpers are finished.
+ */
+
+#define JANET_GC_MARK_CHUNK 256
+
+typedef struct {
+    JanetGCLock lock;
+    JanetGCCond cond;
+    JanetGCObject **pool;
+    size_t pool_count;
+    size_t pool_capacity;
+    JanetGCObject **deferred;
+    size_t deferred_count;
+    size_t deferred_capacity;
+    int workers;
+    int idle;
+    int done;
+} JanetGCMarker;
+
+/* Check if a grey object must be traced on the main thread. Weak tables are
+ * collected in a vector on the main thread, see janet_mark_weak_table. */
+static int janet_gc_main_only(JanetGCObject *mem) {
+    switch (mem->flags & JANET_MEM_TYPEBITS) {
+        default:
+            return 0;
+        case JANET_MEMORY_ABSTRACT:
+            return 1;
+        case JANET_MEMORY_TABLE:
+            return 0 != (mem->flags & JANET_TABLE_FLAG_WEAK);
+        case JANET_MEMORY_FUNCENV:
+            return 0 != ((JanetFuncEnv *) mem)->offset;
+    }
+}
+
+/* Move half of the local grey stack to the pool if another thread is idle */
+static void janet_gc_marker_share(JanetGCMarker *m) {
+    if (janet_vm.gc_grey_count < 2) return;
+    janet_gc_lock(&m->lock);
+    if (m->idle && 0 == m->pool_count) {
+        size_t keep = janet_vm.gc_grey_count / 2;
+        for (size_t i = keep; i < janet_vm.gc_grey_count; i++)
+            janet_gc_push(&m->pool, &m->pool_count, &m->pool_capacity, janet_vm.gc_grey[i]);
+        janet_vm.gc_grey_count = keep;
+        janet_gc_wake(&m->cond);
+    }
+    janet_gc_unlock(&m->lock);
+}
+
+/* Wait for work from the pool. Returns 0 once marking is done. */
+static int janet_gc_marker_take(JanetGCMarker *m) {
+    janet_gc_lock(&m->lock);
+    m->idle++;
+    while (0 == m->pool_count && !m->done) {
+        if (m->idle == m->workers) {
+            m->done = 1;
+            janet_gc_wake(&m->cond);
+        } else {
+            janet_gc_wait(&m->cond, &m->lock);
+        }
+    }
+    if (m->done) {
+        janet_gc_unlock(&m->lock);
+        return 0;
+    }
+    m->idle--;
+    for (int i = 0; i < JANET_GC_MARK_CHUNK && m->pool_count; i++)
+        janet_gc_push(&janet_vm.gc_grey, &janet_vm.gc_grey_count, &janet_vm.gc_grey_capacity,
+                      m->pool[--m->pool_count]);
+    janet_gc_unlock(&m->lock);
+    return 1;
+}
+
+/* Mark loop run by every thread taking part in parallel marking */
+static void janet_gc_mark_worker(JanetGCMarker *m) {
+    size_t traced = 0;
+    grey_mode = JANET_GC_GREY_ALL;
+    do {
+        while (janet_vm.gc_grey_count) {
+            JanetGCObject *mem = janet_vm.gc_grey[--janet_vm.gc_grey_count];
+            if (janet_gc_main_only(mem)) {
+                janet_gc_lock(&m->lock);
+                janet_gc_push(&m->deferred, &m->deferred_count, &m->deferred_capacity, mem);
+                janet_gc_unlock(&m->lock);
+            } else {
+                janet_gc_trace(mem);
+            }
+            if (0 == ++traced % JANET_GC_MARK_CHUNK)
+                janet_gc_marker_share(m);
+        }
+    } while (janet_gc_marker_take(m));
+    grey_mode = JANET_GC_TRACE;
+}
+
+/* Helper threads use their own, otherwise unused, janet_vm only for the grey stack */
+#ifdef JANET_WINDOWS
+static DWORD WINAPI janet_gc_helper(LPVOID param) {
+#else
+static void *janet_gc_helper(void *param) {
+#endif
+    janet_gc_mark_worker((JanetGCMarker *) param);
+    janet_free(janet_vm.gc_grey);
+    janet_vm.gc_grey = NULL;
+    janet_vm.gc_grey_capacity = 0;
+#ifdef JANET_WINDOWS
+    return 0;
+#else
+    return NULL;
+#endif
+}
+
+/* Trace everything reachable from the grey stack with the help of gc_threads
+ * helper threads */
+static void janet_gc_mark_parallel(void) {
+    JanetGCMarker m;
+    int nhelpers = 0;
+#ifdef JANET_WINDOWS
+    HANDLE *helpers = janet_malloc(sizeof(HANDLE) * (size_t) janet_vm.gc_threads);
+#else
+    pthread_t *helpers = janet_malloc(sizeof(pthread_t) * (size_t) janet_vm.gc_threads);
+#endif
+    janet_gc_lock_init(&m.lock);
+    janet_gc_cond_init(&m.cond);
+    if (NULL == helpers) {
+        JANET_OUT_OF_MEMORY;
+    }
+    m.pool = NULL;
+    m.pool_count = 0;
+    m.pool_capacity = 0;
+    m.deferred = NULL;
+    m.deferred_count = 0;
+    m.deferred_capacity = 0;
+    m.idle = 0;
+    m.done = 0;
+
+    /* Seed the pool and start helpers. If a thread fails to start, just mark
+     * with fewer threads. */
+    janet_gc_lock(&m.lock);
+    for (size_t i = janet_vm.gc_grey_count / 2; i < janet_vm.gc_grey_count; i++)
+        janet_gc_push(&m.pool, &m.pool_count, &m.pool_capacity, janet_vm.gc_grey[i]);
+    janet_vm.gc_grey_count /= 2;
+    for (int i = 0; i < janet_vm.gc_threads; i++) {
+#ifdef JANET_WINDOWS
+        helpers[nhelpers] = CreateThread(NULL, 0, janet_gc_helper, &m, 0, NULL);
+        if (NULL != helpers[nhelpers]) nhelpers++;
+#else
+        if (!pthread_create(helpers + nhelpers, NULL, janet_gc_helper, &m)) nhelpers++;
+#endif
+    }
+    m.workers = nhelpers + 1;
+    janet_gc_unlock(&m.lock);
+
+    janet_gc_mark_worker(&m);
+
+    for (int i = 0; i < nhelpers; i++) {
+#ifdef JANET_WINDOWS
+        WaitForSingleObject(helpers[i], INFINITE);
+        CloseHandle(helpers[i]);
+#else
+        pthread_join(helpers[i], NULL);
+#endif
+    }
+    janet_gc_lock_deinit(&m.lock);
+    janet_gc_cond_deinit(&m.cond);
+
+    /* Trace what the helpers could not */
+    for (size_t i = 0; i < m.deferred_count; i++)
+        janet_gc_trace(m.deferred[i]);
+
+    janet_free(m.deferred);
+    janet_free(m.pool);
+    janet_free(helpers);
+}
+
+#endif
+
+/* Mark the whole heap. If an incremental collection is in progress, this is
+ * its final pause. */
+static void janet_gc_mark_full(void) {
+    visited_mask = JANET_MEM_REACHABLE;
+    janet_mark_begin();
+#ifdef JANET_PARALLEL_GC
+    if (janet_vm.gc_threads > 0 && janet_vm.block_count >= JANET_GC_PARALLEL_MIN) {
+        grey_mode = JANET_GC_GREY_ALL;
+        janet_mark_roots();
+        if (janet_vm.gc_marking)
+            janet_mark_remembered(1);
+        grey_mode = JANET_GC_TRACE;
+        janet_gc_mark_parallel();
+    } else
+#endif
+    {
+        janet_mark_roots();
+        if (janet_vm.gc_marking) {
+            janet_mark_remembered(1);
+            while (janet_vm.gc_grey_count)
+                janet_gc_trace(janet_vm.gc_grey[--janet_vm.gc_grey_count]);
+        }
+    }
+    janet_vm.gc_marking = 0;
+    janet_mark_end();
+}
+
+/* Collect the whole heap. Every page must have been swept since the last
+ * full collection. */
+static void janet_gc_full(int lazy) {
+    janet_gc_mark_full();
+    janet_vm.gc_stats.full_collections++;
+    janet_vm.gc_swept_data = 0;
+    if (lazy) {
+        janet_sweep_lazy();
+        if (0 == janet_vm.gc_unswept)
+            janet_gc_set_old_limit();
+    } else {
+        janet_sweep();
+        janet_gc_set_old_limit();
+    }
+    janet_vm.next_collection = 0;
+    janet_gc_schedule();
+    janet_free_all_scratch();
+}
+
+/* Run garbage collection over the whole heap and free everything that is
+ * found dead before returning. */
+void janet_collect(void) {
+    if (janet_vm.gc_suspend) return;
+    uint64_t start = janet_gc_now();
+    janet_gc_free_pending();
+    janet_gc_sweep_lazily(SIZE_MAX);
+    janet_gc_full(0);
+#ifdef JANET_THREADS
+    janet_gc_background_wait();
+#endif
+    janet_gc_record_pause(start);
+}
+
+/* Check if an automatic collection should collect the whole heap */
+static int janet_gc_want_full(void) {
+    if (janet_vm.gc_marking) {
+        /* Finish the cycle when marking is done, if the old generation
+         * grows faster than it can be marked, or if the heap is past the
+         * soft limit */
+        return 0 == janet_vm.gc_pause ||
+               janet_gc_over_limit() ||
+               janet_gc_mark_slice(janet_vm.gc_pause) ||
+               janet_vm.old_block_count > 2 * janet_vm.old_block_limit;
+    }
+    /* Until the last collection is swept, the old generation size is not known */
+    if (janet_vm.gc_unswept || !janet_gc_heap_full())
+        return 0;
+    if (0 == janet_vm.gc_pause)
+        return 1;
+    janet_gc_start_marking();
+    return 0;
+}
+
+/* Collect only the young generation. Once the old generation has outgrown
+ * its budget, also start or advance an incremental collection of the whole
+ * heap, or do a full collection right away if incremental marking is
+ * disabled. Old objects survive minor collections even if they are
+ * unreachable. Full collections started here leave most pages unswept, and
+ * each minor collection sweeps a few of them. */
+static void janet_gc_minor(void) {
+    uint64_t start = janet_gc_now();
+    finalize_mode = JANET_GC_FINALIZE_AUTO;
+    janet_gc_free_pending();
+    janet_gc_sweep_lazily(JANET_GC_SWEEP_STEP);
+    if (janet_gc_want_full()) {
+        janet_gc_full(1);
+    } else {
+        visited_mask = JANET_MEM_REACHABLE | JANET_MEM_OLD;
+        janet_mark_begin();
+        janet_mark_roots();
+        janet_mark_remembered(0);
+        janet_mark_end();
+        janet_sweep_young();
+        visited_mask = JANET_MEM_REACHABLE;
+        janet_vm.next_collection = 0;
+        janet_gc_schedule();
+        janet_free_all_scratch();
+        janet_vm.gc_stats.minor_collections++;
+    }
+    finalize_mode = JANET_GC_FINALIZE_NOW;
+    janet_gc_record_pause(start);
+}
+
+/* Automatic minor collection. Inside a region, collections are put off until
+ * the region ends, unless the region allocates far more than the gc interval. */
+void janet_collect_minor(void) {
+    if (janet_vm.gc_suspend) return;
+    if (janet_vm.gc_region) {
+        janet_vm.gc_region_bytes += janet_vm.next_collection;
+        janet_vm.next_collection = 0;
+        if (janet_vm.gc_region_bytes / JANET_GC_REGION_SLACK < janet_vm.gc_trigger) return;
+    }
+    janet_vm.gc_region_bytes = 0;
+    janet_gc_minor();
+}
+
+/* Bring back a dead object found through a weak reference, such as the symbol
+ * cache. Such an object may sit on a page that has not been swept yet, and
+ * marking it keeps the sweep from freeing it. Takes the object header. */
+void janet_gc_revive(void *mem) {
+    JanetGCObject *obj = janet_gc_header(mem);
+    if (janet_vm.gc_unswept && (obj->flags & JANET_MEM_OLD))
+        obj->flags |= JANET_MEM_REACHABLE;
+}
+
+/* Add a root value to the GC. This prevents the GC from removing a value
+ * and all of its children. If gcroot is called on a value n times, unroot
+ * must also be called n times to remove it as a gc root. */
+void janet_gcroot(Janet root) {
+    size_t newcount = janet_vm.root_count + 1;
+    if (newcount > janet_vm.root_capacity) {
+        size_t newcap = 2 * newcount;
+        janet_vm.roots = janet_realloc(janet_vm.roots, sizeof(Janet) * newcap);
+        if (NULL == janet_vm.roots) {
+            JANET_OUT_OF_MEMORY;
+        }
+        janet_vm.root_capacity = newcap;
+    }
+    janet_vm.roots[janet_vm.root_count] = root;
+    janet_vm.root_count = newcount;
+}
+
+/* Identity equality for GC purposes */
+static int janet_gc_idequals(Janet lhs, Janet rhs) {
+    if (janet_type(lhs) != janet_type(rhs))
+        return 0;
+    switch (janet_type(lhs)) {
+        case JANET_BOOLEAN:
+        case JANET_NIL:
+        case JANET_NUMBER:
+            /* These values don't really matter to the gc so returning 1 all the time is fine. */
+            return 1;
+        default:
+            return janet_unwrap_pointer(lhs) == janet_unwrap_pointer(rhs);
+    }
+}
+
+/* Remove a root value from the GC. This allows the gc to potentially reclaim
  * a value and all its children. */
 int janet_gcunroot(Janet root) {
     Janet *vtop = janet_vm.roots + janet_vm.root_count;
@@ -466,16 +2400,65 @@ int janet_gcunrootall(Janet root) {
     return ret;
 }
 
-/* Free all allocated memory */
-void janet_clear_memory(void) {
-    JanetGCObject *current = janet_vm.blocks;
+/* Free all large objects in a list */
+static void janet_free_list(void **list) {
+    JanetGCObject *current = *list;
     while (NULL != current) {
         janet_deinit_block(current);
         JanetGCObject *next = current->next;
-        janet_free(current);
+        janet_free(janet_gc_large_base(current));
         current = next;
     }
-    janet_vm.blocks = NULL;
+    *list = NULL;
+}
+
+/* Free all pages in a list */
+static void janet_free_pages(JanetGCPage **list) {
+    JanetGCPage *page = *list;
+    while (NULL != page) {
+        JanetGCPage *next = page->next;
+        for (uint32_t i = 0; i < page->bump; i++) {
+            JanetGCObject *mem = janet_gc_page_slot(page, i);
+            if (!(mem->flags & JANET_MEM_FREE)) janet_deinit_block(mem);
+        }
+        janet_gc_page_unmap(page);
+        page = next;
+    }
+    *list = NULL;
+}
+
+/* Free all allocated memory */
+void janet_clear_memory(void) {
+#ifdef JANET_THREADS
+    janet_gc_background_deinit();
+#endif
+    janet_gc_profile_deinit();
+    for (int c = 0; c < JANET_GC_SIZE_CLASSES; c++) {
+        janet_free_pages(&janet_vm.gc_pools[c].pages);
+        janet_free_pages(&janet_vm.gc_pools[c].unswept);
+        janet_vm.gc_pools[c].available = NULL;
+    }
+    janet_vm.gc_unswept = 0;
+    janet_free(janet_vm.gc_pending);
+    janet_vm.gc_pending = NULL;
+    janet_vm.gc_pending_count = 0;
+    janet_vm.gc_pending_capacity = 0;
+    janet_vm.young_pages = NULL;
+    janet_free_list(&janet_vm.blocks);
+    janet_free_list(&janet_vm.old_blocks);
+    janet_free(janet_vm.remembered);
+    janet_vm.remembered = NULL;
+    janet_vm.remembered_count = 0;
+    janet_vm.remembered_capacity = 0;
+    janet_free(janet_vm.gc_grey);
+    janet_vm.gc_grey = NULL;
+    janet_vm.gc_grey_count = 0;
+    janet_vm.gc_grey_capacity = 0;
+    janet_free(janet_vm.gc_weak);
+    janet_vm.gc_weak = NULL;
+    janet_vm.gc_weak_count = 0;
+    janet_vm.gc_weak_capacity = 0;
+    janet_vm.gc_marking = 0;
     janet_free_all_scratch();
     janet_free(janet_vm.scratch_mem);
 }
@@ -488,6 +2471,32 @@ void janet_gcunlock(int handle) {
     janet_vm.gc_suspend = handle;
 }
 
+/* Memory regions. A region is a hint to put off automatic collections, not an
+ * arena: objects allocated in it come from the normal heap. When a region
+ * ends, one minor collection runs if regions allocated at least
+ * JANET_GC_REGION_MIN bytes since the last collection. That collection traces
+ * the roots and the remembered set like any other, and frees the dead objects
+ * of the region along with any other dead young objects. Objects that escaped
+ * the region survive it like any other young object. Regions belong to the
+ * fiber that opened them. janet_continue saves the depth of a fiber when it
+ * yields and reopens its regions on top of those of the resumer when it is
+ * resumed, so handles count from the depth the fiber was resumed at. Ending a
+ * region that was already ended along with an enclosing region does nothing.
+ * Like janet_collect, janet_region_end frees any object that is not reachable
+ * from a root or a fiber stack. */
+int janet_region_begin(void) {
+    return janet_vm.gc_region++ - janet_vm.gc_region_base;
+}
+void janet_region_end(int handle) {
+    int depth = janet_vm.gc_region_base + handle;
+    if (handle < 0 || depth >= janet_vm.gc_region) return;
+    janet_vm.gc_region = depth;
+    if (janet_vm.gc_suspend) return;
+    if (janet_vm.gc_region_bytes + janet_vm.next_collection < JANET_GC_REGION_MIN) return;
+    janet_vm.gc_region_bytes = 0;
+    janet_gc_minor();
+}
+
 /* Scratch memory API */
 
 void *janet_smalloc(size_t size) {
@@ -496,6 +2505,7 @@ void *janet_smalloc(size_t size) {
         JANET_OUT_OF_MEMORY;
     }
     s->finalize = NULL;
+    s->size = size;
     if (janet_vm.scratch_len == janet_vm.scratch_cap) {
         size_t newcap = 2 * janet_vm.scratch_cap + 2;
         JanetScratch **newmem = (JanetScratch **) janet_realloc(janet_vm.scratch_mem, newcap * sizeof(JanetScratch));
@@ -529,6 +2539,7 @@ void *janet_srealloc(void *mem, size_t size) {
                 if (NULL == news) {
                     JANET_OUT_OF_MEMORY;
                 }
+                news->size = size;
                 janet_vm.scratch_mem[i] = news;
                 return (char *)(news->mem);
             }
@@ -34,6 +34,45 @@
 #define JANET_MEM_TYPEBITS 0xFF
 #define JANET_MEM_REACHABLE 0x100
 #define JANET_MEM_DISABLED 0x200
+#define JANET_MEM_OLD 0x400
+#define JANET_MEM_FREE 0x800
+#define JANET_MEM_PENDING 0x1000
+#define JANET_MEM_SAMPLED 0x2000
+
+/* Any of the weak table flags */
+#define JANET_TABLE_FLAG_WEAK (JANET_TABLE_FLAG_WEAK_K | JANET_TABLE_FLAG_WEAK_V | JANET_TABLE_FLAG_EPHEMERON)
+
+/* Smallest old generation (in blocks) that will trigger a full collection */
+#define JANET_GC_OLD_MIN 0x10000
+
+/* Smallest array, buffer or fiber stack data (in bytes) that is mapped
+ * directly from the OS instead of allocated with malloc */
+#define JANET_GC_LARGE_DATA 0x40000
+
+/* Default growth of the heap between full collections, in percent */
+#define JANET_GC_TARGET 100
+
+/* Near the soft heap limit, the fewest bytes allocated between minor collections */
+#define JANET_GC_TRIGGER_MIN 0x10000
+
+/* Past the soft heap limit, collect the whole heap once it has grown by
+ * 1/JANET_GC_LIMIT_GROWTH of the limit since the last full collection */
+#define JANET_GC_LIMIT_GROWTH 16
+
+/* Fewest minor collections between full collections when the heap grows by the target */
+#define JANET_GC_MINOR_SPLIT 8
+
+/* Smallest allocation (in bytes) that is collected when a region ends */
+#define JANET_GC_REGION_MIN 0x10000
+
+/* How many gc intervals a region may allocate before collecting anyway */
+#define JANET_GC_REGION_SLACK 16
+
+/* Default number of objects traced per slice of incremental marking */
+#define JANET_GC_PAUSE 0x4000
+
+/* Smallest heap (in blocks) that is marked in parallel */
+#define JANET_GC_PARALLEL_MIN 0x10000
 
 #define janet_gc_settype(m, t) ((janet_gc_header(m)->flags |= (0xFF & (t))))
 #define janet_gc_type(m) (janet_gc_header(m)->flags & 0xFF)
@@ -62,4 +101,24 @@ enum JanetMemoryType {
  * and then call when janet_enablegc when it is initailize and reachable by the gc (on the JANET stack) */
 void *janet_gcalloc(enum JanetMemoryType type, size_t size);
 
+/* Run a minor collection, escalating to a full one when needed */
+void janet_collect_minor(void);
+
+/* Take one slice of an incremental mark if one is in progress */
+void janet_collect_step(void);
+
+/* Keep a dead object found through a weak reference from being swept */
+void janet_gc_revive(void *mem);
+
+/* Allocate, resize and free the data of arrays, buffers and fiber stacks.
+ * Large data is mapped from the OS, so resizing and freeing must be given the
+ * size it was allocated with. */
+void *janet_gc_data_alloc(size_t size);
+void *janet_gc_data_realloc(void *mem, size_t oldsize, size_t size);
+void janet_gc_data_free(void *mem, size_t size);
+
+/* Call a function on every object in the heap */
+typedef void (*JanetGCVisitor)(JanetGCObject *mem, void *data);
+void janet_gc_foreach(JanetGCVisitor visitor, void *data);
+
 #endif
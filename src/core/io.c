@@ -53,7 +53,9 @@ const JanetAbstractType janet_file_type = {
     NULL, /* compare */
     NULL, /* hash */
     io_file_next,
-    JANET_ATEND_NEXT
+    NULL, /* call */
+    cfun_io_gc,
+    JANET_ATEND_GCASYNC
 };
 
 /* Check arguments to fopen */
@@ -542,9 +544,9 @@ static Janet cfun_io_printf_impl_x(int32_t argc, Janet *argv, int newline,
         }
     }
     /* Clear buffer to make things easier for GC */
+    janet_buffer_deinit(buf);
     buf->count = 0;
     buf->capacity = 0;
-    janet_free(buf->data);
     buf->data = NULL;
     return janet_wrap_nil();
 }
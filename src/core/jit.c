@@ -0,0 +1,573 @@
+/*
+* Copyright (c) 2021 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "util.h"
+#include "vector.h"
+#endif
+
+#ifdef JANET_JIT
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+/* Template JIT
+ *
+ * Hot function definitions are translated into x86-64 code one instruction at
+ * a time, with the same semantics as the interpreter. Compiled code works
+ * directly on the interpreter's stack frame and keeps no state of its own, so
+ * it can hand control back at any instruction. It handles the common cases of
+ * moves, loads, jumps, arithmetic and comparisons on numbers, and indexing
+ * arrays, and returns the pc of the first instruction it cannot handle. Calls,
+ * allocation, errors, signals and everything else run in the interpreter as
+ * usual, which enters compiled code again on calls and backward jumps.
+ *
+ * Register use: rbx holds the stack frame, rax, rcx and rdx are scratch, and
+ * xmm0 to xmm2 hold numbers. */
+
+/* Opcode fields of an instruction, as in vm.c */
+#define A ((instr >> 8)  & 0xFF)
+#define B ((instr >> 16) & 0xFF)
+#define C (instr >> 24)
+#define D (instr >> 8)
+#define E (instr >> 16)
+#define CS (((int32_t) instr) >> 24)
+#define DS (((int32_t) instr) >> 8)
+#define ES (((int32_t) instr) >> 16)
+
+/* x86-64 condition codes */
+#define JIT_CC_B 0x2
+#define JIT_CC_AE 0x3
+#define JIT_CC_E 0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_BE 0x6
+#define JIT_CC_A 0x7
+#define JIT_CC_P 0xA
+#define JIT_CC_S 0x8
+#define JIT_CC_GE 0xD
+#define JIT_CC_LE 0xE
+
+/* Registers */
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+
+/* A jump whose target is not known yet */
+typedef struct {
+    int32_t at; /* Offset of the rel32 to patch */
+    int32_t index; /* Target instruction */
+    int exit; /* Jump to the exit of the instruction instead of its code */
+} JitFixup;
+
+typedef struct {
+    uint8_t *code;
+    JitFixup *fixups;
+    int32_t *blocks;
+    int32_t *exits;
+    int32_t epilogue;
+} JitState;
+
+static void jit_byte(JitState *st, uint8_t b) {
+    janet_v_push(st->code, b);
+}
+
+static void jit_bytes(JitState *st, const char *bytes, int32_t n) {
+    for (int32_t i = 0; i < n; i++) janet_v_push(st->code, (uint8_t) bytes[i]);
+}
+
+static void jit_u32(JitState *st, uint32_t x) {
+    for (int i = 0; i < 4; i++) jit_byte(st, (x >> (8 * i)) & 0xFF);
+}
+
+static void jit_u64(JitState *st, uint64_t x) {
+    for (int i = 0; i < 8; i++) jit_byte(st, (x >> (8 * i)) & 0xFF);
+}
+
+static void jit_patch(JitState *st, int32_t at, int32_t target) {
+    uint32_t rel = (uint32_t)(target - (at + 4));
+    for (int i = 0; i < 4; i++) st->code[at + i] = (rel >> (8 * i)) & 0xFF;
+}
+
+/* jcc or jmp (cc < 0) to the code or the exit of an instruction */
+static void jit_jump(JitState *st, int cc, int32_t index, int exit) {
+    if (cc < 0) {
+        jit_byte(st, 0xE9);
+    } else {
+        jit_byte(st, 0x0F);
+        jit_byte(st, 0x80 | cc);
+    }
+    JitFixup fixup;
+    fixup.at = janet_v_count(st->code);
+    fixup.index = index;
+    fixup.exit = exit;
+    janet_v_push(st->fixups, fixup);
+    jit_u32(st, 0);
+}
+
+/* Forward jump within an instruction, patched with jit_here */
+static int32_t jit_jump_local(JitState *st, int cc) {
+    jit_byte(st, 0x0F);
+    jit_byte(st, 0x80 | cc);
+    jit_u32(st, 0);
+    return janet_v_count(st->code) - 4;
+}
+
+static void jit_here(JitState *st, int32_t at) {
+    jit_patch(st, at, janet_v_count(st->code));
+}
+
+/* mov reg, [rbx + 8 * slot] */
+static void jit_load(JitState *st, int reg, uint32_t slot) {
+    jit_bytes(st, "\x48\x8B", 2);
+    jit_byte(st, 0x83 | (reg << 3));
+    jit_u32(st, slot * sizeof(Janet));
+}
+
+/* mov [rbx + 8 * slot], reg */
+static void jit_store(JitState *st, int reg, uint32_t slot) {
+    jit_bytes(st, "\x48\x89", 2);
+    jit_byte(st, 0x83 | (reg << 3));
+    jit_u32(st, slot * sizeof(Janet));
+}
+
+/* mov reg, imm64 */
+static void jit_imm(JitState *st, int reg, uint64_t x) {
+    jit_byte(st, 0x48);
+    jit_byte(st, 0xB8 | reg);
+    jit_u64(st, x);
+}
+
+static void jit_store_value(JitState *st, uint32_t slot, Janet x) {
+    jit_imm(st, JIT_RAX, janet_u64(x));
+    jit_store(st, JIT_RAX, slot);
+}
+
+/* Load a number into an xmm register, leaving at the exit of instruction
+ * index if it is not a number. NaNs leave as well and are left to the
+ * interpreter. */
+static void jit_number(JitState *st, int xmm, uint32_t slot, int32_t index) {
+    jit_bytes(st, "\xF2\x0F\x10", 3);
+    jit_byte(st, 0x83 | (xmm << 3));
+    jit_u32(st, slot * sizeof(Janet));
+    jit_bytes(st, "\x66\x0F\x2E", 3);
+    jit_byte(st, 0xC0 | (xmm << 3) | xmm);
+    jit_jump(st, JIT_CC_P, index, 1);
+}
+
+/* Load an integer immediate as a number into xmm1 */
+static void jit_number_imm(JitState *st, int32_t x) {
+    double d = (double) x;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    jit_imm(st, JIT_RAX, bits);
+    jit_bytes(st, "\x66\x48\x0F\x6E\xC8", 5);
+}
+
+/* Leave with the tag of a value in ecx, or at the exit if it is not of type t */
+static void jit_tag(JitState *st, int reg, JanetType t, int32_t index) {
+    jit_bytes(st, "\x48\x89", 2);
+    jit_byte(st, 0xC1 | (reg << 3));
+    jit_bytes(st, "\x48\xC1\xE9\x2F", 4);
+    jit_bytes(st, "\x81\xF9", 2);
+    jit_u32(st, (uint32_t) janet_nanbox_lowtag(t));
+    jit_jump(st, JIT_CC_NE, index, 1);
+}
+
+/* xmm0 = xmm0 op xmm1, stored in slot a */
+static void jit_arith(JitState *st, uint8_t op, uint32_t a) {
+    jit_bytes(st, "\xF2\x0F", 2);
+    jit_byte(st, op);
+    jit_byte(st, 0xC1);
+    jit_bytes(st, "\xF2\x0F\x11", 3);
+    jit_byte(st, 0x83);
+    jit_u32(st, a * sizeof(Janet));
+}
+
+/* Store the boolean result of comparing xmm0 with xmm1 in slot a */
+static void jit_compare(JitState *st, int cc, uint32_t a) {
+    jit_bytes(st, "\x66\x0F\x2E\xC1", 4);
+    jit_imm(st, JIT_RAX, janet_u64(janet_wrap_false()));
+    jit_imm(st, JIT_RCX, janet_u64(janet_wrap_true()));
+    jit_bytes(st, "\x48\x0F", 2);
+    jit_byte(st, 0x40 | cc);
+    jit_byte(st, 0xC1);
+    jit_store(st, JIT_RAX, a);
+}
+
+/* Jump to target if the value in slot a is truthy, and to the next
+ * instruction if not. */
+static void jit_branch(JitState *st, uint32_t a, int32_t target, int32_t next) {
+    jit_load(st, JIT_RAX, a);
+    jit_bytes(st, "\x48\x89\xC1\x48\xC1\xE9\x2F", 7);
+    jit_bytes(st, "\x81\xF9", 2);
+    jit_u32(st, (uint32_t) janet_nanbox_lowtag(JANET_NIL));
+    jit_jump(st, JIT_CC_E, next, 0);
+    jit_bytes(st, "\x81\xF9", 2);
+    jit_u32(st, (uint32_t) janet_nanbox_lowtag(JANET_BOOLEAN));
+    jit_jump(st, JIT_CC_NE, target, 0);
+    jit_bytes(st, "\xA8\x01", 2);
+    jit_jump(st, JIT_CC_E, next, 0);
+    jit_jump(st, -1, target, 0);
+}
+
+/* Load the payload of an array in rax into rax and leave at the exit if
+ * it is not an array. */
+static void jit_array(JitState *st, uint32_t slot, int32_t index) {
+    jit_load(st, JIT_RAX, slot);
+    jit_tag(st, JIT_RAX, JANET_ARRAY, index);
+    jit_imm(st, JIT_RCX, JANET_NANBOX_PAYLOADBITS);
+    jit_bytes(st, "\x48\x21\xC8", 3);
+}
+
+/* Emit code for one instruction. Returns 0 if the instruction is not
+ * supported, in which case it always leaves to the interpreter. */
+static int jit_instruction(JitState *st, JanetFuncDef *def, int32_t i) {
+    /* The rest of a superinstruction is compiled on its own */
+    uint32_t instr = janet_unfuse(janet_unquicken(def->bytecode[i]));
+    /* Widened instructions are left to the interpreter */
+    if (i > 0 && (def->bytecode[i - 1] & 0x7F) == JOP_WIDE) return 0;
+    switch (instr & 0x7F) {
+        default:
+            return 0;
+        case JOP_NOOP:
+            break;
+        case JOP_MOVE_NEAR:
+            jit_load(st, JIT_RAX, E);
+            jit_store(st, JIT_RAX, A);
+            break;
+        case JOP_MOVE_FAR:
+            jit_load(st, JIT_RAX, A);
+            jit_store(st, JIT_RAX, E);
+            break;
+        case JOP_LOAD_NIL:
+            jit_store_value(st, D, janet_wrap_nil());
+            break;
+        case JOP_LOAD_TRUE:
+            jit_store_value(st, D, janet_wrap_true());
+            break;
+        case JOP_LOAD_FALSE:
+            jit_store_value(st, D, janet_wrap_false());
+            break;
+        case JOP_LOAD_INTEGER:
+            jit_store_value(st, A, janet_wrap_integer(ES));
+            break;
+        case JOP_LOAD_CONSTANT:
+            if ((int32_t) E >= def->constants_length) return 0;
+            jit_store_value(st, A, def->constants[E]);
+            break;
+        case JOP_JUMP:
+            jit_jump(st, -1, i + DS, 0);
+            return 1;
+        case JOP_JUMP_IF:
+            jit_branch(st, A, i + ES, i + 1);
+            return 1;
+        case JOP_JUMP_IF_NOT:
+            jit_branch(st, A, i + 1, i + ES);
+            return 1;
+        case JOP_JUMP_IF_NIL:
+        case JOP_JUMP_IF_NOT_NIL: {
+            int nil = (instr & 0x7F) == JOP_JUMP_IF_NIL;
+            jit_load(st, JIT_RAX, A);
+            jit_bytes(st, "\x48\xC1\xE8\x2F", 4);
+            jit_byte(st, 0x3D);
+            jit_u32(st, (uint32_t) janet_nanbox_lowtag(JANET_NIL));
+            jit_jump(st, JIT_CC_E, nil ? i + ES : i + 1, 0);
+            jit_jump(st, -1, nil ? i + 1 : i + ES, 0);
+            return 1;
+        }
+        case JOP_ADD:
+        case JOP_SUBTRACT:
+        case JOP_MULTIPLY:
+        case JOP_DIVIDE:
+        case JOP_ADD_IMMEDIATE:
+        case JOP_MULTIPLY_IMMEDIATE:
+        case JOP_DIVIDE_IMMEDIATE: {
+            uint8_t op;
+            int imm = 0;
+            switch (instr & 0x7F) {
+                default:
+                    op = 0x58;
+                    break;
+                case JOP_ADD_IMMEDIATE:
+                    op = 0x58;
+                    imm = 1;
+                    break;
+                case JOP_SUBTRACT:
+                    op = 0x5C;
+                    break;
+                case JOP_MULTIPLY:
+                    op = 0x59;
+                    break;
+                case JOP_MULTIPLY_IMMEDIATE:
+                    op = 0x59;
+                    imm = 1;
+                    break;
+                case JOP_DIVIDE:
+                    op = 0x5E;
+                    break;
+                case JOP_DIVIDE_IMMEDIATE:
+                    op = 0x5E;
+                    imm = 1;
+                    break;
+            }
+            jit_number(st, 0, B, i);
+            if (imm) {
+                jit_number_imm(st, CS);
+            } else {
+                jit_number(st, 1, C, i);
+            }
+            jit_arith(st, op, A);
+            break;
+        }
+        case JOP_LESS_THAN:
+        case JOP_LESS_THAN_EQUAL:
+        case JOP_GREATER_THAN:
+        case JOP_GREATER_THAN_EQUAL:
+        case JOP_EQUALS:
+        case JOP_NOT_EQUALS:
+            jit_number(st, 0, B, i);
+            jit_number(st, 1, C, i);
+            switch (instr & 0x7F) {
+                default:
+                    jit_compare(st, JIT_CC_B, A);
+                    break;
+                case JOP_LESS_THAN_EQUAL:
+                    jit_compare(st, JIT_CC_BE, A);
+                    break;
+                case JOP_GREATER_THAN:
+                    jit_compare(st, JIT_CC_A, A);
+                    break;
+                case JOP_GREATER_THAN_EQUAL:
+                    jit_compare(st, JIT_CC_AE, A);
+                    break;
+                case JOP_EQUALS:
+                    jit_compare(st, JIT_CC_E, A);
+                    break;
+                case JOP_NOT_EQUALS:
+                    jit_compare(st, JIT_CC_NE, A);
+                    break;
+            }
+            break;
+        case JOP_LESS_THAN_IMMEDIATE:
+        case JOP_GREATER_THAN_IMMEDIATE:
+        case JOP_EQUALS_IMMEDIATE:
+        case JOP_NOT_EQUALS_IMMEDIATE: {
+            int cc;
+            switch (instr & 0x7F) {
+                default:
+                    cc = JIT_CC_B;
+                    break;
+                case JOP_GREATER_THAN_IMMEDIATE:
+                    cc = JIT_CC_A;
+                    break;
+                case JOP_EQUALS_IMMEDIATE:
+                    cc = JIT_CC_E;
+                    break;
+                case JOP_NOT_EQUALS_IMMEDIATE:
+                    cc = JIT_CC_NE;
+                    break;
+            }
+            jit_number(st, 0, B, i);
+            jit_number_imm(st, CS);
+            jit_compare(st, cc, A);
+            break;
+        }
+        case JOP_GET_INDEX: {
+            /* Arrays only, with a nil result past the end */
+            jit_array(st, B, i);
+            jit_bytes(st, "\x81\xB8", 2);
+            jit_u32(st, offsetof(JanetArray, count));
+            jit_u32(st, C);
+            int32_t past_end = jit_jump_local(st, JIT_CC_LE);
+            jit_bytes(st, "\x48\x8B\x80", 3);
+            jit_u32(st, offsetof(JanetArray, data));
+            jit_bytes(st, "\x48\x8B\x80", 3);
+            jit_u32(st, C * sizeof(Janet));
+            jit_store(st, JIT_RAX, A);
+            jit_jump(st, -1, i + 1, 0);
+            jit_here(st, past_end);
+            jit_store_value(st, A, janet_wrap_nil());
+            break;
+        }
+        case JOP_GET:
+            /* Arrays with an integer index in range only */
+            jit_array(st, B, i);
+            jit_number(st, 1, C, i);
+            jit_bytes(st, "\xF2\x0F\x2C\xC9", 4); /* cvttsd2si ecx, xmm1 */
+            jit_bytes(st, "\xF2\x0F\x2A\xD1", 4); /* cvtsi2sd xmm2, ecx */
+            jit_bytes(st, "\x66\x0F\x2E\xCA", 4); /* ucomisd xmm1, xmm2 */
+            jit_jump(st, JIT_CC_NE, i, 1);
+            jit_bytes(st, "\x85\xC9", 2); /* test ecx, ecx */
+            jit_jump(st, JIT_CC_S, i, 1);
+            jit_bytes(st, "\x3B\x88", 2); /* cmp ecx, [rax + count] */
+            jit_u32(st, offsetof(JanetArray, count));
+            jit_jump(st, JIT_CC_GE, i, 1);
+            jit_bytes(st, "\x48\x8B\x80", 3);
+            jit_u32(st, offsetof(JanetArray, data));
+            jit_bytes(st, "\x48\x8B\x04\xC8", 4); /* mov rax, [rax + 8 * rcx] */
+            jit_store(st, JIT_RAX, A);
+            break;
+    }
+    /* Fall through to the next instruction. The last instruction of a
+     * function always returns or jumps, so this is never past the end. */
+    return 1;
+}
+
+/* Count the instructions that compiled code would run when entered at index,
+ * up to JANET_JIT_MIN_RUN. Entering and leaving native code costs about as
+ * much as a few instructions in the interpreter, so short runs stay there. */
+static int32_t jit_run(JanetFuncDef *def, const uint8_t *ok, int32_t index) {
+    int32_t run = 0;
+    while (run < JANET_JIT_MIN_RUN && index >= 0 && index < def->bytecode_length && ok[index]) {
+        uint32_t instr = janet_unquicken(def->bytecode[index]);
+        run++;
+        index += ((instr & 0x7F) == JOP_JUMP) ? DS : 1;
+    }
+    return run;
+}
+
+/* Leave to the interpreter at instruction index */
+static void jit_exit(JitState *st, JanetFuncDef *def, int32_t index) {
+    st->exits[index] = janet_v_count(st->code);
+    jit_imm(st, JIT_RAX, (uint64_t)(uintptr_t)(def->bytecode + index));
+    jit_byte(st, 0xE9);
+    jit_u32(st, (uint32_t)(st->epilogue - (janet_v_count(st->code) + 4)));
+}
+
+/* Compile a function definition. Leaves def->jit NULL if the definition
+ * should stay in the interpreter. */
+void janet_jit_compile(JanetFuncDef *def) {
+    int32_t n = def->bytecode_length;
+    int32_t entries = 0;
+    def->jit_hotness = 0;
+    if (NULL != def->jit || n == 0) return;
+
+    /* Breakpoints must be seen by the interpreter */
+    for (int32_t i = 0; i < n; i++) {
+        if (def->bytecode[i] & 0x80) return;
+    }
+
+    JitState st;
+    st.code = NULL;
+    st.fixups = NULL;
+    st.blocks = janet_smalloc(sizeof(int32_t) * (size_t) n);
+    st.exits = janet_smalloc(sizeof(int32_t) * (size_t) n);
+    uint8_t *ok = janet_smalloc((size_t) n);
+    for (int32_t i = 0; i < n; i++) st.exits[i] = -1;
+
+    /* Entry: push rbx; mov rbx, rdi; jmp rsi */
+    jit_bytes(&st, "\x53\x48\x89\xFB\xFF\xE6", 6);
+    /* Epilogue: pop rbx; ret */
+    st.epilogue = janet_v_count(st.code);
+    jit_bytes(&st, "\x5B\xC3", 2);
+
+    for (int32_t i = 0; i < n; i++) {
+        st.blocks[i] = janet_v_count(st.code);
+        int32_t mark = janet_v_count(st.fixups);
+        ok[i] = (uint8_t) jit_instruction(&st, def, i);
+        if (!ok[i]) {
+            janet_v__cnt(st.code) = st.blocks[i];
+            if (NULL != st.fixups) janet_v__cnt(st.fixups) = mark;
+            jit_exit(&st, def, i);
+        }
+    }
+
+    /* Out of line exits for the slow paths */
+    for (int32_t i = 0; i < janet_v_count(st.fixups); i++) {
+        JitFixup f = st.fixups[i];
+        if (f.exit && st.exits[f.index] < 0) jit_exit(&st, def, f.index);
+    }
+    for (int32_t i = 0; i < janet_v_count(st.fixups); i++) {
+        JitFixup f = st.fixups[i];
+        jit_patch(&st, f.at, f.exit ? st.exits[f.index] : st.blocks[f.index]);
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        if (jit_run(def, ok, i) < JANET_JIT_MIN_RUN) {
+            st.blocks[i] = -1;
+        } else {
+            entries++;
+        }
+    }
+
+    if (entries > 0) {
+        size_t size = (size_t) janet_v_count(st.code);
+        void *code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        JanetJitCode *jit = janet_malloc(sizeof(JanetJitCode));
+        uint8_t **blocks = janet_malloc(sizeof(uint8_t *) * (size_t) n);
+        if (NULL == jit || NULL == blocks) {
+            JANET_OUT_OF_MEMORY;
+        }
+        if (code != MAP_FAILED) {
+            memcpy(code, st.code, size);
+            if (mprotect(code, size, PROT_READ | PROT_EXEC) == 0) {
+                for (int32_t i = 0; i < n; i++)
+                    blocks[i] = st.blocks[i] < 0 ? NULL : (uint8_t *) code + st.blocks[i];
+                jit->entry = (JanetJitEntry) code;
+                jit->blocks = blocks;
+                jit->code = code;
+                jit->size = size;
+                def->jit = jit;
+            } else {
+                munmap(code, size);
+            }
+        }
+        if (NULL == def->jit) {
+            janet_free(jit);
+            janet_free(blocks);
+        }
+    } else {
+        /* Nothing long enough to run natively, so do not try again for a
+         * long time. */
+        def->jit_hotness = INT32_MIN;
+    }
+
+    janet_v_free(st.code);
+    janet_v_free(st.fixups);
+    janet_sfree(st.blocks);
+    janet_sfree(st.exits);
+    janet_sfree(ok);
+}
+
+/* Drop the native code of a function definition */
+void janet_jit_discard(JanetFuncDef *def) {
+    JanetJitCode *jit = def->jit;
+    def->jit_hotness = 0;
+    if (NULL == jit) return;
+    def->jit = NULL;
+    munmap(jit->code, jit->size);
+    janet_free(jit->blocks);
+    janet_free(jit);
+}
+
+#undef A
+#undef B
+#undef C
+#undef D
+#undef E
+#undef CS
+#undef DS
+#undef ES
+
+#endif
@@ -256,8 +256,11 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     for (int32_t i = 0; i < def->constants_length; i++)
         marshal_one(st, def->constants[i], flags);
 
-    /* marshal the bytecode */
-    janet_marshal_u32s(st, def->bytecode, def->bytecode_length);
+    /* marshal the bytecode, without any quickened opcodes */
+    for (int32_t i = 0; i < def->bytecode_length; i++) {
+        uint32_t instr = janet_unquicken(def->bytecode[i]);
+        janet_marshal_u32s(st, &instr, 1);
+    }
 
     /* marshal the environments if needed */
     for (int32_t i = 0; i < def->environments_length; i++)
@@ -282,6 +285,11 @@ static void marshal_one_def(MarshalState *st, JanetFuncDef *def, int flags) {
     if (def->flags & JANET_FUNCDEF_FLAG_HASCLOBITSET) {
         janet_marshal_u32s(st, def->closure_bitset, ((def->slotcount + 31) >> 5));
     }
+
+    /* Marshal escape information, if needed */
+    if (def->flags & JANET_FUNCDEF_FLAG_HASNOESCAPE) {
+        pushint(st, (int32_t) def->noescape);
+    }
 }
 
 #define JANET_FIBER_FLAG_HASCHILD (1 << 29)
@@ -790,6 +798,15 @@ static const uint8_t *unmarshal_one_def(
         def->name = NULL;
         def->source = NULL;
         def->closure_bitset = NULL;
+        def->icache = NULL;
+        def->noescape = 0;
+#ifdef JANET_VM_COUNTERS
+        def->counters = NULL;
+#endif
+#ifdef JANET_JIT
+        def->jit = NULL;
+        def->jit_hotness = 0;
+#endif
         def->defs = NULL;
         def->environments = NULL;
         def->constants = NULL;
@@ -907,6 +924,11 @@ static const uint8_t *unmarshal_one_def(
             data = janet_unmarshal_u32s(st, data, def->closure_bitset, n);
         }
 
+        /* Unmarshal escape information if needed */
+        if (def->flags & JANET_FUNCDEF_FLAG_HASNOESCAPE) {
+            def->noescape = (uint32_t) readint(st, &data);
+        }
+
         /* Validate */
         if (janet_verify(def))
             janet_panic("funcdef has invalid bytecode");
@@ -935,6 +957,7 @@ static const uint8_t *unmarshal_one_fiber(
     fiber->data = NULL;
     fiber->child = NULL;
     fiber->env = NULL;
+    fiber->region = 0;
 #ifdef JANET_EV
     fiber->waiting = NULL;
     fiber->sched_id = 0;
@@ -961,10 +984,7 @@ static const uint8_t *unmarshal_one_fiber(
 
     /* Allocate stack memory */
     fiber->capacity = fiber_stacktop + 10;
-    fiber->data = janet_malloc(sizeof(Janet) * fiber->capacity);
-    if (!fiber->data) {
-        JANET_OUT_OF_MEMORY;
-    }
+    fiber->data = janet_gc_data_alloc(sizeof(Janet) * (size_t) fiber->capacity);
     for (int32_t i = 0; i < fiber->capacity; i++) {
         fiber->data[i] = janet_wrap_nil();
     }
@@ -0,0 +1,222 @@
+/*
+* Copyright (c) 2021 Calvin Rose
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this software and associated documentation files (the "Software"), to
+* deal in the Software without restriction, including without limitation the
+* rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+* sell copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in
+* all copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+* FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+* IN THE SOFTWARE.
+*/
+
+#ifndef JANET_AMALG
+#include "features.h"
+#include <janet.h>
+#include "gc.h"
+#include "state.h"
+#include "util.h"
+#include "vector.h"
+#endif
+
+#ifdef JANET_PROFILE
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+
+/* Sampling profiler. SIGPROF only counts ticks, as the signal can arrive
+ * anywhere, including in the middle of an allocation. The interpreter takes
+ * the pending ticks at its next safe point (calls, returns and backward
+ * jumps, the same places it checks for garbage collection) and charges them
+ * to the stack of the running fibers. Samples are kept as folded stacks,
+ * a string of frames from the root to the leaf joined by semicolons, mapped
+ * to the number of ticks they were seen with. */
+
+volatile sig_atomic_t janet_profile_ticks = 0;
+
+/* The interval timer is per process, so only one thread can profile at a time. */
+static volatile sig_atomic_t janet_profile_running = 0;
+static struct sigaction janet_profile_old_action;
+
+static void janet_profile_handler(int sig) {
+    (void) sig;
+    janet_profile_ticks++;
+}
+
+/* Append one stack frame to a folded stack */
+static void janet_profile_frame(JanetBuffer *buffer, JanetStackFrame *frame) {
+    if (buffer->count) janet_buffer_push_u8(buffer, ';');
+    if (frame->func) {
+        JanetFuncDef *def = frame->func->def;
+        janet_buffer_push_cstring(buffer, def->name ? (const char *) def->name : "<anonymous>");
+        if (def->source) {
+            janet_buffer_push_cstring(buffer, " [");
+            janet_buffer_push_string(buffer, def->source);
+            if (def->sourcemap && frame->pc) {
+                JanetSourceMapping mapping = def->sourcemap[frame->pc - def->bytecode];
+                janet_formatb(buffer, ":%d", mapping.line);
+            }
+            janet_buffer_push_u8(buffer, ']');
+        }
+    } else {
+        JanetCFunction cfun = (JanetCFunction)(frame->pc);
+        Janet name = cfun
+                     ? janet_table_get(janet_vm.registry, janet_wrap_cfunction(cfun))
+                     : janet_wrap_nil();
+        if (janet_checktype(name, JANET_NIL)) {
+            janet_buffer_push_cstring(buffer, "<cfunction>");
+        } else {
+            janet_buffer_push_string(buffer, janet_to_string(name));
+        }
+    }
+}
+
+/* Append all frames of a fiber to a folded stack, bottom frame first */
+static void janet_profile_fiber(JanetBuffer *buffer, JanetFiber *fiber) {
+    int32_t *frames = NULL;
+    int32_t i = fiber->frame;
+    while (i > 0) {
+        janet_v_push(frames, i);
+        i = ((JanetStackFrame *)(fiber->data + i - JANET_FRAME_SIZE))->prevframe;
+    }
+    for (int32_t j = janet_v_count(frames) - 1; j >= 0; j--) {
+        janet_profile_frame(buffer, (JanetStackFrame *)(fiber->data + frames[j] - JANET_FRAME_SIZE));
+    }
+    janet_v_free(frames);
+}
+
+/* Charge pending ticks to the current stack. Called by the interpreter with
+ * the program counter of the current frame committed. */
+void janet_profile_sample(void) {
+    int32_t ticks = (int32_t) janet_profile_ticks;
+    janet_profile_ticks = 0;
+    if (ticks <= 0 || NULL == janet_vm.fiber) return;
+    JanetBuffer buffer;
+    janet_buffer_init(&buffer, 128);
+    /* Fibers resumed from the interpreter are linked from the root fiber.
+     * Fibers resumed from C are not, so they are sampled on their own. */
+    JanetFiber *fiber = janet_vm.root_fiber;
+    while (NULL != fiber && fiber != janet_vm.fiber) fiber = fiber->child;
+    if (NULL != fiber) {
+        for (fiber = janet_vm.root_fiber; fiber != janet_vm.fiber; fiber = fiber->child) {
+            janet_profile_fiber(&buffer, fiber);
+        }
+    }
+    janet_profile_fiber(&buffer, janet_vm.fiber);
+    Janet key = janet_stringv(buffer.data, buffer.count);
+    janet_buffer_deinit(&buffer);
+    Janet count = janet_table_get(janet_vm.profile, key);
+    double old = janet_checktype(count, JANET_NUMBER) ? janet_unwrap_number(count) : 0.0;
+    janet_table_put(janet_vm.profile, key, janet_wrap_number(old + ticks));
+}
+
+static void janet_profile_timer(int32_t hz) {
+    struct itimerval timer;
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz ? 1000000 / hz : 0;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/* Stop the timer and drop the samples */
+static void janet_profile_end(void) {
+    janet_profile_timer(0);
+    sigaction(SIGPROF, &janet_profile_old_action, NULL);
+    janet_gcunroot(janet_wrap_table(janet_vm.profile));
+    janet_vm.profile = NULL;
+    janet_profile_ticks = 0;
+    janet_profile_running = 0;
+}
+
+void janet_profile_deinit(void) {
+    if (NULL != janet_vm.profile) janet_profile_end();
+}
+
+static Janet cfun_profile_start(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    int32_t hz = janet_optinteger(argv, argc, 0, 100);
+    if (hz < 1 || hz > 1000000) janet_panicf("expected sampling rate between 1 and 1000000, got %d", hz);
+    if (janet_profile_running) janet_panic("profiler already running");
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = janet_profile_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGPROF, &action, &janet_profile_old_action)) {
+        janet_panicf("could not install profiler: %s", strerror(errno));
+    }
+    janet_profile_running = 1;
+    janet_profile_ticks = 0;
+    janet_vm.profile = janet_table(0);
+    janet_gcroot(janet_wrap_table(janet_vm.profile));
+    janet_profile_timer(hz);
+    return janet_wrap_nil();
+}
+
+static Janet cfun_profile_stop(int32_t argc, Janet *argv) {
+    janet_arity(argc, 0, 1);
+    if (NULL == janet_vm.profile) janet_panic("profiler not running");
+    JanetBuffer *buffer = janet_optbuffer(argv, argc, 0, 0);
+    JanetTable *samples = janet_vm.profile;
+    janet_profile_end();
+    for (int32_t i = 0; i < samples->capacity; i++) {
+        const JanetKV *kv = samples->data + i;
+        if (!janet_checktype(kv->key, JANET_STRING)) continue;
+        janet_buffer_push_string(buffer, janet_unwrap_string(kv->key));
+        janet_formatb(buffer, " %d\n", (int32_t) janet_unwrap_number(kv->value));
+    }
+    return janet_wrap_buffer(buffer);
+}
+
+static Janet cfun_profile_samples(int32_t argc, Janet *argv) {
+    (void) argv;
+    janet_fixarity(argc, 0);
+    if (NULL == janet_vm.profile) return janet_wrap_nil();
+    return janet_wrap_table(janet_table_clone(janet_vm.profile));
+}
+
+static const JanetReg profile_cfuns[] = {
+    {
+        "profile/start", cfun_profile_start,
+        JDOC("(profile/start &opt hz)\n\n"
+             "Start the sampling profiler, which records the stack of the running fibers "
+             "`hz` times per second of CPU time used by the process. `hz` defaults to 100. "
+             "Only one thread can run the profiler at a time. Samples are taken at calls, returns "
+             "and loop iterations, so time spent in a C function is charged to the Janet code "
+             "around it. Returns nil.")
+    },
+    {
+        "profile/stop", cfun_profile_stop,
+        JDOC("(profile/stop &opt buf)\n\n"
+             "Stop the sampling profiler and write the samples to a buffer as folded stacks, "
+             "one line per distinct stack with its frames joined by semicolons followed by the "
+             "number of samples. This is the input format of flamegraph.pl and similar tools. "
+             "Returns the buffer.")
+    },
+    {
+        "profile/samples", cfun_profile_samples,
+        JDOC("(profile/samples)\n\n"
+             "Get the samples the running profiler has taken so far as a table from folded "
+             "stacks to sample counts, or nil if the profiler is not running.")
+    },
+    {NULL, NULL, NULL}
+};
+
+/* Module entry point */
+void janet_lib_profile(JanetTable *env) {
+    janet_core_cfuns(env, NULL, profile_cfuns);
+}
+
+#endif
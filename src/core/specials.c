@@ -592,10 +592,11 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
     JanetFopts subopts = janetc_fopts_default(c);
     JanetScope tempscope;
     int32_t labelwt, labeld, labeljt, labelc, i;
+    uint32_t *condcode = NULL;
+    JanetSourceMapping *condmap = NULL;
     int infinite = 0;
     int is_notnil_form = 0;
     uint8_t ifjmp = JOP_JUMP_IF;
-    uint8_t ifnjmp = JOP_JUMP_IF_NOT;
 
     if (argn < 2) {
         janetc_cerror(c, "expected at least 2 arguments");
@@ -613,7 +614,6 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
     if (janetc_check_notnil_form(condform, &condform)) {
         is_notnil_form = 1;
         ifjmp = JOP_JUMP_IF_NOT_NIL;
-        ifnjmp = JOP_JUMP_IF_NIL;
     }
 
     /* Compile condition */
@@ -633,10 +633,20 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
         infinite = 1;
     }
 
-    /* Infinite loop does not need to check condition */
-    labelc = infinite
-             ? 0
-             : janetc_emit_si(c, ifnjmp, cond, 0, 0);
+    /* Move the condition after the body, so that each iteration takes one
+     * conditional jump back to the top instead of a conditional jump out and
+     * a jump back. The loop is entered with a jump to the condition. An
+     * infinite loop does not need to check the condition. */
+    labeljt = labelwt;
+    if (!infinite) {
+        for (i = labelwt; i < janet_v_count(c->buffer); i++) {
+            janet_v_push(condcode, c->buffer[i]);
+            if (c->mapbuffer) janet_v_push(condmap, c->mapbuffer[i]);
+        }
+        if (c->buffer) janet_v__cnt(c->buffer) = labelwt;
+        if (c->mapbuffer) janet_v__cnt(c->mapbuffer) = labelwt;
+        janetc_emit(c, JOP_JUMP);
+    }
 
     /* Compile body */
     for (i = 1; i < argn; i++) {
@@ -647,6 +657,8 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
     /* Check if closure created in while scope. If so,
      * recompile in a function scope. */
     if (tempscope.flags & JANET_SCOPE_CLOSURE) {
+        janet_v_free(condcode);
+        janet_v_free(condmap);
         subopts = janetc_fopts_default(c);
         tempscope.flags |= JANET_SCOPE_UNUSED;
         janetc_popscope(c);
@@ -674,6 +686,7 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
         /* Compile function */
         JanetFuncDef *def = janetc_pop_funcdef(c);
         def->name = janet_cstring("_while");
+        janetc_analyze_escapes(def);
         janet_def_addflags(def);
         int32_t defindex = janetc_addfuncdef(c, def);
         /* And then load the closure and call it. */
@@ -685,14 +698,27 @@ static JanetSlot janetc_while(JanetFopts opts, int32_t argn, const Janet *argv)
         return janetc_cslot(janet_wrap_nil());
     }
 
-    /* Compile jump to :whiletop */
-    labeljt = janet_v_count(c->buffer);
-    janetc_emit(c, JOP_JUMP);
+    if (infinite) {
+        /* Compile jump to :whiletop */
+        labeljt = janet_v_count(c->buffer);
+        janetc_emit(c, JOP_JUMP);
+        c->buffer[labeljt] |= (uint32_t)(labelwt - labeljt) << 8;
+    } else {
+        /* Compile condition and jump to the body */
+        labelc = janet_v_count(c->buffer);
+        c->buffer[labeljt] |= (uint32_t)(labelc - labeljt) << 8;
+        for (i = 0; i < janet_v_count(condcode); i++) {
+            janet_v_push(c->buffer, condcode[i]);
+            if (c->mapbuffer) janet_v_push(c->mapbuffer, condmap[i]);
+        }
+        janet_v_free(condcode);
+        janet_v_free(condmap);
+        labelc = janetc_emit_si(c, ifjmp, cond, 0, 0);
+        c->buffer[labelc] |= (uint32_t)(labeljt + 1 - labelc) << 16;
+    }
 
     /* Calculate jumps */
     labeld = janet_v_count(c->buffer);
-    if (!infinite) c->buffer[labelc] |= (uint32_t)(labeld - labelc) << 16;
-    c->buffer[labeljt] |= (uint32_t)(labelwt - labeljt) << 8;
 
     /* Calculate breaks */
     for (int32_t i = labelwt; i < labeld; i++) {
@@ -849,6 +875,7 @@ static JanetSlot janetc_fn(JanetFopts opts, int32_t argn, const Janet *argv) {
     if (structarg) def->flags |= JANET_FUNCDEF_FLAG_STRUCTARG;
 
     if (selfref) def->name = janet_unwrap_symbol(head);
+    janetc_analyze_escapes(def);
     janet_def_addflags(def);
     defindex = janetc_addfuncdef(c, def);
 
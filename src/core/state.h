@@ -24,14 +24,36 @@
 #define JANET_STATE_H_defined
 
 #include <stdint.h>
+#ifdef JANET_PROFILE
+#include <signal.h>
+#endif
 
 typedef int64_t JanetTimestamp;
 
 typedef struct JanetScratch {
     JanetScratchFinalizer finalize;
+    size_t size;
     long long mem[]; /* for proper alignment */
 } JanetScratch;
 
+/* Free fiber stacks, one list per power of two capacity. See fiber.c */
+#define JANET_FIBER_POOL_BUCKETS 8
+
+/* Pages of equally sized gc objects, one pool per size class. See gc.c */
+#define JANET_GC_SIZE_CLASSES 16
+typedef struct JanetGCPage JanetGCPage;
+typedef struct {
+    JanetGCPage *pages;
+    JanetGCPage *available;
+    JanetGCPage *unswept; /* Left over from the last full collection */
+} JanetGCPool;
+
+/* Thread that runs finalizers for automatic collections. See gc.c */
+typedef struct JanetGCBackground JanetGCBackground;
+
+/* Samples of the heap profiler. See gc.c */
+typedef struct JanetGCProfile JanetGCProfile;
+
 typedef struct {
     JanetGCObject *self;
     JanetGCObject *other;
@@ -97,12 +119,51 @@ struct JanetVM {
     uint32_t cache_deleted;
     uint8_t gensym_counter[8];
 
-    /* Garbage collection */
+    /* Garbage collection. Small objects live in gc_pools, large objects in
+     * the blocks (young) and old_blocks lists. Old objects that may be
+     * mutated are also kept in the remembered set. While an incremental
+     * collection is marking, gc_grey holds marked but untraced objects.
+     * Dead objects that could not be finalized during a sweep yet are kept
+     * in gc_pending until the next collection. */
+    JanetGCPool gc_pools[JANET_GC_SIZE_CLASSES];
+    JanetGCPage *young_pages;
     void *blocks;
+    void *old_blocks;
+    JanetGCObject **remembered;
+    size_t remembered_count;
+    size_t remembered_capacity;
+    JanetGCObject **gc_grey;
+    size_t gc_grey_count;
+    size_t gc_grey_capacity;
+    JanetGCObject **gc_weak; /* Weak tables reached while marking */
+    size_t gc_weak_count;
+    size_t gc_weak_capacity;
+    JanetGCObject **gc_pending;
+    size_t gc_pending_count;
+    size_t gc_pending_capacity;
+    JanetGCBackground *gc_background;
+    size_t gc_unswept;
     size_t gc_interval;
+    size_t gc_trigger; /* Bytes to allocate before the next minor collection */
+    size_t gc_target;
+    size_t gc_limit;
+    size_t gc_live_bytes; /* Heap size after the last full collection */
+    size_t gc_data_bytes; /* Data owned by objects after the last full collection */
+    size_t gc_swept_data;
+    size_t gc_pause;
     size_t next_collection;
     size_t block_count;
+    size_t old_block_count;
+    size_t old_block_limit;
+    int gc_marking;
+    int gc_threads;
     int gc_suspend;
+    int gc_region;
+    int gc_region_base; /* Region depth when the current fiber was resumed */
+    size_t gc_region_bytes; /* Bytes allocated in regions since the last collection */
+    JanetGCStats gc_stats;
+    JanetGCProfile *gc_profile;
+    size_t gc_sample_left; /* Bytes to allocate before the next heap profile sample */
 
     /* GC roots */
     Janet *roots;
@@ -122,6 +183,28 @@ struct JanetVM {
     JanetTraversalNode *traversal_top;
     JanetTraversalNode *traversal_base;
 
+    /* Recycled fiber stacks */
+    Janet *fiber_pool[JANET_FIBER_POOL_BUCKETS];
+    size_t fiber_pool_bytes;
+
+    /* Execution counters. Function definitions with counters are kept in
+     * counted_defs so they can be reported and reset. pair_counts counts each
+     * opcode by the opcode executed before it, 128 by 128. */
+#ifdef JANET_VM_COUNTERS
+    int counting;
+    uint64_t op_counts[128];
+    uint64_t *pair_counts;
+    int32_t last_op;
+    JanetFuncDef **counted_defs;
+    size_t counted_count;
+    size_t counted_capacity;
+#endif
+
+    /* Samples of the sampling profiler while it runs on this thread */
+#ifdef JANET_PROFILE
+    JanetTable *profile;
+#endif
+
     /* Threading */
 #ifdef JANET_THREADS
     JanetMailbox *mailbox;
@@ -173,4 +256,10 @@ void janet_ev_init(void);
 void janet_ev_deinit(void);
 #endif
 
+#ifdef JANET_PROFILE
+extern volatile sig_atomic_t janet_profile_ticks;
+void janet_profile_sample(void);
+void janet_profile_deinit(void);
+#endif
+
 #endif /* JANET_STATE_H_defined */
@@ -172,8 +172,10 @@ const uint8_t *janet_symbol(const uint8_t *str, int32_t len) {
     uint8_t *newstr;
     int success = 0;
     const uint8_t **bucket = janet_symcache_findmem(str, len, hash, &success);
-    if (success)
+    if (success) {
+        janet_gc_revive(janet_string_head(*bucket));
         return *bucket;
+    }
     JanetStringHead *head = janet_gcalloc(JANET_MEMORY_SYMBOL, sizeof(JanetStringHead) + (size_t) len + 1);
     head->hash = hash;
     head->length = len;
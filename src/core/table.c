@@ -83,6 +83,14 @@ JanetTable *janet_table(int32_t capacity) {
     return janet_table_init_impl(table, capacity, 0);
 }
 
+/* Create a new weak table. flags is a combination of JANET_TABLE_FLAG_WEAK_K,
+ * JANET_TABLE_FLAG_WEAK_V and JANET_TABLE_FLAG_EPHEMERON. */
+JanetTable *janet_table_weak(int32_t capacity, int32_t flags) {
+    JanetTable *table = janet_table(capacity);
+    table->gc.flags |= flags & JANET_TABLE_FLAG_WEAK;
+    return table;
+}
+
 /* Find the bucket that contains the given key. Will also return
  * bucket where key should go if not in the table. */
 JanetKV *janet_table_find(JanetTable *t, Janet key) {
@@ -233,6 +241,7 @@ const JanetKV *janet_table_to_struct(JanetTable *t) {
 /* Clone a table. */
 JanetTable *janet_table_clone(JanetTable *table) {
     JanetTable *newTable = janet_gcalloc(JANET_MEMORY_TABLE, sizeof(JanetTable));
+    newTable->gc.flags |= table->gc.flags & JANET_TABLE_FLAG_WEAK;
     newTable->count = table->count;
     newTable->capacity = table->capacity;
     newTable->deleted = table->deleted;
@@ -274,6 +283,25 @@ static Janet cfun_table_new(int32_t argc, Janet *argv) {
     return janet_wrap_table(janet_table(cap));
 }
 
+static Janet cfun_table_weak(int32_t argc, Janet *argv) {
+    janet_arity(argc, 1, 2);
+    const uint8_t *kind = janet_getkeyword(argv, 0);
+    int32_t cap = janet_optinteger(argv, argc, 1, 0);
+    int32_t flags;
+    if (!janet_cstrcmp(kind, "keys")) {
+        flags = JANET_TABLE_FLAG_WEAK_K;
+    } else if (!janet_cstrcmp(kind, "values")) {
+        flags = JANET_TABLE_FLAG_WEAK_V;
+    } else if (!janet_cstrcmp(kind, "both")) {
+        flags = JANET_TABLE_FLAG_WEAK_K | JANET_TABLE_FLAG_WEAK_V;
+    } else if (!janet_cstrcmp(kind, "ephemeron")) {
+        flags = JANET_TABLE_FLAG_EPHEMERON;
+    } else {
+        janet_panicf("expected :keys, :values, :both or :ephemeron, got %v", argv[0]);
+    }
+    return janet_wrap_table(janet_table_weak(cap, flags));
+}
+
 static Janet cfun_table_getproto(int32_t argc, Janet *argv) {
     janet_fixarity(argc, 1);
     JanetTable *t = janet_gettable(argv, 0);
@@ -333,6 +361,21 @@ static const JanetReg table_cfuns[] = {
              "Convert a table to a struct. Returns a new struct. This function "
              "does not take into account prototype tables.")
     },
+    {
+        "table/weak", cfun_table_weak,
+        JDOC("(table/weak kind &opt capacity)\n\n"
+             "Creates a new empty table that does not keep some of its contents alive. "
+             "Entries are removed by the garbage collector once what they hold weakly "
+             "is no longer reachable from anywhere else. kind is one of:\n\n"
+             "* :keys - keys are weak and values are strong\n\n"
+             "* :values - values are weak and keys are strong\n\n"
+             "* :both - keys and values are weak\n\n"
+             "* :ephemeron - keys are weak, and each value is kept alive only while its key "
+             "is, even if the value refers back to the key\n\n"
+             "Numbers, booleans and other values that are not garbage collected are never "
+             "removed. Strings are looked up by contents, but an entry is only kept while "
+             "the string object used as its key is alive. Returns the new table.")
+    },
     {
         "table/getproto", cfun_table_getproto,
         JDOC("(table/getproto tab)\n\n"
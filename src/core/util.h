@@ -74,6 +74,38 @@ void janet_memempty(JanetKV *mem, int32_t count);
 void *janet_memalloc_empty(int32_t count);
 JanetTable *janet_get_core_table(const char *name);
 void janet_def_addflags(JanetFuncDef *def);
+uint32_t janet_unquicken(uint32_t instr);
+
+/* JIT */
+#ifdef JANET_JIT
+#ifndef JANET_JIT_HOT
+#define JANET_JIT_HOT 64
+#endif
+#ifndef JANET_JIT_MIN_RUN
+#define JANET_JIT_MIN_RUN 6
+#endif
+typedef uint32_t *(*JanetJitEntry)(Janet *stack, uint8_t *target);
+typedef struct JanetJitCode JanetJitCode;
+struct JanetJitCode {
+    JanetJitEntry entry;
+    uint8_t **blocks; /* Native code of each instruction */
+    void *code;
+    size_t size;
+};
+void janet_jit_compile(JanetFuncDef *def);
+void janet_jit_discard(JanetFuncDef *def);
+#endif
+#ifdef JANET_VM_COUNTERS
+void janet_counters_discard(JanetFuncDef *def);
+void janet_counters_reset(void);
+#endif
+#ifdef JANET_ASSEMBLER
+const char *janet_opcode_name(uint32_t opcode);
+#endif
+int32_t janet_wide_registers(uint32_t wide, uint32_t instr, int32_t *regs);
+uint32_t janet_unfuse(uint32_t instr);
+void janet_bytecode_optimize(JanetFuncDef *def);
+int janet_bytecode_rename(uint32_t *instr, const int32_t *map, int32_t count);
 const void *janet_strbinsearch(
     const void *tab,
     size_t tabcount,
@@ -142,6 +174,9 @@ void janet_lib_thread(JanetTable *env);
 void janet_lib_net(JanetTable *env);
 extern const JanetAbstractType janet_address_type;
 #endif
+#ifdef JANET_PROFILE
+void janet_lib_profile(JanetTable *env);
+#endif
 #ifdef JANET_EV
 void janet_lib_ev(JanetTable *env);
 void janet_ev_mark(void);
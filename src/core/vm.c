@@ -62,14 +62,14 @@
 #define VM_END() }
 #define VM_OP(op) label_##op :
 #define VM_DEFAULT() label_unknown_op:
-#define vm_next() goto *op_lookup[*pc & 0xFF]
+#define vm_next() vm_count(); goto *op_lookup[*pc & 0xFF]
 #define opcode (*pc & 0xFF)
 #else
 #define VM_START() uint8_t opcode = first_opcode; for (;;) {switch(opcode) {
 #define VM_END() }}
 #define VM_OP(op) case op :
 #define VM_DEFAULT() default:
-#define vm_next() opcode = *pc & 0xFF; continue
+#define vm_next() vm_count(); opcode = *pc & 0xFF; continue
 #endif
 
 /* Commit and restore VM state before possible longjmp */
@@ -89,13 +89,104 @@
     return (sig); \
 } while (0)
 
+/* Count every instruction executed while counters are on. See vm/counters. */
+#ifdef JANET_VM_COUNTERS
+static void vm_count_instruction(JanetFuncDef *def, const uint32_t *pc) {
+    if (NULL == def->counters) {
+        def->counters = janet_calloc(def->bytecode_length, sizeof(uint64_t));
+        if (NULL == def->counters) {
+            JANET_OUT_OF_MEMORY;
+        }
+        if (janet_vm.counted_count == janet_vm.counted_capacity) {
+            size_t newcap = 2 * janet_vm.counted_capacity + 16;
+            JanetFuncDef **newdefs = janet_realloc(janet_vm.counted_defs, newcap * sizeof(JanetFuncDef *));
+            if (NULL == newdefs) {
+                JANET_OUT_OF_MEMORY;
+            }
+            janet_vm.counted_defs = newdefs;
+            janet_vm.counted_capacity = newcap;
+        }
+        janet_vm.counted_defs[janet_vm.counted_count++] = def;
+    }
+    if (NULL == janet_vm.pair_counts) {
+        janet_vm.pair_counts = janet_calloc(128 * 128, sizeof(uint64_t));
+        if (NULL == janet_vm.pair_counts) {
+            JANET_OUT_OF_MEMORY;
+        }
+    }
+    int32_t op = *pc & 0x7F;
+    janet_vm.op_counts[op]++;
+    if (janet_vm.last_op >= 0) janet_vm.pair_counts[janet_vm.last_op * 128 + op]++;
+    janet_vm.last_op = op;
+    def->counters[pc - def->bytecode]++;
+}
+#define vm_counting() (janet_vm.counting)
+#define vm_count() do { if (janet_vm.counting) vm_count_instruction(func->def, pc); } while (0)
+#else
+#define vm_counting() 0
+#define vm_count() do { } while (0)
+#endif
+
+/* Take a profiler sample if the profiling timer fired since the last one */
+#ifdef JANET_PROFILE
+#define vm_profile() do { \
+    if (janet_profile_ticks && NULL != janet_vm.profile) { \
+        vm_commit(); \
+        janet_profile_sample(); \
+    } \
+} while (0)
+#else
+#define vm_profile() do { } while (0)
+#endif
+
 /* Next instruction variations */
 #define maybe_collect() do {\
-    if (janet_vm.next_collection >= janet_vm.gc_interval) janet_collect(); } while (0)
+    if (janet_vm.next_collection >= janet_vm.gc_trigger) janet_collect_minor(); \
+    vm_profile(); } while (0)
 #define vm_checkgc_next() maybe_collect(); vm_next()
 #define vm_pcnext() pc++; vm_next()
 #define vm_checkgc_pcnext() maybe_collect(); vm_pcnext()
 
+/* Enter native code at pc once a function definition is hot. It runs until an
+ * instruction that it leaves to the interpreter. This is done on calls,
+ * returns and backward jumps. */
+#ifdef JANET_JIT
+#define vm_jit() do { \
+    JanetFuncDef *_def = func->def; \
+    if (vm_counting()) { \
+        /* Native code is not counted */ \
+    } else if (NULL != _def->jit) { \
+        uint8_t *_target = _def->jit->blocks[pc - _def->bytecode]; \
+        if (NULL != _target) pc = _def->jit->entry(stack, _target); \
+    } else if (++_def->jit_hotness == JANET_JIT_HOT) { \
+        janet_jit_compile(_def); \
+    } \
+} while (0)
+#else
+#define vm_jit() do { } while (0)
+#endif
+#define vm_checkgc_jit_next() maybe_collect(); vm_jit(); vm_next()
+
+/* Superinstructions run the instruction after them as well, unless it has
+ * a breakpoint. Moves pc to that instruction. Macros that dispatch are plain
+ * blocks, since a do/while would catch the continue of switch dispatch. */
+#define vm_fused_next() { \
+    if (pc[1] & 0x80) { \
+        vm_pcnext(); \
+    } \
+    pc++; \
+}
+#define vm_checkgc_jit_pcnext() maybe_collect(); pc++; vm_jit(); vm_next()
+
+/* Take the conditional jump at pc. Loops test their condition at the bottom,
+ * so backward jumps count towards compiling the function like jmp does. */
+#define vm_jumpif_taken() { \
+    int32_t _offset = ES; \
+    pc += _offset; \
+    if (_offset < 0) vm_jit(); \
+    vm_next(); \
+}
+
 /* Handle certain errors in main vm loop */
 #define vm_throw(e) do { vm_commit(); janet_panic(e); } while (0)
 #define vm_assert(cond, e) do {if (!(cond)) vm_throw((e)); } while (0)
@@ -143,22 +234,25 @@
     }
 #define vm_bitop_immediate(op) _vm_bitop_immediate(op, int32_t);
 #define vm_bitopu_immediate(op) _vm_bitop_immediate(op, uint32_t);
-#define _vm_binop(op, wrap)\
+#define _vm_binop(op, wrap, hit, miss)\
     {\
         Janet op1 = stack[B];\
         Janet op2 = stack[C];\
         if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
             double x1 = janet_unwrap_number(op1);\
             double x2 = janet_unwrap_number(op2);\
+            hit;\
             stack[A] = wrap(x1 op x2);\
             vm_pcnext();\
         } else {\
+            miss;\
             vm_commit();\
             stack[A] = janet_binop_call(#op, "r" #op, op1, op2);\
             vm_checkgc_pcnext();\
         }\
     }
-#define vm_binop(op) _vm_binop(op, janet_wrap_number)
+#define vm_binop(op, qop) _vm_binop(op, janet_wrap_number, vm_quicken(qop), (void) 0)
+#define vm_binop_quick(op, gop) _vm_binop(op, janet_wrap_number, (void) 0, vm_deopt(gop))
 #define _vm_bitop(op, type1)\
     {\
         Janet op1 = stack[B];\
@@ -174,23 +268,44 @@
             vm_checkgc_pcnext();\
         }\
     }
+#define _vm_mathop(expr, lmethod, rmethod)\
+    {\
+        Janet op1 = stack[B];\
+        Janet op2 = stack[C];\
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
+            double x1 = janet_unwrap_number(op1);\
+            double x2 = janet_unwrap_number(op2);\
+            stack[A] = janet_wrap_number(expr);\
+            vm_pcnext();\
+        } else {\
+            vm_commit();\
+            stack[A] = janet_binop_call(lmethod, rmethod, op1, op2);\
+            vm_checkgc_pcnext();\
+        }\
+    }
+#define vm_modop() _vm_mathop(x1 - x2 * floor(x1 / x2), "mod", "rmod")
+#define vm_remop() _vm_mathop(fmod(x1, x2), "%", "r%")
 #define vm_bitop(op) _vm_bitop(op, int32_t)
 #define vm_bitopu(op) _vm_bitop(op, uint32_t)
-#define vm_compop(op) \
+#define _vm_compop(op, hit, miss) \
     {\
         Janet op1 = stack[B];\
         Janet op2 = stack[C];\
         if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {\
             double x1 = janet_unwrap_number(op1);\
             double x2 = janet_unwrap_number(op2);\
+            hit;\
             stack[A] = janet_wrap_boolean(x1 op x2);\
             vm_pcnext();\
         } else {\
+            miss;\
             vm_commit();\
             stack[A] = janet_wrap_boolean(janet_compare(op1, op2) op 0);\
             vm_checkgc_pcnext();\
         }\
     }
+#define vm_compop(op, qop) _vm_compop(op, vm_quicken(qop), (void) 0)
+#define vm_compop_quick(op, gop) _vm_compop(op, (void) 0, vm_deopt(gop))
 #define vm_compop_imm(op) \
     {\
         Janet op1 = stack[B];\
@@ -256,14 +371,143 @@ static Janet janet_method_invoke(Janet method, int32_t argc, Janet *argv) {
     }
 }
 
+/* Inline caches for keyword lookups in tables and structs
+ *
+ * Each instruction that looks up a key remembers the bucket where it last
+ * found a keyword. Keywords are interned, and a key stays in its bucket until
+ * the table is resized, so comparing the key in the remembered bucket is enough
+ * to validate a hit. Records built by the same code insert the same keys into
+ * tables of the same capacity, so they end up with the same layout and one
+ * cache serves all of them. Misses fall back to a normal probe of the table
+ * itself, and keys that are not found there to the generic lookup. */
+
+#define vm_icache_hit(kv, k) (janet_checktype((kv)->key, JANET_KEYWORD) && \
+    janet_unwrap_keyword((kv)->key) == janet_unwrap_keyword(k))
+
+/* An inline cache entry holds the bucket index in its low bits. The bit above
+ * them marks an instruction that should not be quickened again, and is kept
+ * when the bucket index is refilled. */
+#define JANET_ICACHE_INDEX 0x3FFFFFFF
+#define JANET_ICACHE_GENERIC 0x40000000
+#define vm_icache_index(def, pc) ((def)->icache[(pc) - (def)->bytecode] & JANET_ICACHE_INDEX)
+
+static int32_t *vm_icache_slot(JanetFuncDef *def, const uint32_t *pc) {
+    if (NULL == def->icache) {
+        def->icache = janet_malloc(sizeof(int32_t) * (size_t) def->bytecode_length);
+        if (NULL == def->icache) {
+            JANET_OUT_OF_MEMORY;
+        }
+        for (int32_t i = 0; i < def->bytecode_length; i++) {
+            def->icache[i] = JANET_ICACHE_INDEX;
+        }
+    }
+    return def->icache + (pc - def->bytecode);
+}
+
+/* Find the bucket of a keyword key in a table or struct through the inline
+ * cache of the instruction at pc. Returns NULL if the key is not a keyword, or
+ * is not in ds itself. */
+static JanetKV *vm_icache_find(JanetFuncDef *def, const uint32_t *pc, Janet ds, Janet key) {
+    JanetKV *data;
+    int32_t cap;
+    if (!janet_checktype(key, JANET_KEYWORD)) return NULL;
+    if (janet_checktype(ds, JANET_TABLE)) {
+        data = janet_unwrap_table(ds)->data;
+        cap = janet_unwrap_table(ds)->capacity;
+    } else if (janet_checktype(ds, JANET_STRUCT)) {
+        data = (JanetKV *) janet_unwrap_struct(ds);
+        cap = janet_struct_capacity(janet_unwrap_struct(ds));
+    } else {
+        return NULL;
+    }
+    if (NULL != def->icache) {
+        int32_t i = vm_icache_index(def, pc);
+        if (i < cap && vm_icache_hit(data + i, key)) return data + i;
+    }
+    if (0 == cap) return NULL;
+    JanetKV *kv = (JanetKV *) janet_dict_find(data, cap, key);
+    if (NULL == kv || janet_checktype(kv->key, JANET_NIL)) return NULL;
+    int32_t *slot = vm_icache_slot(def, pc);
+    *slot = (*slot & JANET_ICACHE_GENERIC) | (int32_t)(kv - data);
+    return kv;
+}
+
 /* Call a non function type from a JOP_CALL or JOP_TAILCALL instruction.
- * Assumes that the arguments are on the fiber stack. */
-static Janet call_nonfn(JanetFiber *fiber, Janet callee) {
+ * Assumes that the arguments are on the fiber stack. A table or struct called
+ * with a keyword goes through the inline cache of the call. */
+static Janet call_nonfn(JanetFiber *fiber, Janet callee, JanetFuncDef *def, const uint32_t *pc) {
     int32_t argc = fiber->stacktop - fiber->stackstart;
     fiber->stacktop = fiber->stackstart;
+    if (argc == 1) {
+        JanetKV *kv = vm_icache_find(def, pc, callee, fiber->data[fiber->stacktop]);
+        if (NULL != kv) return kv->value;
+    }
     return janet_method_invoke(callee, argc, fiber->data + fiber->stacktop);
 }
 
+/* Quickening
+ *
+ * A generic instruction that runs with the operand types it usually sees
+ * rewrites its own opcode into a variant that checks for those types only.
+ * A variant that later sees other types rewrites the instruction back to the
+ * generic opcode and marks it in the inline cache so that it stays generic.
+ * Quickened opcodes are private to the VM and live after the public ones,
+ * below the breakpoint bit. Anything that exposes bytecode outside of the VM,
+ * such as the marshaller and the disassembler, maps them back to their
+ * generic opcode with janet_unquicken. */
+
+enum JanetQuickOpCode {
+    JOP_ADD_NUMBER = JOP_INSTRUCTION_COUNT,
+    JOP_SUBTRACT_NUMBER,
+    JOP_MULTIPLY_NUMBER,
+    JOP_DIVIDE_NUMBER,
+    JOP_LESS_THAN_NUMBER,
+    JOP_LESS_THAN_EQUAL_NUMBER,
+    JOP_GREATER_THAN_NUMBER,
+    JOP_GREATER_THAN_EQUAL_NUMBER,
+    JOP_EQUALS_NUMBER,
+    JOP_NOT_EQUALS_NUMBER,
+    JOP_GET_ARRAY,
+    JOP_GET_TABLE,
+    JOP_GET_INDEX_ARRAY,
+    JOP_QUICK_COUNT
+};
+
+static const uint8_t janet_quick_generic[JOP_QUICK_COUNT - JOP_INSTRUCTION_COUNT] = {
+    JOP_ADD,
+    JOP_SUBTRACT,
+    JOP_MULTIPLY,
+    JOP_DIVIDE,
+    JOP_LESS_THAN,
+    JOP_LESS_THAN_EQUAL,
+    JOP_GREATER_THAN,
+    JOP_GREATER_THAN_EQUAL,
+    JOP_EQUALS,
+    JOP_NOT_EQUALS,
+    JOP_GET,
+    JOP_GET,
+    JOP_GET_INDEX
+};
+
+/* Rewrite the opcode at pc, keeping the breakpoint bit */
+#define vm_setop(op) (*pc = (*pc & ~((uint32_t) 0x7F)) | (uint32_t)(op))
+#define vm_quicken(qop) do { \
+    if (NULL == func->def->icache || \
+            !(func->def->icache[pc - func->def->bytecode] & JANET_ICACHE_GENERIC)) \
+        vm_setop(qop); \
+} while (0)
+#define vm_deopt(op) do { \
+    *vm_icache_slot(func->def, pc) |= JANET_ICACHE_GENERIC; \
+    vm_setop(op); \
+} while (0)
+
+/* Map a possibly quickened instruction back to its generic form */
+uint32_t janet_unquicken(uint32_t instr) {
+    uint32_t op = instr & 0x7F;
+    if (op < JOP_INSTRUCTION_COUNT || op >= JOP_QUICK_COUNT) return instr;
+    return (instr & ~((uint32_t) 0x7F)) | janet_quick_generic[op - JOP_INSTRUCTION_COUNT];
+}
+
 /* Method lookup could potentially handle tables specially... */
 static Janet method_to_fun(Janet method, Janet obj) {
     return janet_get(obj, method);
@@ -388,27 +632,26 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         &&label_JOP_NOT_EQUALS,
         &&label_JOP_NOT_EQUALS_IMMEDIATE,
         &&label_JOP_CANCEL,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
-        &&label_unknown_op,
+        &&label_JOP_LESS_THAN_JUMP_IF_NOT,
+        &&label_JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT,
+        &&label_JOP_WIDE,
+        &&label_JOP_LESS_THAN_JUMP_IF,
+        &&label_JOP_LESS_THAN_IMMEDIATE_JUMP_IF,
+        &&label_JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF,
+        &&label_JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF,
+        &&label_JOP_ADD_NUMBER,
+        &&label_JOP_SUBTRACT_NUMBER,
+        &&label_JOP_MULTIPLY_NUMBER,
+        &&label_JOP_DIVIDE_NUMBER,
+        &&label_JOP_LESS_THAN_NUMBER,
+        &&label_JOP_LESS_THAN_EQUAL_NUMBER,
+        &&label_JOP_GREATER_THAN_NUMBER,
+        &&label_JOP_GREATER_THAN_EQUAL_NUMBER,
+        &&label_JOP_EQUALS_NUMBER,
+        &&label_JOP_NOT_EQUALS_NUMBER,
+        &&label_JOP_GET_ARRAY,
+        &&label_JOP_GET_TABLE,
+        &&label_JOP_GET_INDEX_ARRAY,
         &&label_unknown_op,
         &&label_unknown_op,
         &&label_unknown_op,
@@ -605,7 +848,12 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         }
     }
 
-    if (!(fiber->flags & JANET_FIBER_RESUME_NO_USEVAL)) stack[A] = in;
+    if (!(fiber->flags & JANET_FIBER_RESUME_NO_USEVAL)) {
+        uint32_t dest = A;
+        /* The instruction may have a wide destination */
+        if (pc > func->def->bytecode && (pc[-1] & 0x7F) == JOP_WIDE) dest |= pc[-1] & 0xFF00;
+        stack[dest] = in;
+    }
     if (!(fiber->flags & JANET_FIBER_RESUME_NO_SKIP)) pc++;
 
     uint8_t first_opcode = *pc & ((fiber->flags & JANET_FIBER_BREAKPOINT) ? 0x7F : 0xFF);
@@ -614,6 +862,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
 
     /* Main interpreter loop. Semantically is a switch on
      * (*pc & 0xFF) inside of an infinite loop. */
+    vm_count();
     VM_START();
 
     VM_DEFAULT();
@@ -637,7 +886,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        vm_checkgc_jit_pcnext();
     }
 
     VM_OP(JOP_RETURN_NIL) {
@@ -647,60 +896,35 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         if (entrance_frame) vm_return_no_restore(JANET_SIGNAL_OK, retval);
         vm_restore();
         stack[A] = retval;
-        vm_checkgc_pcnext();
+        vm_checkgc_jit_pcnext();
     }
 
     VM_OP(JOP_ADD_IMMEDIATE)
     vm_binop_immediate(+);
 
     VM_OP(JOP_ADD)
-    vm_binop(+);
+    vm_binop(+, JOP_ADD_NUMBER);
 
     VM_OP(JOP_SUBTRACT)
-    vm_binop(-);
+    vm_binop(-, JOP_SUBTRACT_NUMBER);
 
     VM_OP(JOP_MULTIPLY_IMMEDIATE)
     vm_binop_immediate(*);
 
     VM_OP(JOP_MULTIPLY)
-    vm_binop(*);
+    vm_binop(*, JOP_MULTIPLY_NUMBER);
 
     VM_OP(JOP_DIVIDE_IMMEDIATE)
     vm_binop_immediate( /);
 
     VM_OP(JOP_DIVIDE)
-    vm_binop( /);
+    vm_binop( /, JOP_DIVIDE_NUMBER);
 
-    VM_OP(JOP_MODULO) {
-        Janet op1 = stack[B];
-        Janet op2 = stack[C];
-        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {
-            double x1 = janet_unwrap_number(op1);
-            double x2 = janet_unwrap_number(op2);
-            double intres = x2 * floor(x1 / x2);
-            stack[A] = janet_wrap_number(x1 - intres);
-            vm_pcnext();
-        } else {
-            vm_commit();
-            stack[A] = janet_binop_call("mod", "rmod", op1, op2);
-            vm_checkgc_pcnext();
-        }
-    }
+    VM_OP(JOP_MODULO)
+    vm_modop();
 
-    VM_OP(JOP_REMAINDER) {
-        Janet op1 = stack[B];
-        Janet op2 = stack[C];
-        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {
-            double x1 = janet_unwrap_number(op1);
-            double x2 = janet_unwrap_number(op2);
-            stack[A] = janet_wrap_number(fmod(x1, x2));
-            vm_pcnext();
-        } else {
-            vm_commit();
-            stack[A] = janet_binop_call("%", "r%", op1, op2);
-            vm_checkgc_pcnext();
-        }
-    }
+    VM_OP(JOP_REMAINDER)
+    vm_remop();
 
     VM_OP(JOP_BAND)
     vm_bitop(&);
@@ -745,60 +969,166 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_pcnext();
 
     VM_OP(JOP_JUMP)
+    if (DS < 0) {
+        pc += DS;
+        vm_jit();
+        vm_next();
+    }
     pc += DS;
     vm_next();
 
     VM_OP(JOP_JUMP_IF)
-    if (janet_truthy(stack[A])) {
-        pc += ES;
-    } else {
-        pc++;
+    if (!janet_truthy(stack[A])) {
+        vm_pcnext();
     }
-    vm_next();
+    vm_jumpif_taken();
 
     VM_OP(JOP_JUMP_IF_NOT)
     if (janet_truthy(stack[A])) {
-        pc++;
-    } else {
-        pc += ES;
+        vm_pcnext();
     }
-    vm_next();
+    vm_jumpif_taken();
 
     VM_OP(JOP_JUMP_IF_NIL)
-    if (janet_checktype(stack[A], JANET_NIL)) {
-        pc += ES;
-    } else {
-        pc++;
+    if (!janet_checktype(stack[A], JANET_NIL)) {
+        vm_pcnext();
     }
-    vm_next();
+    vm_jumpif_taken();
 
     VM_OP(JOP_JUMP_IF_NOT_NIL)
     if (janet_checktype(stack[A], JANET_NIL)) {
-        pc++;
-    } else {
-        pc += ES;
+        vm_pcnext();
     }
-    vm_next();
+    vm_jumpif_taken();
 
     VM_OP(JOP_LESS_THAN)
-    vm_compop( <);
+    vm_compop( <, JOP_LESS_THAN_NUMBER);
 
     VM_OP(JOP_LESS_THAN_EQUAL)
-    vm_compop( <=);
+    vm_compop( <=, JOP_LESS_THAN_EQUAL_NUMBER);
 
     VM_OP(JOP_LESS_THAN_IMMEDIATE)
     vm_compop_imm( <);
 
     VM_OP(JOP_GREATER_THAN)
-    vm_compop( >);
+    vm_compop( >, JOP_GREATER_THAN_NUMBER);
 
     VM_OP(JOP_GREATER_THAN_EQUAL)
-    vm_compop( >=);
+    vm_compop( >=, JOP_GREATER_THAN_EQUAL_NUMBER);
 
     VM_OP(JOP_GREATER_THAN_IMMEDIATE)
     vm_compop_imm( >);
 
+    VM_OP(JOP_LESS_THAN_JUMP_IF_NOT) {
+        Janet op1 = stack[B];
+        Janet op2 = stack[C];
+        int lt;
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {
+            lt = janet_unwrap_number(op1) < janet_unwrap_number(op2);
+        } else {
+            vm_commit();
+            lt = janet_compare(op1, op2) < 0;
+            maybe_collect();
+        }
+        stack[A] = janet_wrap_boolean(lt);
+        vm_fused_next();
+        if (lt) {
+            vm_pcnext();
+        }
+        pc += ES;
+        vm_next();
+    }
+
+    VM_OP(JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT) {
+        Janet op1 = stack[B];
+        int lt;
+        if (janet_checktype(op1, JANET_NUMBER)) {
+            lt = janet_unwrap_number(op1) < (double) CS;
+        } else {
+            vm_commit();
+            lt = janet_compare(op1, janet_wrap_integer(CS)) < 0;
+            maybe_collect();
+        }
+        stack[A] = janet_wrap_boolean(lt);
+        vm_fused_next();
+        if (lt) {
+            vm_pcnext();
+        }
+        pc += ES;
+        vm_next();
+    }
+
+    VM_OP(JOP_LESS_THAN_JUMP_IF) {
+        Janet op1 = stack[B];
+        Janet op2 = stack[C];
+        int lt;
+        if (janet_checktype(op1, JANET_NUMBER) && janet_checktype(op2, JANET_NUMBER)) {
+            lt = janet_unwrap_number(op1) < janet_unwrap_number(op2);
+        } else {
+            vm_commit();
+            lt = janet_compare(op1, op2) < 0;
+            maybe_collect();
+        }
+        stack[A] = janet_wrap_boolean(lt);
+        vm_fused_next();
+        if (!lt) {
+            vm_pcnext();
+        }
+        vm_jumpif_taken();
+    }
+
+    VM_OP(JOP_LESS_THAN_IMMEDIATE_JUMP_IF) {
+        Janet op1 = stack[B];
+        int lt;
+        if (janet_checktype(op1, JANET_NUMBER)) {
+            lt = janet_unwrap_number(op1) < (double) CS;
+        } else {
+            vm_commit();
+            lt = janet_compare(op1, janet_wrap_integer(CS)) < 0;
+            maybe_collect();
+        }
+        stack[A] = janet_wrap_boolean(lt);
+        vm_fused_next();
+        if (!lt) {
+            vm_pcnext();
+        }
+        vm_jumpif_taken();
+    }
+
+    /* Latch of a counting loop. Adds the immediate, compares the result with
+     * the limit in the next instruction and takes the jmpif after that, with
+     * one check that both are numbers. Anything else runs the addim on its
+     * own and leaves the rest to the next instructions. */
+    VM_OP(JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF)
+    VM_OP(JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF) {
+        Janet op1 = stack[B];
+        if (!janet_checktype(op1, JANET_NUMBER) || ((pc[1] | pc[2]) & 0x80)) {
+            vm_binop_immediate(+);
+        }
+        double x = janet_unwrap_number(op1) + CS;
+        stack[A] = janet_wrap_number(x);
+        double limit;
+        if ((*pc & 0x7F) == JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF) {
+            Janet op2 = stack[pc[1] >> 24];
+            if (!janet_checktype(op2, JANET_NUMBER)) {
+                vm_pcnext();
+            }
+            limit = janet_unwrap_number(op2);
+        } else {
+            limit = (double)(*((int32_t *)pc + 1) >> 24);
+        }
+        int lt = x < limit;
+        stack[(pc[1] >> 8) & 0xFF] = janet_wrap_boolean(lt);
+        pc += 2;
+        if (!lt) {
+            vm_pcnext();
+        }
+        vm_jumpif_taken();
+    }
+
     VM_OP(JOP_EQUALS)
+    if (janet_checktype(stack[B], JANET_NUMBER) && janet_checktype(stack[C], JANET_NUMBER))
+        vm_quicken(JOP_EQUALS_NUMBER);
     stack[A] = janet_wrap_boolean(janet_equals(stack[B], stack[C]));
     vm_pcnext();
 
@@ -807,6 +1137,8 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_pcnext();
 
     VM_OP(JOP_NOT_EQUALS)
+    if (janet_checktype(stack[B], JANET_NUMBER) && janet_checktype(stack[C], JANET_NUMBER))
+        vm_quicken(JOP_NOT_EQUALS_NUMBER);
     stack[A] = janet_wrap_boolean(!janet_equals(stack[B], stack[C]));
     vm_pcnext();
 
@@ -896,6 +1228,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         vm_assert(defindex < func->def->defs_length, "invalid funcdef");
         fd = func->def->defs[defindex];
         elen = fd->environments_length;
+        vm_commit();
         fn = janet_gcalloc(JANET_MEMORY_FUNCTION, sizeof(JanetFunction) + ((size_t) elen * sizeof(JanetFuncEnv *)));
         fn->def = fd;
         {
@@ -971,7 +1304,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             }
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
-            vm_checkgc_next();
+            vm_checkgc_jit_next();
         } else if (janet_checktype(callee, JANET_CFUNCTION)) {
             vm_commit();
             int32_t argc = fiber->stacktop - fiber->stackstart;
@@ -980,10 +1313,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             janet_fiber_popframe(fiber);
             stack = fiber->data + fiber->frame;
             stack[A] = ret;
-            vm_checkgc_pcnext();
+            vm_checkgc_jit_pcnext();
         } else {
             vm_commit();
-            stack[A] = call_nonfn(fiber, callee);
+            stack[A] = call_nonfn(fiber, callee, func->def, pc);
             vm_pcnext();
         }
     }
@@ -1010,7 +1343,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
             }
             stack = fiber->data + fiber->frame;
             pc = func->def->bytecode;
-            vm_checkgc_next();
+            vm_checkgc_jit_next();
         } else {
             Janet retreg;
             int entrance_frame = janet_stack_frame(stack)->flags & JANET_STACKFRAME_ENTRANCE;
@@ -1021,7 +1354,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
                 retreg = janet_unwrap_cfunction(callee)(argc, fiber->data + fiber->frame);
                 janet_fiber_popframe(fiber);
             } else {
-                retreg = call_nonfn(fiber, callee);
+                retreg = call_nonfn(fiber, callee, func->def, pc);
             }
             janet_fiber_popframe(fiber);
             if (entrance_frame) {
@@ -1092,12 +1425,20 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         vm_checkgc_pcnext();
     }
 
-    VM_OP(JOP_PUT)
-    vm_commit();
-    fiber->flags |= JANET_FIBER_RESUME_NO_USEVAL;
-    janet_put(stack[A], stack[B], stack[C]);
-    fiber->flags &= ~JANET_FIBER_RESUME_NO_USEVAL;
-    vm_checkgc_pcnext();
+    VM_OP(JOP_PUT) {
+        if (janet_checktype(stack[A], JANET_TABLE) && !janet_checktype(stack[C], JANET_NIL)) {
+            JanetKV *kv = vm_icache_find(func->def, pc, stack[A], stack[B]);
+            if (NULL != kv) {
+                kv->value = stack[C];
+                vm_pcnext();
+            }
+        }
+        vm_commit();
+        fiber->flags |= JANET_FIBER_RESUME_NO_USEVAL;
+        janet_put(stack[A], stack[B], stack[C]);
+        fiber->flags &= ~JANET_FIBER_RESUME_NO_USEVAL;
+        vm_checkgc_pcnext();
+    }
 
     VM_OP(JOP_PUT_INDEX)
     vm_commit();
@@ -1106,17 +1447,33 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     fiber->flags &= ~JANET_FIBER_RESUME_NO_USEVAL;
     vm_checkgc_pcnext();
 
-    VM_OP(JOP_IN)
-    vm_commit();
-    stack[A] = janet_in(stack[B], stack[C]);
-    vm_pcnext();
+    VM_OP(JOP_IN) {
+        JanetKV *kv = vm_icache_find(func->def, pc, stack[B], stack[C]);
+        if (NULL != kv) {
+            stack[A] = kv->value;
+            vm_pcnext();
+        }
+        vm_commit();
+        stack[A] = janet_in(stack[B], stack[C]);
+        vm_pcnext();
+    }
 
-    VM_OP(JOP_GET)
-    vm_commit();
-    stack[A] = janet_get(stack[B], stack[C]);
-    vm_pcnext();
+    VM_OP(JOP_GET) {
+        JanetKV *kv = vm_icache_find(func->def, pc, stack[B], stack[C]);
+        if (NULL != kv) {
+            if (janet_checktype(stack[B], JANET_TABLE)) vm_quicken(JOP_GET_TABLE);
+            stack[A] = kv->value;
+            vm_pcnext();
+        }
+        if (janet_checktype(stack[B], JANET_ARRAY) && janet_checktype(stack[C], JANET_NUMBER))
+            vm_quicken(JOP_GET_ARRAY);
+        vm_commit();
+        stack[A] = janet_get(stack[B], stack[C]);
+        vm_pcnext();
+    }
 
     VM_OP(JOP_GET_INDEX)
+    if (janet_checktype(stack[B], JANET_ARRAY)) vm_quicken(JOP_GET_INDEX_ARRAY);
     vm_commit();
     stack[A] = janet_getindex(stack[B], C);
     vm_pcnext();
@@ -1127,6 +1484,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     vm_pcnext();
 
     VM_OP(JOP_MAKE_ARRAY) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         stack[D] = janet_wrap_array(janet_array_n(mem, count));
@@ -1137,6 +1495,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     VM_OP(JOP_MAKE_TUPLE)
     /* fallthrough */
     VM_OP(JOP_MAKE_BRACKET_TUPLE) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         const Janet *tup = janet_tuple_n(mem, count);
@@ -1148,10 +1507,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_TABLE) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         if (count & 1) {
-            vm_commit();
             janet_panicf("expected even number of arguments to table constructor, got %d", count);
         }
         JanetTable *table = janet_table(count / 2);
@@ -1163,10 +1522,10 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_STRUCT) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         if (count & 1) {
-            vm_commit();
             janet_panicf("expected even number of arguments to struct constructor, got %d", count);
         }
         JanetKV *st = janet_struct_begin(count / 2);
@@ -1178,6 +1537,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_STRING) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         JanetBuffer buffer;
@@ -1191,6 +1551,7 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
     }
 
     VM_OP(JOP_MAKE_BUFFER) {
+        vm_commit();
         int32_t count = fiber->stacktop - fiber->stackstart;
         Janet *mem = fiber->data + fiber->stackstart;
         JanetBuffer *buffer = janet_buffer(10 * count);
@@ -1201,6 +1562,268 @@ static JanetSignal run_vm(JanetFiber *fiber, Janet in) {
         vm_checkgc_pcnext();
     }
 
+    /* The prefix holds the high bytes of the registers of the next
+     * instruction, which runs here with its operands widened. The pair runs
+     * as a single instruction, so the second one is never quickened and can
+     * not have a breakpoint of its own. */
+    VM_OP(JOP_WIDE) {
+        uint32_t wide = *pc++;
+#undef A
+#undef B
+#undef C
+#define A (((*pc >> 8) & 0xFF) | (wide & 0xFF00))
+#define B (((*pc >> 16) & 0xFF) | ((wide >> 8) & 0xFF00))
+#define C ((*pc >> 24) | ((wide >> 16) & 0xFF00))
+        switch (*pc & 0x7F) {
+            default:
+                vm_throw("invalid wide instruction");
+            case JOP_ADD:
+                _vm_binop(+, janet_wrap_number, (void) 0, (void) 0);
+            case JOP_SUBTRACT:
+                _vm_binop(-, janet_wrap_number, (void) 0, (void) 0);
+            case JOP_MULTIPLY:
+                _vm_binop(*, janet_wrap_number, (void) 0, (void) 0);
+            case JOP_DIVIDE:
+                _vm_binop( /, janet_wrap_number, (void) 0, (void) 0);
+            case JOP_MODULO:
+                vm_modop();
+            case JOP_REMAINDER:
+                vm_remop();
+            case JOP_BAND:
+                vm_bitop(&);
+            case JOP_BOR:
+                vm_bitop( |);
+            case JOP_BXOR:
+                vm_bitop(^);
+            case JOP_SHIFT_LEFT:
+                vm_bitop( <<);
+            case JOP_SHIFT_RIGHT:
+                vm_bitop( >>);
+            case JOP_SHIFT_RIGHT_UNSIGNED:
+                vm_bitopu( >>);
+            case JOP_LESS_THAN:
+                _vm_compop( <, (void) 0, (void) 0);
+            case JOP_LESS_THAN_EQUAL:
+                _vm_compop( <=, (void) 0, (void) 0);
+            case JOP_GREATER_THAN:
+                _vm_compop( >, (void) 0, (void) 0);
+            case JOP_GREATER_THAN_EQUAL:
+                _vm_compop( >=, (void) 0, (void) 0);
+            case JOP_EQUALS:
+                stack[A] = janet_wrap_boolean(janet_equals(stack[B], stack[C]));
+                vm_pcnext();
+            case JOP_NOT_EQUALS:
+                stack[A] = janet_wrap_boolean(!janet_equals(stack[B], stack[C]));
+                vm_pcnext();
+            case JOP_COMPARE:
+                stack[A] = janet_wrap_integer(janet_compare(stack[B], stack[C]));
+                vm_pcnext();
+            case JOP_ADD_IMMEDIATE:
+                vm_binop_immediate(+);
+            case JOP_MULTIPLY_IMMEDIATE:
+                vm_binop_immediate(*);
+            case JOP_DIVIDE_IMMEDIATE:
+                vm_binop_immediate( /);
+            case JOP_SHIFT_LEFT_IMMEDIATE:
+                vm_bitop_immediate( <<);
+            case JOP_SHIFT_RIGHT_IMMEDIATE:
+                vm_bitop_immediate( >>);
+            case JOP_SHIFT_RIGHT_UNSIGNED_IMMEDIATE:
+                vm_bitopu_immediate( >>);
+            case JOP_LESS_THAN_IMMEDIATE:
+                vm_compop_imm( <);
+            case JOP_GREATER_THAN_IMMEDIATE:
+                vm_compop_imm( >);
+            case JOP_EQUALS_IMMEDIATE:
+                stack[A] = janet_wrap_boolean(janet_unwrap_number(stack[B]) == (double) CS);
+                vm_pcnext();
+            case JOP_NOT_EQUALS_IMMEDIATE:
+                stack[A] = janet_wrap_boolean(janet_unwrap_number(stack[B]) != (double) CS);
+                vm_pcnext();
+            case JOP_IN: {
+                JanetKV *kv = vm_icache_find(func->def, pc, stack[B], stack[C]);
+                if (NULL != kv) {
+                    stack[A] = kv->value;
+                    vm_pcnext();
+                }
+                vm_commit();
+                stack[A] = janet_in(stack[B], stack[C]);
+                vm_pcnext();
+            }
+            case JOP_GET: {
+                JanetKV *kv = vm_icache_find(func->def, pc, stack[B], stack[C]);
+                if (NULL != kv) {
+                    stack[A] = kv->value;
+                    vm_pcnext();
+                }
+                vm_commit();
+                stack[A] = janet_get(stack[B], stack[C]);
+                vm_pcnext();
+            }
+            case JOP_PUT:
+                vm_commit();
+                fiber->flags |= JANET_FIBER_RESUME_NO_USEVAL;
+                janet_put(stack[A], stack[B], stack[C]);
+                fiber->flags &= ~JANET_FIBER_RESUME_NO_USEVAL;
+                vm_checkgc_pcnext();
+            case JOP_GET_INDEX:
+                vm_commit();
+                stack[A] = janet_getindex(stack[B], *pc >> 24);
+                vm_pcnext();
+            case JOP_PUT_INDEX:
+                vm_commit();
+                fiber->flags |= JANET_FIBER_RESUME_NO_USEVAL;
+                janet_putindex(stack[A], *pc >> 24, stack[B]);
+                fiber->flags &= ~JANET_FIBER_RESUME_NO_USEVAL;
+                vm_checkgc_pcnext();
+            case JOP_NEXT: {
+                vm_commit();
+                Janet temp = janet_next_impl(stack[B], stack[C], 1);
+                vm_restore();
+                stack[A] = temp;
+                vm_pcnext();
+            }
+            case JOP_MOVE_NEAR:
+                stack[A] = stack[E];
+                vm_pcnext();
+            case JOP_MOVE_FAR:
+                stack[E] = stack[A];
+                vm_pcnext();
+            case JOP_BNOT: {
+                Janet op = stack[E];
+                vm_assert_type(op, JANET_NUMBER);
+                stack[A] = janet_wrap_integer(~janet_unwrap_integer(op));
+                vm_pcnext();
+            }
+            case JOP_LENGTH:
+                vm_commit();
+                stack[A] = janet_lengthv(stack[E]);
+                vm_pcnext();
+            case JOP_LOAD_INTEGER:
+                stack[A] = janet_wrap_integer(ES);
+                vm_pcnext();
+            case JOP_LOAD_CONSTANT: {
+                int32_t cindex = (int32_t)E;
+                vm_assert(cindex < func->def->constants_length, "invalid constant");
+                stack[A] = func->def->constants[cindex];
+                vm_pcnext();
+            }
+            case JOP_TYPECHECK:
+                vm_assert_types(stack[A], E);
+                vm_pcnext();
+            case JOP_JUMP_IF:
+                pc += janet_truthy(stack[A]) ? ES : 1;
+                vm_next();
+            case JOP_JUMP_IF_NOT:
+                pc += janet_truthy(stack[A]) ? 1 : ES;
+                vm_next();
+            case JOP_JUMP_IF_NIL:
+                pc += janet_checktype(stack[A], JANET_NIL) ? ES : 1;
+                vm_next();
+            case JOP_JUMP_IF_NOT_NIL:
+                pc += janet_checktype(stack[A], JANET_NIL) ? 1 : ES;
+                vm_next();
+        }
+#undef A
+#undef B
+#undef C
+#define A ((*pc >> 8)  & 0xFF)
+#define B ((*pc >> 16) & 0xFF)
+#define C (*pc >> 24)
+    }
+
+    /* Quickened instructions */
+
+    VM_OP(JOP_ADD_NUMBER)
+    vm_binop_quick(+, JOP_ADD);
+
+    VM_OP(JOP_SUBTRACT_NUMBER)
+    vm_binop_quick(-, JOP_SUBTRACT);
+
+    VM_OP(JOP_MULTIPLY_NUMBER)
+    vm_binop_quick(*, JOP_MULTIPLY);
+
+    VM_OP(JOP_DIVIDE_NUMBER)
+    vm_binop_quick( /, JOP_DIVIDE);
+
+    VM_OP(JOP_LESS_THAN_NUMBER)
+    vm_compop_quick( <, JOP_LESS_THAN);
+
+    VM_OP(JOP_LESS_THAN_EQUAL_NUMBER)
+    vm_compop_quick( <=, JOP_LESS_THAN_EQUAL);
+
+    VM_OP(JOP_GREATER_THAN_NUMBER)
+    vm_compop_quick( >, JOP_GREATER_THAN);
+
+    VM_OP(JOP_GREATER_THAN_EQUAL_NUMBER)
+    vm_compop_quick( >=, JOP_GREATER_THAN_EQUAL);
+
+    VM_OP(JOP_EQUALS_NUMBER)
+    if (janet_checktype(stack[B], JANET_NUMBER) && janet_checktype(stack[C], JANET_NUMBER)) {
+        stack[A] = janet_wrap_boolean(janet_unwrap_number(stack[B]) == janet_unwrap_number(stack[C]));
+        vm_pcnext();
+    }
+    vm_deopt(JOP_EQUALS);
+    stack[A] = janet_wrap_boolean(janet_equals(stack[B], stack[C]));
+    vm_pcnext();
+
+    VM_OP(JOP_NOT_EQUALS_NUMBER)
+    if (janet_checktype(stack[B], JANET_NUMBER) && janet_checktype(stack[C], JANET_NUMBER)) {
+        stack[A] = janet_wrap_boolean(janet_unwrap_number(stack[B]) != janet_unwrap_number(stack[C]));
+        vm_pcnext();
+    }
+    vm_deopt(JOP_NOT_EQUALS);
+    stack[A] = janet_wrap_boolean(!janet_equals(stack[B], stack[C]));
+    vm_pcnext();
+
+    VM_OP(JOP_GET_ARRAY) {
+        if (janet_checktype(stack[B], JANET_ARRAY) && janet_checktype(stack[C], JANET_NUMBER)) {
+            JanetArray *array = janet_unwrap_array(stack[B]);
+            double index = janet_unwrap_number(stack[C]);
+            if (index >= 0 && index < array->count && index == (int32_t) index) {
+                stack[A] = array->data[(int32_t) index];
+                vm_pcnext();
+            }
+        } else {
+            vm_deopt(JOP_GET);
+        }
+        vm_commit();
+        stack[A] = janet_get(stack[B], stack[C]);
+        vm_pcnext();
+    }
+
+    VM_OP(JOP_GET_TABLE) {
+        if (janet_checktype(stack[B], JANET_TABLE) && janet_checktype(stack[C], JANET_KEYWORD)) {
+            JanetTable *table = janet_unwrap_table(stack[B]);
+            int32_t i = vm_icache_index(func->def, pc);
+            if (i < table->capacity && vm_icache_hit(table->data + i, stack[C])) {
+                stack[A] = table->data[i].value;
+                vm_pcnext();
+            }
+            JanetKV *kv = vm_icache_find(func->def, pc, stack[B], stack[C]);
+            if (NULL != kv) {
+                stack[A] = kv->value;
+                vm_pcnext();
+            }
+        } else {
+            vm_deopt(JOP_GET);
+        }
+        vm_commit();
+        stack[A] = janet_get(stack[B], stack[C]);
+        vm_pcnext();
+    }
+
+    VM_OP(JOP_GET_INDEX_ARRAY)
+    if (janet_checktype(stack[B], JANET_ARRAY)) {
+        JanetArray *array = janet_unwrap_array(stack[B]);
+        stack[A] = (int32_t) C < array->count ? array->data[C] : janet_wrap_nil();
+        vm_pcnext();
+    }
+    vm_deopt(JOP_GET_INDEX);
+    vm_commit();
+    stack[A] = janet_getindex(stack[B], C);
+    vm_pcnext();
+
     VM_END()
 }
 
@@ -1226,6 +1849,14 @@ JanetSignal janet_step(JanetFiber *fiber, Janet in, Janet *out) {
      * but for branching instructions it is also the target of the branch. */
     uint32_t *nexta = NULL, *nextb = NULL, olda = 0, oldb = 0;
 
+#ifdef JANET_JIT
+    JanetFunction *func = janet_stack_frame(fiber->data + fiber->frame)->func;
+    if (NULL != func) janet_jit_discard(func->def);
+#endif
+
+    /* A prefix runs together with the instruction after it */
+    if ((*pc & 0x7F) == JOP_WIDE) pc++;
+
     /* Set temporary breakpoints */
     switch (*pc & 0x7F) {
         default:
@@ -1360,6 +1991,12 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
     /* Clear last value */
     fiber->last_value = janet_wrap_nil();
 
+    /* Reopen the regions of the fiber on top of those of the resumer */
+    int region = janet_vm.gc_region;
+    int region_base = janet_vm.gc_region_base;
+    janet_vm.gc_region_base = region;
+    janet_vm.gc_region = region + fiber->region;
+
     /* Continue child fiber if it exists */
     if (fiber->child) {
         if (janet_vm.root_fiber == NULL) janet_vm.root_fiber = fiber;
@@ -1372,6 +2009,8 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
         if (sig != JANET_SIGNAL_OK && !(child->flags & (1 << sig))) {
             *out = in;
             janet_fiber_set_status(fiber, sig);
+            janet_vm.gc_region = region;
+            janet_vm.gc_region_base = region_base;
             return sig;
         }
         /* Check if we need any special handling for certain opcodes */
@@ -1424,6 +2063,9 @@ static JanetSignal janet_continue_no_check(JanetFiber *fiber, Janet in, Janet *o
     if (janet_vm.root_fiber == fiber) janet_vm.root_fiber = NULL;
     janet_fiber_set_status(fiber, sig);
     janet_restore(&tstate);
+    fiber->region = janet_vm.gc_region - janet_vm.gc_region_base;
+    janet_vm.gc_region = region;
+    janet_vm.gc_region_base = region_base;
     fiber->last_value = tstate.payload;
     *out = tstate.payload;
 
@@ -1484,14 +2126,81 @@ Janet janet_mcall(const char *name, int32_t argc, Janet *argv) {
     return janet_method_invoke(method, argc, argv);
 }
 
+#ifdef JANET_VM_COUNTERS
+
+/* Forget the counters of a function definition that is being freed */
+void janet_counters_discard(JanetFuncDef *def) {
+    if (NULL == def->counters) return;
+    for (size_t i = 0; i < janet_vm.counted_count; i++) {
+        if (janet_vm.counted_defs[i] == def) {
+            janet_vm.counted_defs[i] = janet_vm.counted_defs[--janet_vm.counted_count];
+            break;
+        }
+    }
+    janet_free(def->counters);
+    def->counters = NULL;
+}
+
+void janet_counters_reset(void) {
+    for (size_t i = 0; i < janet_vm.counted_count; i++) {
+        janet_free(janet_vm.counted_defs[i]->counters);
+        janet_vm.counted_defs[i]->counters = NULL;
+    }
+    janet_vm.counted_count = 0;
+    memset(janet_vm.op_counts, 0, sizeof(janet_vm.op_counts));
+    janet_free(janet_vm.pair_counts);
+    janet_vm.pair_counts = NULL;
+    janet_vm.last_op = -1;
+}
+
+#endif
+
 /* Setup VM */
 int janet_init(void) {
 
     /* Garbage collection */
+    for (int i = 0; i < JANET_GC_SIZE_CLASSES; i++) {
+        janet_vm.gc_pools[i].pages = NULL;
+        janet_vm.gc_pools[i].available = NULL;
+        janet_vm.gc_pools[i].unswept = NULL;
+    }
+    janet_vm.young_pages = NULL;
     janet_vm.blocks = NULL;
+    janet_vm.old_blocks = NULL;
+    janet_vm.remembered = NULL;
+    janet_vm.remembered_count = 0;
+    janet_vm.remembered_capacity = 0;
+    janet_vm.gc_grey = NULL;
+    janet_vm.gc_grey_count = 0;
+    janet_vm.gc_grey_capacity = 0;
+    janet_vm.gc_weak = NULL;
+    janet_vm.gc_weak_count = 0;
+    janet_vm.gc_weak_capacity = 0;
+    janet_vm.gc_pending = NULL;
+    janet_vm.gc_pending_count = 0;
+    janet_vm.gc_pending_capacity = 0;
+    janet_vm.gc_background = NULL;
+    janet_vm.gc_unswept = 0;
     janet_vm.next_collection = 0;
     janet_vm.gc_interval = 0x400000;
+    janet_vm.gc_trigger = janet_vm.gc_interval;
+    janet_vm.gc_target = JANET_GC_TARGET;
+    janet_vm.gc_limit = 0;
+    janet_vm.gc_live_bytes = 0;
+    janet_vm.gc_data_bytes = 0;
+    janet_vm.gc_swept_data = 0;
+    janet_vm.gc_pause = JANET_GC_PAUSE;
+    janet_vm.gc_marking = 0;
+    janet_vm.gc_threads = 0;
+    janet_vm.gc_region = 0;
+    janet_vm.gc_region_base = 0;
+    janet_vm.gc_region_bytes = 0;
     janet_vm.block_count = 0;
+    janet_vm.old_block_count = 0;
+    janet_vm.old_block_limit = JANET_GC_OLD_MIN;
+    memset(&janet_vm.gc_stats, 0, sizeof(JanetGCStats));
+    janet_vm.gc_profile = NULL;
+    janet_vm.gc_sample_left = SIZE_MAX;
 
     janet_symcache_init();
 
@@ -1529,6 +2238,22 @@ int janet_init(void) {
     janet_vm.fiber = NULL;
     janet_vm.root_fiber = NULL;
     janet_vm.stackn = 0;
+    memset(janet_vm.fiber_pool, 0, sizeof(janet_vm.fiber_pool));
+    janet_vm.fiber_pool_bytes = 0;
+
+#ifdef JANET_PROFILE
+    janet_vm.profile = NULL;
+#endif
+
+#ifdef JANET_VM_COUNTERS
+    janet_vm.counting = 0;
+    memset(janet_vm.op_counts, 0, sizeof(janet_vm.op_counts));
+    janet_vm.pair_counts = NULL;
+    janet_vm.last_op = -1;
+    janet_vm.counted_defs = NULL;
+    janet_vm.counted_count = 0;
+    janet_vm.counted_capacity = 0;
+#endif
 
 #ifdef JANET_THREADS
     janet_threads_init();
@@ -1544,7 +2269,11 @@ int janet_init(void) {
 
 /* Clear all memory associated with the VM */
 void janet_deinit(void) {
+#ifdef JANET_PROFILE
+    janet_profile_deinit();
+#endif
     janet_clear_memory();
+    janet_fiber_pool_clear();
     janet_symcache_deinit();
     janet_free(janet_vm.roots);
     janet_vm.roots = NULL;
@@ -1555,6 +2284,14 @@ void janet_deinit(void) {
     janet_vm.core_env = NULL;
     janet_vm.top_dyns = NULL;
     janet_free(janet_vm.traversal_base);
+#ifdef JANET_VM_COUNTERS
+    janet_free(janet_vm.counted_defs);
+    janet_vm.counted_defs = NULL;
+    janet_vm.counted_count = 0;
+    janet_vm.counted_capacity = 0;
+    janet_free(janet_vm.pair_counts);
+    janet_vm.pair_counts = NULL;
+#endif
     janet_vm.fiber = NULL;
     janet_vm.root_fiber = NULL;
 #ifdef JANET_THREADS
@@ -154,6 +154,7 @@ extern "C" {
 #ifdef JANET_SINGLE_THREADED
 #define JANET_THREAD_LOCAL
 #undef JANET_THREADS
+#undef JANET_PARALLEL_GC
 #elif defined(__GNUC__)
 #define JANET_THREAD_LOCAL __thread
 #elif defined(_MSC_BUILD)
@@ -161,6 +162,7 @@ extern "C" {
 #else
 #define JANET_THREAD_LOCAL
 #undef JANET_THREADS
+#undef JANET_PARALLEL_GC
 #endif
 
 /* Enable or disable dynamic module loading. Enabled by default. */
@@ -188,6 +190,11 @@ extern "C" {
 #define JANET_NET
 #endif
 
+/* Enable or disable the sampling profiler */
+#if !defined(JANET_NO_PROFILE) && !defined(JANET_WINDOWS) && !defined(__EMSCRIPTEN__)
+#define JANET_PROFILE
+#endif
+
 /* Enable or disable large int types (for now 64 bit, maybe 128 / 256 bit integer types) */
 #ifndef JANET_NO_INT_TYPES
 #define JANET_INT_TYPES
@@ -252,6 +259,11 @@ extern "C" {
 #endif
 #endif
 
+/* The JIT emits x86-64 code for nanboxed values */
+#if defined(JANET_JIT) && !(defined(JANET_NANBOX_64) && defined(__x86_64__) && defined(__linux__))
+#undef JANET_JIT
+#endif
+
 /* Runtime config constants */
 #ifdef JANET_NO_NANBOX
 #define JANET_NANBOX_BIT 0
@@ -269,6 +281,10 @@ extern "C" {
     (JANET_SINGLE_THREADED_BIT | \
      JANET_NANBOX_BIT)
 
+/* Oldest minor version whose native modules can be loaded. Bumped when a public
+ * structure that modules allocate themselves, such as JanetAbstractType, grows. */
+#define JANET_ABI_MINOR 17
+
 /* Represents the settings used to compile Janet, as well as the version */
 typedef struct {
     unsigned major;
@@ -833,8 +849,9 @@ JANET_API JanetAbstract janet_checkabstract(Janet x, const JanetAbstractType *at
 #define janet_checktypes(x, tps) ((1 << janet_type(x)) & (tps))
 
 /* GC Object type pun. The lower 16 bits of flags are reserved for the garbage collector,
- * but the upper 16 can be used per type for custom flags. The current collector is a linked
- * list of blocks, which is naive but works. */
+ * but the upper 16 can be used per type for custom flags. Small objects live in size-class
+ * pages, where next links free slots; large objects are kept in linked lists of blocks
+ * for a young and an old generation. */
 struct JanetGCObject {
     int32_t flags;
     JanetGCObject *next;
@@ -863,6 +880,7 @@ struct JanetFiber {
     uint32_t sched_id; /* Increment everytime fiber is scheduled by event loop */
     void *supervisor_channel; /* Channel to push self to when complete */
 #endif
+    int32_t region; /* Depth of the memory regions opened by the fiber */
 };
 
 /* Mark if a stack frame is a tail call for debugging */
@@ -910,6 +928,14 @@ struct JanetTable {
     JanetTable *proto;
 };
 
+/* Flags for weak tables, see janet_table_weak. Entries of a table with weak
+ * keys or weak values are removed once the key or value is garbage collected.
+ * An ephemeron table has weak keys, and its values are only kept alive
+ * through their keys. */
+#define JANET_TABLE_FLAG_WEAK_K 0x20000
+#define JANET_TABLE_FLAG_WEAK_V 0x40000
+#define JANET_TABLE_FLAG_EPHEMERON 0x80000
+
 /* A key value pair in a struct or table */
 struct JanetKV {
     Janet key;
@@ -961,6 +987,8 @@ struct JanetAbstractHead {
 #define JANET_FUNCDEF_FLAG_HASSOURCEMAP 0x800000
 #define JANET_FUNCDEF_FLAG_STRUCTARG 0x1000000
 #define JANET_FUNCDEF_FLAG_HASCLOBITSET 0x2000000
+#define JANET_FUNCDEF_FLAG_STACKENV 0x4000000
+#define JANET_FUNCDEF_FLAG_HASNOESCAPE 0x8000000
 #define JANET_FUNCDEF_FLAG_TAG 0xFFFF
 
 /* Source mapping structure for a bytecode instruction */
@@ -992,6 +1020,16 @@ struct JanetFuncDef {
     int32_t bytecode_length;
     int32_t environments_length;
     int32_t defs_length;
+    uint32_t noescape; /* Parameters (low 31 bits) and self (high bit) that never outlive a call. */
+    int32_t *icache; /* Inline cache of keyword lookups per instruction, allocated on first use. */
+
+#ifdef JANET_JIT
+    struct JanetJitCode *jit; /* Native code compiled from the bytecode, if any. */
+    int32_t jit_hotness; /* Calls and loop iterations since the last attempt to compile. */
+#endif
+#ifdef JANET_VM_COUNTERS
+    uint64_t *counters; /* Executions of each instruction while counting, allocated on first use. */
+#endif
 };
 
 /* A function environment */
@@ -1067,6 +1105,7 @@ struct JanetAbstractType {
     int32_t (*hash)(void *p, size_t len);
     Janet(*next)(void *p, Janet key);
     Janet(*call)(void *p, int32_t argc, Janet *argv);
+    int (*gcasync)(void *data, size_t len);
 };
 
 /* Some macros to let us add extra types to JanetAbstract types without
@@ -1084,7 +1123,8 @@ struct JanetAbstractType {
 #define JANET_ATEND_COMPARE     NULL,JANET_ATEND_HASH
 #define JANET_ATEND_HASH        NULL,JANET_ATEND_NEXT
 #define JANET_ATEND_NEXT        NULL,JANET_ATEND_CALL
-#define JANET_ATEND_CALL
+#define JANET_ATEND_CALL        NULL,JANET_ATEND_GCASYNC
+#define JANET_ATEND_GCASYNC
 
 struct JanetReg {
     const char *name;
@@ -1264,6 +1304,13 @@ enum JanetOpCode {
     JOP_NOT_EQUALS,
     JOP_NOT_EQUALS_IMMEDIATE,
     JOP_CANCEL,
+    JOP_LESS_THAN_JUMP_IF_NOT,
+    JOP_LESS_THAN_IMMEDIATE_JUMP_IF_NOT,
+    JOP_WIDE,
+    JOP_LESS_THAN_JUMP_IF,
+    JOP_LESS_THAN_IMMEDIATE_JUMP_IF,
+    JOP_ADD_IMMEDIATE_LESS_THAN_JUMP_IF,
+    JOP_ADD_IMMEDIATE_LESS_THAN_IMMEDIATE_JUMP_IF,
     JOP_INSTRUCTION_COUNT
 };
 
@@ -1400,6 +1447,7 @@ struct JanetAssembleResult {
     JanetString error;
     enum JanetAssembleStatus status;
 };
+#define JANET_ASM_OPTIMIZE 0x1
 JANET_API JanetAssembleResult janet_asm(Janet source, int flags);
 JANET_API Janet janet_disasm(JanetFuncDef *def);
 JANET_API Janet janet_asm_decode_instruction(uint32_t instr);
@@ -1543,6 +1591,7 @@ JANET_API const JanetKV *janet_struct_find(JanetStruct st, Janet key);
 
 /* Table functions */
 JANET_API JanetTable *janet_table(int32_t capacity);
+JANET_API JanetTable *janet_table_weak(int32_t capacity, int32_t flags);
 JANET_API JanetTable *janet_table_init(JanetTable *table, int32_t capacity);
 JANET_API void janet_table_deinit(JanetTable *table);
 JANET_API Janet janet_table_get(JanetTable *t, Janet key);
@@ -1602,6 +1651,43 @@ JANET_API Janet janet_unmarshal(
 JANET_API JanetTable *janet_env_lookup(JanetTable *env);
 JANET_API void janet_env_lookup_into(JanetTable *renv, JanetTable *env, const char *prefix, int recurse);
 
+/* GC statistics. Blocks and bytes are broken down by memory type, which is
+ * finer than JanetType, see janet_gc_type_name. Pause times are in nanoseconds,
+ * and bucket i of the histogram counts pauses shorter than 2^i microseconds
+ * that do not fit in an earlier bucket. live_bytes is the size of the heap
+ * measured by the last full collection. large_count and large_bytes count the
+ * data of arrays, buffers and fibers that is mapped directly from the OS. */
+#define JANET_GC_MEMORY_TYPES 13
+#define JANET_GC_HISTOGRAM_SIZE 24
+typedef struct {
+    uint64_t minor_collections;
+    uint64_t full_collections;
+    uint64_t pauses;
+    uint64_t pause_total;
+    uint64_t pause_max;
+    uint64_t pause_histogram[JANET_GC_HISTOGRAM_SIZE];
+    size_t blocks[JANET_GC_MEMORY_TYPES];
+    size_t bytes[JANET_GC_MEMORY_TYPES];
+    size_t block_count;
+    size_t old_block_count;
+    size_t root_count;
+    size_t scratch_count;
+    size_t scratch_bytes;
+    size_t live_bytes;
+    size_t large_count;
+    size_t large_bytes;
+} JanetGCStats;
+
+/* What to count in a heap profile, see janet_gc_profile_dump */
+typedef enum {
+    JANET_GC_PROFILE_INUSE_SPACE,
+    JANET_GC_PROFILE_INUSE_OBJECTS,
+    JANET_GC_PROFILE_ALLOC_SPACE,
+    JANET_GC_PROFILE_ALLOC_OBJECTS,
+    JANET_GC_PROFILE_SURVIVED_SPACE,
+    JANET_GC_PROFILE_SURVIVED_OBJECTS
+} JanetGCProfileKind;
+
 /* GC */
 JANET_API void janet_mark(Janet x);
 JANET_API void janet_sweep(void);
@@ -1613,6 +1699,12 @@ JANET_API int janet_gcunrootall(Janet root);
 JANET_API int janet_gclock(void);
 JANET_API void janet_gcunlock(int handle);
 JANET_API void janet_gcpressure(size_t s);
+JANET_API void janet_gc_stats(JanetGCStats *stats);
+JANET_API const char *janet_gc_type_name(int type);
+JANET_API void janet_gc_set_limit(size_t limit);
+JANET_API void janet_gc_set_target(size_t target);
+JANET_API void janet_gc_profile(size_t rate);
+JANET_API void janet_gc_profile_dump(JanetBuffer *buffer, JanetGCProfileKind kind);
 
 /* Functions */
 JANET_API JanetFuncDef *janet_funcdef_alloc(void);
@@ -1680,6 +1772,10 @@ JANET_API void *janet_scalloc(size_t nmemb, size_t size);
 JANET_API void janet_sfinalizer(void *mem, JanetScratchFinalizer finalizer);
 JANET_API void janet_sfree(void *mem);
 
+/* Memory regions */
+JANET_API int janet_region_begin(void);
+JANET_API void janet_region_end(int handle);
+
 /* C Library helpers */
 typedef enum {
     JANET_BINDING_NONE,